@@ -0,0 +1,44 @@
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Allocator of cache memory. Sizes up to ARENA_MAX_CLASS are rounded up
+// to size classes, four per doubling, and carved from 2 MiB slabs of one
+// class each. Slabs are huge pages if MAP_HUGETLB ones are available, or
+// aligned regions marked for transparent huge pages otherwise, and are
+// given back as soon as they are empty. Larger sizes are mapped on their
+// own, rounded up to pages. Safe to use from several threads.
+typedef struct CacheArena CacheArena;
+
+#define ARENA_MAX_CLASS ((size_t) 256 * 1024)
+
+typedef struct {
+    // Mapped from the system: slabs and large objects
+    size_t reserved;
+    // Handed out, rounded up to size classes or pages
+    size_t allocated;
+    // Asked for. allocated - requested is lost to rounding, reserved -
+    // allocated to partially used slabs.
+    size_t requested;
+    size_t slab_count;
+    // Slabs backed by MAP_HUGETLB pages
+    size_t hugetlb_slab_count;
+    size_t large_count;
+} CacheArenaStats;
+
+CacheArena *CreateCacheArena(void);
+// All allocations have to be freed by then
+void DestroyCacheArena(CacheArena *arena);
+
+// NULL if memory can't be mapped
+void *ArenaAlloc(CacheArena *arena, size_t size);
+// Size has to be the one data was allocated with
+void ArenaFree(CacheArena *arena, void *data, size_t size);
+
+// Counters are read one by one, they may be slightly inconsistent while
+// other threads allocate
+CacheArenaStats GetCacheArenaStats(CacheArena *arena);
+
+#endif // ARENA_H__
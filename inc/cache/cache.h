@@ -2,6 +2,9 @@
 #define CACHE_H__
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "cache/arena.h"
 
 typedef struct CacheManager CacheManager;
 
@@ -11,6 +14,9 @@ struct ReadBuffer {
     const char *data;
     const size_t *size;
     const size_t *used;
+    // Data can also be sent from this descriptor with sendfile(), at the
+    // same offsets (-1 - none)
+    const int fd;
 
     BufferMeta * const meta;
 };
@@ -32,10 +38,69 @@ void UnlockReadBuffer(ReadBuffer *buffer);
 void LockWriteBuffer(WriteBuffer *buffer);
 void UnlockWriteBuffer(WriteBuffer *buffer);
 
+// Bytes of buffer that are loaded, readable without buffer lock
+size_t GetBufferUsed(const ReadBuffer *buffer);
+
+typedef enum {
+    BUFFER_LOAD_PROGRESS,
+    BUFFER_LOAD_DONE,
+    BUFFER_LOAD_FAILED
+} BufferLoadEvent;
+
+typedef struct BufferWaiter BufferWaiter;
+
+// Request waiting for buffer being filled by someone else. Callback is
+// called from the loading thread after each published part and once
+// more when loading ends, after that the waiter is dropped.
+struct BufferWaiter {
+    void (*callback)(BufferLoadEvent event, void *userData);
+    void *userData;
+
+    BufferWaiter *_next;
+};
+
+// Claims buffer for filling, so that concurrent misses don't load it twice.
+// Returns ERR_BUFFER_LOADING if it is already being filled.
+int StartBufferLoad(WriteBuffer *buffer);
+// Sets used of claimed buffer and notifies its waiters
+void PublishBufferLoad(WriteBuffer *buffer, size_t used);
+// Drops the claim; buffer is complete if used reached size by then.
+// Waiters get BUFFER_LOAD_DONE or BUFFER_LOAD_FAILED.
+void FinishBufferLoad(WriteBuffer *buffer);
+// Waiter keeps buffer referenced until loading ends. Returns
+// ERR_BUFFER_NOT_LOADING if nobody fills the buffer (anymore).
+int AddBufferWaiter(ReadBuffer *buffer, BufferWaiter *waiter);
+
+// Which buffers are dropped when cache is full
+typedef enum {
+    // Least recently referenced first
+    EVICTION_POLICY_LRU,
+    // Small probationary FIFO in front of main FIFO, buffers not referenced
+    // again while in small queue leave without touching main one
+    EVICTION_POLICY_S3_FIFO,
+    // Small LRU window in front of segmented LRU, buffer leaving window is
+    // admitted only if it is referenced more often than main's victim
+    EVICTION_POLICY_W_TINYLFU
+} EvictionPolicy;
+
+// Where contents of buffers created by cache are kept
+typedef enum {
+    CACHE_STORAGE_HEAP,
+    // Shared memory file for each buffer, it takes a file descriptor
+    CACHE_STORAGE_MEMFD,
+    // Size-classed slabs of huge pages, see CacheArena
+    CACHE_STORAGE_ARENA
+} CacheStorage;
+
 struct CacheParams {
     size_t max_memory;
     size_t max_entries;
     size_t max_buffer_size;
+    EvictionPolicy policy;
+    // Independently locked parts of cache, each with its share of limits
+    // (0 - single one)
+    size_t shard_count;
+    CacheStorage storage;
 };
 
 typedef struct CacheParams CacheParams;
@@ -43,14 +108,68 @@ typedef struct CacheParams CacheParams;
 CacheManager *CreateCacheManager(const CacheParams *params);
 void DestroyCacheManager(CacheManager *manager);
 
-int CreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize);
+const char *EvictionPolicyName(EvictionPolicy policy);
+const char *CacheStorageName(CacheStorage storage);
+// Totals over all shards
+void GetCacheUsage(CacheManager *manager, size_t *used_memory, size_t *entry_count);
+// False unless storage is CACHE_STORAGE_ARENA
+bool GetCacheArenaUsage(CacheManager *manager, CacheArenaStats *stats);
 
+int CreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize);
+// Gets buffer of key or creates it as one step, so that concurrent misses
+// share a single entry. Buffer that is not filled and not being filled is
+// claimed for the caller: loader is set and has to be finished with
+// FinishBufferLoad. Otherwise loader is NULL.
+int GetOrCreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize,
+                      ReadBuffer **buffer, WriteBuffer **loader);
+// Same with file at path, key of the buffer, mapped read-only instead of
+// copied. Mapped buffers share pages with page cache and are loaded as
+// soon as they are created, the mapping is dropped with the last
+// reference after eviction. File has to be replaced rather than
+// truncated while it is mapped. Returns ERR_FILE_MAP if it can't be
+// mapped, empty files included.
+int GetOrMapBuffer(CacheManager *manager, const char *path, ReadBuffer **buffer);
+
+// Lookups of existing buffers take no locks. Every reference gets the same
+// handle of buffer, it stays valid until the reference is released.
 ReadBuffer *GetBuffer(CacheManager *manager, const char *key);
 WriteBuffer *GetWriteBuffer(CacheManager *manager, const char *key);
 
 void ReleaseBuffer(ReadBuffer *buffer);
 void ReleaseWriteBuffer(WriteBuffer *buffer);
 
+// Drops buffer of key from cache, so the next lookup misses. References
+// that are held keep the old contents until they are released.
+int InvalidateBuffer(CacheManager *manager, const char *key);
+// Same for every key that starts with prefix, returns how many were
+size_t InvalidateBuffersWithPrefix(CacheManager *manager, const char *prefix);
+
+// Refresh loads new contents of a cached key into a shadow buffer while
+// lookups keep getting the current one. Shadow is claimed for the caller
+// and filled with PublishBufferLoad, it is not seen by anybody until
+// committed. Returns ERR_KEY_NOT_FOUND if key is not cached.
+int StartBufferRefresh(CacheManager *manager, const char *key, const size_t bufferSize, WriteBuffer **shadow);
+// Swaps filled shadow in for the buffer of its key in one step, held
+// references to the old one are not disturbed. Shadow that was not
+// filled completely drops the key instead (ERR_BUFFER_INCOMPLETE). Shadow
+// handle can't be used after, whatever is returned.
+int CommitBufferRefresh(CacheManager *manager, WriteBuffer *shadow);
+// Maps file at path again and swaps it in like a committed refresh. Key
+// is dropped if file can't be mapped anymore.
+int RemapBuffer(CacheManager *manager, const char *path);
+
+// References to fully loaded buffers, coldest first within every shard as
+// its eviction queues order them. Takes at most capacity of them, returns
+// how many were taken.
+size_t CollectBuffers(CacheManager *manager, ReadBuffer **buffers, size_t capacity);
+const char *GetBufferKey(const ReadBuffer *buffer);
+// Modification time of file the buffer is filled from. Whoever claims a
+// load or refresh sets it from the stat its size came from, before
+// reading, so contents are never older than the mtime they carry. Mapped
+// buffers get the one of the mapped file. False if it was not set.
+void SetBufferMtime(WriteBuffer *buffer, const struct timespec *mtime);
+bool GetBufferMtime(const ReadBuffer *buffer, struct timespec *mtime);
+
 
 #define ERR_OK 0
 #define ERR_MEMORY 1
@@ -61,6 +180,13 @@ void ReleaseWriteBuffer(WriteBuffer *buffer);
 #define ERR_KEY_NOT_FOUND 6
 #define ERR_BUFFERS_USED 7
 #define ERR_BUFFER_REFERENCED 8
+#define ERR_BUFFER_LOADING 9
+#define ERR_BUFFER_NOT_LOADING 10
+#define ERR_BUFFER_INCOMPLETE 11
+#define ERR_FILE_MAP 12
+#define ERR_SNAPSHOT_NOT_FOUND 13
+#define ERR_SNAPSHOT_IO 14
+#define ERR_SNAPSHOT_FORMAT 15
 
 
 #endif // CACHE_H__
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef SKETCH_H__
+#define SKETCH_H__
+
+#include <stddef.h>
+
+// Count-min sketch of access frequencies. Counters saturate at
+// SKETCH_MAX_FREQUENCY and are all halved after 10 increments per expected
+// entry, so that keys which were popular long ago lose their weight.
+typedef struct FrequencySketch FrequencySketch;
+
+#define SKETCH_MAX_FREQUENCY 15
+
+FrequencySketch *CreateFrequencySketch(size_t expected_entries);
+void DestroyFrequencySketch(FrequencySketch *sketch);
+
+void IncrementFrequency(FrequencySketch *sketch, unsigned long key_hash);
+// Estimate never undercounts since the last aging, but may overcount
+// if keys collide in every row
+unsigned EstimateFrequency(const FrequencySketch *sketch, unsigned long key_hash);
+
+#endif // SKETCH_H__
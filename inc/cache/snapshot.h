@@ -0,0 +1,29 @@
+#ifndef SNAPSHOT_H__
+#define SNAPSHOT_H__
+
+#include "cache/cache.h"
+
+// On-disk copy of cached files, so that a restarted server starts warm
+// from one sequential read. Keys have to be paths of files: entries keep
+// size and mtime the file had when saved, and are only restored if it
+// still has them. Entries are stored coldest first, restoring them in
+// that order gives the hottest ones the most recent places again.
+
+typedef struct {
+    // Saved or restored
+    size_t entries;
+    // Of contents saved or restored
+    size_t bytes;
+    // Files that changed, went away or didn't fit into cache
+    size_t skipped;
+} CacheSnapshotStats;
+
+// Written to a temporary file renamed over path when complete. Without
+// bodies only keys and metadata are saved and files are read again on
+// restore.
+int SaveCacheSnapshot(CacheManager *manager, const char *path, bool bodies, CacheSnapshotStats *stats);
+// Returns ERR_SNAPSHOT_NOT_FOUND if there is no snapshot at path. Entries
+// are mapped instead of copied with map_files, see GetOrMapBuffer.
+int LoadCacheSnapshot(CacheManager *manager, const char *path, bool map_files, CacheSnapshotStats *stats);
+
+#endif // SNAPSHOT_H__
@@ -0,0 +1,53 @@
+#ifndef WARMUP_H__
+#define WARMUP_H__
+
+#include "cache/cache.h"
+#include "reader/reader.h"
+
+// Thread that preloads files under a directory into the cache, so that
+// traffic after a restart does not start with a cold one. Files are read
+// by all threads of a reader pool at once, lookups meanwhile share their
+// entries. Keys are paths of files under root, like the watcher expects.
+typedef struct CacheWarmup CacheWarmup;
+
+typedef struct {
+    const char *root;
+    // File with one path or fnmatch(3) pattern relative to root per line,
+    // '*' matches '/' as well. Earlier lines are loaded first, '#' starts
+    // a comment (NULL - every file under root)
+    const char *manifest;
+    // Larger files are skipped (0 - no limit)
+    size_t max_file_size;
+    // Files are added while they fit into these without evicting anything
+    size_t max_memory;
+    size_t max_entries;
+
+    FileReaderPool *pool;
+    // Reads queued at once, keep them within the pool request limit
+    size_t parallel_reads;
+    // Files are mapped instead of read, see GetOrMapBuffer
+    bool map_files;
+} CacheWarmupParams;
+
+typedef struct {
+    // Files and bytes selected to be loaded
+    size_t total_files;
+    size_t total_bytes;
+    size_t loaded_files;
+    size_t loaded_bytes;
+    // Did not fit into cache or failed to load
+    size_t skipped_files;
+    bool done;
+} CacheWarmupProgress;
+
+// NULL if manifest can't be read. Progress is logged while files are
+// loaded.
+CacheWarmup *CreateCacheWarmup(CacheManager *manager, const CacheWarmupParams *params);
+// Waits until every selected file was loaded or skipped
+void WaitCacheWarmup(CacheWarmup *warmup);
+// Stops loading and waits for reads in flight
+void DestroyCacheWarmup(CacheWarmup *warmup);
+
+CacheWarmupProgress GetCacheWarmupProgress(CacheWarmup *warmup);
+
+#endif // WARMUP_H__
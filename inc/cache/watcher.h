@@ -0,0 +1,28 @@
+#ifndef WATCHER_H__
+#define WATCHER_H__
+
+#include "cache/cache.h"
+#include "reader/reader.h"
+
+// Thread that follows changes under a directory with inotify and drops
+// cache buffers of files that were modified, moved or deleted. Keys of
+// the cache have to be paths of files under root.
+typedef struct CacheWatcher CacheWatcher;
+
+typedef struct {
+    const char *root;
+    // Files written or replaced are read again with it into shadow buffers
+    // while their cached versions are still served, moved away or deleted
+    // ones are dropped (NULL - every changed file is dropped)
+    FileReaderPool *refresh_pool;
+    // Refreshed files are mapped again instead of read, see GetOrMapBuffer.
+    // Mapping shares pages with the file, so files written in place are
+    // dropped meanwhile rather than served.
+    bool map_files;
+} CacheWatcherParams;
+
+// NULL if root can't be watched
+CacheWatcher *CreateCacheWatcher(CacheManager *manager, const CacheWatcherParams *params);
+void DestroyCacheWatcher(CacheWatcher *watcher);
+
+#endif // WATCHER_H__
@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <uuid/uuid.h>
 
+// Files are read in chunks of this size, progress is reported after each one
+#define READER_CHUNK_SIZE (1024 * 1024)
+
 typedef struct FileReaderPool FileReaderPool;
 
 typedef struct FileReadRequest FileReadRequest;
@@ -18,6 +21,9 @@ struct FileReadRequest {
 
     void (*callback)(FileReadResponse *response, void *userData);
     void *userData;
+    // Optional, called from reader thread with bytes in buffer so far,
+    // before callback reports completion
+    void (*progress)(size_t bytesRead, void *userData);
 };
 
 struct FileReadSet {
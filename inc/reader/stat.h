@@ -19,6 +19,8 @@ typedef struct {
     time_t last_modified;
     time_t last_accessed;
     time_t created;
+    // last_modified with nanoseconds
+    struct timespec mtime;
 } FileStatResponse;
 
 FileStatResponse GetFileStat(const char *path);
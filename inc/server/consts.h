@@ -24,7 +24,11 @@
 #define HTTP_HEADER_CONTENT_TYPE "Content-Type: "
 #define HTTP_HEADER_DATE "Date: "
 #define HTTP_HEADER_LAST_MODIFIED "Last-Modified: "
+#define HTTP_HEADER_CONNECTION "Connection: "
 #define HTTP_HEADER_DELIMITER "\r\n"
 
+#define HTTP_CONNECTION_KEEP_ALIVE "keep-alive"
+#define HTTP_CONNECTION_CLOSE "close"
+
 
 #endif // HTTP_CONSTS_H__
\ No newline at end of file
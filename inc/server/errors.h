@@ -16,6 +16,7 @@
 #define ERR_WORKER_MAX_REQUESTS_EXCEEDED 11
 #define ERR_WORKER_READ_ERROR 12
 #define ERR_WORKER_WRITE_ERROR 13
+#define ERR_WORKER_POLL_ERROR 22
 
 
 #define ERR_SERVER_NOT_RUNNING 14
@@ -25,11 +26,13 @@
 
 
 #define ERR_REQUEST_READ_END 18
-#define ERR_REQUEST_NONBLOCKED_ERROR 18
+#define ERR_REQUEST_NONBLOCKED_ERROR 23
 #define ERR_REQUEST_READ_ERROR 19
+#define ERR_REQUEST_CLOSED 25
 
 #define ERR_RESPONSE_WRITE_END 20
-#define ERR_RESPONSE_NONBLOCKED_ERROR 20
+#define ERR_RESPONSE_NONBLOCKED_ERROR 24
 #define ERR_RESPONSE_WRITE_ERROR 21
+#define ERR_RESPONSE_BODY_PENDING 26
 
 #endif
\ No newline at end of file
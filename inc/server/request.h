@@ -9,11 +9,18 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define INITITAL_REQUEST_BUFFER_SIZE 3192
 #define INITITAL_PARSED_BUFFERS_SIZE 1024
 #define INITIAL_RESPONSE_HEADER_SIZE 1024
 
+// Pipelined responses kept per connection before reading further requests
+#define RESPONSE_MAX_QUEUED 16
+// Segments gathered into a single send
+#define RESPONSE_MAX_IOV 32
+
 typedef enum  {
     HTTP_REQUEST_GET,
     HTTP_REQUEST_HEAD,
@@ -31,6 +38,9 @@ typedef enum {
 
 typedef struct  {
     DynamicString *request_buffer;
+    // Length of the first complete request head in buffer (0 - incomplete),
+    // bytes after it belong to the next request on the connection
+    size_t head_size;
 } RawHttpRequest;
 
 typedef struct {
@@ -38,6 +48,8 @@ typedef struct {
     DynamicString *path;
     DynamicString *user_agent;
     DynamicString *host;    
+    // Client allows persistent connection (HTTP/1.1 default or Connection header)
+    bool keep_alive;
 } ParsedHttpRequest ;
 
 typedef struct  {
@@ -49,6 +61,8 @@ typedef struct  {
 
 typedef struct  {
     ReadBuffer *body;
+    // Opened file sent with sendfile() instead of cached body (-1 - none)
+    int file_fd;
 } HttpResponseDataBody;
 
 typedef struct  {
@@ -56,12 +70,19 @@ typedef struct  {
     HttpResponseDataBody body;
 } HttpResponseData;
 
-typedef struct  {
+typedef struct HttpResponseRaw HttpResponseRaw;
+
+struct HttpResponseRaw {
     DynamicString *header_buffer;
     size_t header_bytes_written;
     ReadBuffer *body_buffer;
+    // File body: bytes_written is file offset, sent up to body_file_size
+    int body_fd;
+    size_t body_file_size;
     size_t body_bytes_written;
-} HttpResponseRaw;
+    // Next response in connection queue
+    HttpResponseRaw *next;
+};
 
 typedef struct {
     int socketfd;
@@ -72,6 +93,18 @@ typedef struct {
 
     HttpResponseData *response;
     HttpResponseRaw *raw_response;
+
+    // Connection stays open after response, set before preparing it
+    bool keep_alive;
+    // Cached bodies that have a descriptor are sent with sendfile() like
+    // file bodies, by engines writing with WriteRequest
+    bool sendfile_buffers;
+
+    // Finished responses of earlier pipelined requests, sent in order
+    // before raw_response
+    HttpResponseRaw *queued_responses;
+    HttpResponseRaw *queued_tail;
+    size_t queued_count;
 } HttpRequest;
 
 
@@ -81,14 +114,46 @@ void DestroyHttpRequest(HttpRequest *request);
 int ParseHttpRequest(HttpRequest *request);
 int FillHttpResponseHeader(HttpRequest *request, FileStatResponse stat);
 int AddHttpResponseBody(HttpRequest *request, ReadBuffer *body);
+// Response takes ownership of fd, body is sent from file with sendfile()
+int AddHttpResponseFile(HttpRequest *request, int fd);
 int PrepareHttpResponseOk(HttpRequest *request);
 int PrepareHttpResponseForbidden(HttpRequest *request);
 int PrepareHttpResponseNotFound(HttpRequest *request);
 int PrepareHttpResponseUnsupportedMethod(HttpRequest *request);
 
+// Drops finished request and response, keeping buffers and bytes already
+// read for the next request. Returns ERR_REQUEST_READ_END if they hold
+// a complete request head.
+int ResetHttpRequest(HttpRequest *request);
+// Bytes after current request head contain another complete request head
+bool HasPipelinedRequest(HttpRequest *request);
+// Moves prepared response to connection queue, so next request can be
+// processed while it is still being sent
+int QueueHttpResponse(HttpRequest *request);
+
 int ReadRequest(HttpRequest *request);
 int WriteRequest(HttpRequest *request);
 
+// Split read/write steps for engines doing socket I/O themselves
+int GetRequestReadBuffer(HttpRequest *request, char **to, size_t *upto);
+int CommitRequestRead(HttpRequest *request, size_t bytes_read);
+// Fills iov with unsent queued responses followed by the prepared one,
+// headers and bodies as separate segments. truncated is set if more ready
+// bytes follow: iov is full or a file body comes next. Returns
+// ERR_RESPONSE_WRITE_END if there is nothing to send and
+// ERR_RESPONSE_BODY_PENDING if the rest of body is not loaded yet.
+int GetResponseWriteVector(HttpRequest *request, struct iovec *iov, int max_iov,
+                           int *iov_count, bool *truncated);
+// Returns ERR_OK if next bytes to send are file body, or cached body with
+// descriptor if sendfile_buffers is set: count bytes from offset of fd.
+// ERR_RESPONSE_WRITE_END otherwise.
+int GetResponseWriteFile(HttpRequest *request, int *fd, off_t *offset, size_t *count);
+// Advances over bytes_written, dropping queued responses that were sent
+int CommitResponseWrite(HttpRequest *request, size_t bytes_written);
+// Response bytes not yet written to socket, including known body size
+// of response still waiting for its body
+size_t GetResponseBytesLeft(HttpRequest *request);
+
 int AddPathPrefix(HttpRequest *request, const char *prefix);
 int ReplacePath(HttpRequest *request, const char *path);
 
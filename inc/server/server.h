@@ -6,6 +6,14 @@
 
 typedef struct Server Server;
 
+// How accept loop picks worker for new connection
+typedef enum {
+    ASSIGN_POLICY_ROUND_ROBIN,
+    ASSIGN_POLICY_LEAST_CONNECTIONS,
+    ASSIGN_POLICY_LEAST_BYTES,
+    ASSIGN_POLICY_POWER_OF_TWO
+} AssignPolicy;
+
 typedef struct {
     const char *static_root;
     u_int16_t port;
@@ -13,11 +21,38 @@ typedef struct {
     size_t max_cache_size;
     size_t max_cache_entries;
     size_t max_cache_entry_size;
+    EvictionPolicy cache_policy;
+    size_t cache_shards;
+    CacheStorage cache_storage;
+    // Changed files keep being served from cache while they are read again
+    // in background, instead of being dropped
+    bool cache_refresh;
+    // Cached files share pages with page cache instead of being copied,
+    // files have to be replaced rather than truncated then
+    bool cache_mmap;
+    // Files are preloaded into cache at startup, while traffic is served
+    bool cache_warmup;
+    // Paths or globs under static root to preload (NULL - every file)
+    const char *warmup_manifest;
+    // Larger files are not preloaded (0 - no limit)
+    size_t warmup_max_file_size;
+    // Cache is saved there on graceful shutdown and restored from it at
+    // startup (NULL - starts empty)
+    const char *cache_snapshot;
+    // Snapshot holds contents of files, otherwise they are read again
+    bool snapshot_bodies;
 
     size_t reader_count;
 
     size_t max_requests;
     size_t worker_count;
+    WorkerBackend worker_backend;
+    unsigned keepalive_timeout;
+    size_t keepalive_max_requests;
+    size_t sendfile_threshold;
+    // Per-worker SO_REUSEPORT listeners instead of the central accept loop
+    bool reuseport;
+    AssignPolicy assign_policy;
 } ServerParams;
 
 Server *CreateServer(const ServerParams *params);
@@ -27,4 +62,6 @@ int StartServer(Server *server);
 int ShutdownServer(Server *server);
 int GracefullyShutdownServer(Server *server);
 
+const char *AssignPolicyName(AssignPolicy policy);
+
 #endif // SERVER_H__
\ No newline at end of file
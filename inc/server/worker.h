@@ -9,10 +9,29 @@
 
 typedef struct Worker Worker;
 
+typedef enum {
+    WORKER_BACKEND_PSELECT,
+    WORKER_BACKEND_EPOLL,
+    WORKER_BACKEND_IO_URING
+} WorkerBackend;
+
 typedef struct {
     const char *static_root;
     size_t max_requests;
+    WorkerBackend backend;
+    // Idle timeout of persistent connections in seconds (0 - no keep-alive)
+    unsigned keepalive_timeout;
+    // Responses per persistent connection (0 - unlimited)
+    size_t keepalive_max_requests;
+    // Files of at least this size are streamed bypassing cache
+    // (0 - disabled, only files not fitting into cache are streamed)
+    size_t sendfile_threshold;
     CacheManager *cache_manager;
+    // Cached file of another size than on disk is being refreshed, so it is
+    // sent as cached instead of being loaded again
+    bool cache_refresh;
+    // Files are cached as read-only mappings instead of copies
+    bool cache_mmap;
     FileReaderPool *reader_pool;
 } WorkerParams;
 
@@ -23,8 +42,18 @@ int StartWorker(Worker *worker);
 int ShutdownWorker(Worker *worker);
 int GracefullyShutdownWorker(Worker *worker);
 
-
+// Socket has to be non-blocking, except for io_uring workers: those
+// complete O_NONBLOCK sockets with -EAGAIN instead of waiting for data.
 int AddRequest(Worker *worker, int socketfd);
+// Worker takes ownership of listening socket and accepts from it in its
+// own loop. Must be called before StartWorker.
+int SetWorkerListener(Worker *worker, int listenfd);
 pthread_t GetWorkerThread(Worker *worker);
 
+// Load counters, safe to read without worker lock (values may be stale)
+size_t GetWorkerRequestCount(Worker *worker);
+size_t GetWorkerPendingBytes(Worker *worker);
+
+const char *WorkerBackendName(WorkerBackend backend);
+
 #endif // WORKER_H__
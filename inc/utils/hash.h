@@ -4,5 +4,8 @@
 #include <stddef.h>
 
 unsigned long hash(const char *key, size_t table_size);
+// XXH64 of length bytes of key, seed 0. Full 64 bits, well mixed, reads
+// key eight bytes at a time.
+unsigned long hash64(const char *key, size_t length);
 
 #endif // HASH_H__
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef URING_H__
+#define URING_H__
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper over raw syscalls (no liburing dependency)
+
+typedef struct Uring Uring;
+
+Uring *CreateUring(unsigned entries);
+void DestroyUring(Uring *ring);
+
+// Returns free submission entry (zeroed) or NULL if submission queue is full
+struct io_uring_sqe *UringGetSqe(Uring *ring);
+
+// Submits prepared entries without waiting
+int UringSubmit(Uring *ring);
+// Submits prepared entries and waits for at least wait_nr completions.
+// timeout == NULL waits without limit.
+int UringSubmitAndWait(Uring *ring, unsigned wait_nr, const struct timespec *timeout);
+
+// Returns next completion or NULL. Must be followed by UringCqeSeen.
+struct io_uring_cqe *UringPeekCqe(Uring *ring);
+void UringCqeSeen(Uring *ring);
+
+void UringPrepRecv(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, void *user_data);
+void UringPrepSend(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags, void *user_data);
+// msg and buffers it points to must stay valid until completion
+void UringPrepSendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags, void *user_data);
+void UringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, size_t offset, void *user_data);
+void UringPrepAccept(struct io_uring_sqe *sqe, int fd, int flags, void *user_data);
+void UringPrepNop(struct io_uring_sqe *sqe, void *user_data);
+
+#define ERR_OK 0
+#define ERR_URING_SETUP 1
+#define ERR_URING_SUBMIT 2
+#define ERR_URING_TIMEOUT 3
+
+#endif // URING_H__
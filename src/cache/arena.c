@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include "cache/arena.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Size of a slab, also the huge page size it is aligned to
+#define ARENA_REGION_SIZE ((size_t) 2 * 1024 * 1024)
+// Asks for 2 MiB huge pages whatever the default size is
+#define ARENA_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+// Classes are 16 bytes apart up to ARENA_SMALL_LIMIT, then four per doubling
+#define ARENA_SMALL_STEP 16
+#define ARENA_SMALL_LIMIT 128
+#define ARENA_SMALL_CLASSES (ARENA_SMALL_LIMIT / ARENA_SMALL_STEP)
+#define ARENA_CLASSES_PER_DOUBLING 4
+// Doublings from ARENA_SMALL_LIMIT to ARENA_MAX_CLASS
+#define ARENA_DOUBLINGS 11
+#define ARENA_CLASS_COUNT (ARENA_SMALL_CLASSES + ARENA_DOUBLINGS * ARENA_CLASSES_PER_DOUBLING)
+// Objects of a slab start after its header, aligned to a cache line
+#define ARENA_SLAB_HEADER ((sizeof(ArenaSlab) + 63) & ~(size_t) 63)
+
+typedef struct ArenaSlab ArenaSlab;
+
+// Lives at the start of its region, so that objects find it by aligning
+// their address down
+struct ArenaSlab {
+    size_t class_index;
+    size_t capacity;
+    size_t used;
+    // Freed objects, linked through their first bytes
+    void *free;
+    // Objects from here on were never handed out
+    char *untouched;
+    bool hugetlb;
+    // Within list of slabs with free objects of the class
+    ArenaSlab *prev;
+    ArenaSlab *next;
+};
+
+typedef struct {
+    pthread_mutex_t mutex;
+    size_t size;
+    ArenaSlab *partial;
+} ArenaClass;
+
+struct CacheArena {
+    ArenaClass classes[ARENA_CLASS_COUNT];
+    size_t page_size;
+    // MAP_HUGETLB failed once, it is not tried again
+    bool no_hugetlb;
+
+    // Updated atomically, see CacheArenaStats
+    size_t reserved;
+    size_t allocated;
+    size_t requested;
+    size_t slab_count;
+    size_t hugetlb_slab_count;
+    size_t large_count;
+};
+
+size_t _ArenaClassIndex(size_t size) {
+    if (size <= ARENA_SMALL_LIMIT) {
+        return size == 0 ? 0 : (size - 1) / ARENA_SMALL_STEP;
+    }
+    // Highest bit of size - 1 picks the doubling, next two bits the class
+    // within it
+    unsigned shift = 63 - __builtin_clzl(size - 1);
+    size_t quarter = (size - 1) >> (shift - 2);
+    return ARENA_SMALL_CLASSES + (shift - 7) * ARENA_CLASSES_PER_DOUBLING + quarter - 4;
+}
+
+size_t _ArenaClassSize(size_t index) {
+    if (index < ARENA_SMALL_CLASSES) {
+        return (index + 1) * ARENA_SMALL_STEP;
+    }
+    index -= ARENA_SMALL_CLASSES;
+    unsigned shift = 7 + index / ARENA_CLASSES_PER_DOUBLING;
+    return ((size_t) 1 << shift) + (index % ARENA_CLASSES_PER_DOUBLING + 1) * ((size_t) 1 << (shift - 2));
+}
+
+CacheArena *CreateCacheArena(void) {
+    CacheArena *arena = malloc(sizeof(CacheArena));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < ARENA_CLASS_COUNT; i++) {
+        pthread_mutex_init(&arena->classes[i].mutex, NULL);
+        arena->classes[i].size = _ArenaClassSize(i);
+        arena->classes[i].partial = NULL;
+    }
+    arena->page_size = sysconf(_SC_PAGESIZE);
+    arena->no_hugetlb = false;
+
+    arena->reserved = 0;
+    arena->allocated = 0;
+    arena->requested = 0;
+    arena->slab_count = 0;
+    arena->hugetlb_slab_count = 0;
+    arena->large_count = 0;
+
+    return arena;
+}
+
+void DestroyCacheArena(CacheArena *arena) {
+    if (arena == NULL) return;
+    // Slabs were unmapped with their last objects
+    for (size_t i = 0; i < ARENA_CLASS_COUNT; i++) {
+        pthread_mutex_destroy(&arena->classes[i].mutex);
+    }
+    free(arena);
+}
+
+void _ArenaCount(size_t *counter, size_t value, bool add) {
+    if (add) {
+        __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+    } else {
+        __atomic_sub_fetch(counter, value, __ATOMIC_RELAXED);
+    }
+}
+
+// Region of ARENA_REGION_SIZE aligned to it
+void *_ArenaMapRegion(CacheArena *arena, bool *hugetlb) {
+    if (!__atomic_load_n(&arena->no_hugetlb, __ATOMIC_RELAXED)) {
+        void *region = mmap(NULL, ARENA_REGION_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | ARENA_HUGE_2MB, -1, 0);
+        if (region != MAP_FAILED) {
+            *hugetlb = true;
+            return region;
+        }
+        __atomic_store_n(&arena->no_hugetlb, true, __ATOMIC_RELAXED);
+    }
+
+    // Transparent huge pages only back aligned regions, so one is cut out
+    // of a larger mapping
+    char *mapping = mmap(NULL, 2 * ARENA_REGION_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    char *region = (char *) (((uintptr_t) mapping + ARENA_REGION_SIZE - 1) & ~(ARENA_REGION_SIZE - 1));
+    size_t head = region - mapping;
+    if (head > 0) {
+        munmap(mapping, head);
+    }
+    munmap(region + ARENA_REGION_SIZE, ARENA_REGION_SIZE - head);
+    madvise(region, ARENA_REGION_SIZE, MADV_HUGEPAGE);
+    *hugetlb = false;
+    return region;
+}
+
+ArenaSlab *_CreateArenaSlab(CacheArena *arena, size_t class_index) {
+    bool hugetlb;
+    ArenaSlab *slab = _ArenaMapRegion(arena, &hugetlb);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->class_index = class_index;
+    slab->capacity = (ARENA_REGION_SIZE - ARENA_SLAB_HEADER) / arena->classes[class_index].size;
+    slab->used = 0;
+    slab->free = NULL;
+    slab->untouched = (char *) slab + ARENA_SLAB_HEADER;
+    slab->hugetlb = hugetlb;
+    slab->prev = NULL;
+    slab->next = NULL;
+
+    _ArenaCount(&arena->reserved, ARENA_REGION_SIZE, true);
+    _ArenaCount(&arena->slab_count, 1, true);
+    if (hugetlb) {
+        _ArenaCount(&arena->hugetlb_slab_count, 1, true);
+    }
+    return slab;
+}
+
+void _DestroyArenaSlab(CacheArena *arena, ArenaSlab *slab) {
+    _ArenaCount(&arena->reserved, ARENA_REGION_SIZE, false);
+    _ArenaCount(&arena->slab_count, 1, false);
+    if (slab->hugetlb) {
+        _ArenaCount(&arena->hugetlb_slab_count, 1, false);
+    }
+    munmap(slab, ARENA_REGION_SIZE);
+}
+
+// Class must be already locked up to this point.
+void _PushArenaSlab(ArenaClass *class, ArenaSlab *slab) {
+    slab->prev = NULL;
+    slab->next = class->partial;
+    if (class->partial != NULL) {
+        class->partial->prev = slab;
+    }
+    class->partial = slab;
+}
+
+// Class must be already locked up to this point.
+void _UnlinkArenaSlab(ArenaClass *class, ArenaSlab *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        class->partial = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+size_t _ArenaLargeSize(const CacheArena *arena, size_t size) {
+    return (size + arena->page_size - 1) & ~(arena->page_size - 1);
+}
+
+void *_ArenaAllocLarge(CacheArena *arena, size_t size) {
+    size_t mapped = _ArenaLargeSize(arena, size);
+    void *data = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    // Aligned 2 MiB parts of it may still be backed by huge pages
+    madvise(data, mapped, MADV_HUGEPAGE);
+
+    _ArenaCount(&arena->reserved, mapped, true);
+    _ArenaCount(&arena->allocated, mapped, true);
+    _ArenaCount(&arena->requested, size, true);
+    _ArenaCount(&arena->large_count, 1, true);
+    return data;
+}
+
+void *ArenaAlloc(CacheArena *arena, size_t size) {
+    if (size > ARENA_MAX_CLASS) {
+        return _ArenaAllocLarge(arena, size);
+    }
+
+    size_t index = _ArenaClassIndex(size);
+    ArenaClass *class = &arena->classes[index];
+    pthread_mutex_lock(&class->mutex);
+    ArenaSlab *slab = class->partial;
+    if (slab == NULL) {
+        slab = _CreateArenaSlab(arena, index);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&class->mutex);
+            return NULL;
+        }
+        _PushArenaSlab(class, slab);
+    }
+
+    void *data;
+    if (slab->free != NULL) {
+        data = slab->free;
+        slab->free = *(void **) data;
+    } else {
+        data = slab->untouched;
+        slab->untouched += class->size;
+    }
+    slab->used++;
+    if (slab->used == slab->capacity) {
+        _UnlinkArenaSlab(class, slab);
+    }
+    pthread_mutex_unlock(&class->mutex);
+
+    _ArenaCount(&arena->allocated, class->size, true);
+    _ArenaCount(&arena->requested, size, true);
+    return data;
+}
+
+void ArenaFree(CacheArena *arena, void *data, size_t size) {
+    if (data == NULL) return;
+    if (size > ARENA_MAX_CLASS) {
+        size_t mapped = _ArenaLargeSize(arena, size);
+        munmap(data, mapped);
+        _ArenaCount(&arena->reserved, mapped, false);
+        _ArenaCount(&arena->allocated, mapped, false);
+        _ArenaCount(&arena->requested, size, false);
+        _ArenaCount(&arena->large_count, 1, false);
+        return;
+    }
+
+    ArenaSlab *slab = (ArenaSlab *) ((uintptr_t) data & ~(ARENA_REGION_SIZE - 1));
+    ArenaClass *class = &arena->classes[slab->class_index];
+    pthread_mutex_lock(&class->mutex);
+    *(void **) data = slab->free;
+    slab->free = data;
+    if (slab->used == slab->capacity) {
+        _PushArenaSlab(class, slab);
+    }
+    slab->used--;
+    // Empty slabs are given back right away, so that mapped memory follows
+    // what the cache holds
+    bool empty = slab->used == 0;
+    if (empty) {
+        _UnlinkArenaSlab(class, slab);
+    }
+    pthread_mutex_unlock(&class->mutex);
+
+    _ArenaCount(&arena->allocated, class->size, false);
+    _ArenaCount(&arena->requested, size, false);
+    if (empty) {
+        _DestroyArenaSlab(arena, slab);
+    }
+}
+
+CacheArenaStats GetCacheArenaStats(CacheArena *arena) {
+    CacheArenaStats stats = {
+        __atomic_load_n(&arena->reserved, __ATOMIC_RELAXED),
+        __atomic_load_n(&arena->allocated, __ATOMIC_RELAXED),
+        __atomic_load_n(&arena->requested, __ATOMIC_RELAXED),
+        __atomic_load_n(&arena->slab_count, __ATOMIC_RELAXED),
+        __atomic_load_n(&arena->hugetlb_slab_count, __ATOMIC_RELAXED),
+        __atomic_load_n(&arena->large_count, __ATOMIC_RELAXED)
+    };
+    return stats;
+}
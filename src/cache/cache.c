@@ -2,553 +2,1790 @@
 
 #define _GNU_SOURCE
 #include "cache/cache.h"
+#include "cache/sketch.h"
+#include "cache/arena.h"
 #include "utils/hash.h"
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
-#include <time.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct BufferMeta {
     pthread_mutex_t _mutex;
     pthread_rwlock_t _lock;
     char *_key;
-    unsigned long _hash;
 
+    // Atomic. BUFFER_UNLINKED once buffer is taken out of cache, after
+    // that no new references can be made.
     size_t _reference_count;
-    time_t _last_reference_time;
+    // Guarded by _mutex
+    bool _loading;
+    BufferWaiter *_waiters;
+    // Guarded by _mutex, see SetBufferMtime
+    bool _has_mtime;
+    struct timespec _mtime;
 };
 
-
-BufferMeta *_CreateBufferMeta(const char *key, const size_t bufferSize) {
-    BufferMeta *meta = malloc(sizeof(BufferMeta));
-
-    if (meta == NULL) {
-        return NULL;
-    }
-
+// Key is kept by caller, see CacheBufferBlock
+void _InitBufferMeta(BufferMeta *meta, char *key) {
     pthread_rwlock_init(&meta->_lock, NULL);
     pthread_mutex_init(&meta->_mutex, NULL);
-    meta->_key = strdup(key);
-    if (meta->_key == NULL) {
-        pthread_rwlock_destroy(&meta->_lock);
-        pthread_mutex_destroy(&meta->_mutex);
-        free(meta);
-        return NULL;
-    }
-    meta->_hash = hash(key, bufferSize);
+    meta->_key = key;
     meta->_reference_count = 0;
-
-    return meta;
+    meta->_loading = false;
+    meta->_waiters = NULL;
+    meta->_has_mtime = false;
 }
 
 void _DestroyBufferMeta(BufferMeta *meta) {
     pthread_rwlock_destroy(&meta->_lock);
     pthread_mutex_destroy(&meta->_mutex);
-    free(meta->_key);
-    free(meta);
 }
 
 typedef struct CacheBuffer CacheBuffer;
+typedef struct CacheShard CacheShard;
+
+// Eviction queues of shard. Policies give them their own meaning.
+typedef enum {
+    CACHE_QUEUE_RECENCY = 0,
+    // S3-FIFO
+    CACHE_QUEUE_SMALL = 0,
+    CACHE_QUEUE_MAIN = 1,
+    // W-TinyLFU
+    CACHE_QUEUE_WINDOW = 0,
+    CACHE_QUEUE_PROBATION = 1,
+    CACHE_QUEUE_PROTECTED = 2,
+
+    CACHE_QUEUE_COUNT = 3
+} CacheQueueId;
+
+// S3-FIFO reference counter limit
+#define S3_FIFO_MAX_FREQUENCY 3
+
+#define BUFFER_UNLINKED ((size_t) -1)
 
 struct CacheBuffer {
     char *data;
     size_t size;
+    // Data is a mapping instead of heap copy: read-only one of a file or
+    // one of shared memory file fd
+    bool mapped;
+    int fd;
+    // Data and block of buffer come from it instead of heap
+    CacheArena *arena;
+    // Atomic, only the load claim holder stores it
     size_t used;
 
     BufferMeta *meta;
+    // Full width key hash, kept in table slots and used for frequency
+    // tracking
+    unsigned long key_hash;
+
+    // Handles given out with every reference
+    ReadBuffer read_handle;
+    WriteBuffer write_handle;
+
+    // Lookups since eviction policy last looked at buffer. Counted
+    // atomically without shard lock, up to policy hit_limit.
+    unsigned char hits;
+
+    // Eviction queue links and state, guarded by shard mutex
+    CacheQueueId queue;
+    CacheBuffer *queue_prev;
+    CacheBuffer *queue_next;
+
+    // Stale or retired list link, see CacheShard
+    CacheBuffer *retired_next;
 };
 
-CacheBuffer *_CreateCacheBuffer(const char *key, const size_t bufferSize, const size_t table_size) {
-    CacheBuffer *buffer = malloc(sizeof(CacheBuffer));
+// Buffer, its meta and key are allocated together
+typedef struct {
+    CacheBuffer buffer;
+    BufferMeta meta;
+    char key[];
+} CacheBufferBlock;
 
-    if (buffer == NULL) {
-        return NULL;
-    }
+size_t _CacheBufferBlockSize(const char *key) {
+    return sizeof(CacheBufferBlock) + strlen(key) + 1;
+}
 
-    buffer->data = malloc(bufferSize);
+// Buffer owning already allocated data and fd of it (-1 - none), they
+// are not freed on failure. Block is taken from arena unless it is NULL.
+CacheBuffer *_WrapCacheBuffer(const char *key, char *data, const size_t bufferSize, unsigned long key_hash,
+                              int fd, CacheArena *arena) {
+    size_t block_size = _CacheBufferBlockSize(key);
+    CacheBufferBlock *block = arena != NULL ? ArenaAlloc(arena, block_size) : malloc(block_size);
 
-    if (buffer->data == NULL) {
-        free(buffer);
+    if (block == NULL) {
         return NULL;
     }
 
+    CacheBuffer *buffer = &block->buffer;
+    buffer->data = data;
     buffer->size = bufferSize;
+    buffer->mapped = false;
+    buffer->fd = fd;
+    buffer->arena = arena;
     buffer->used = 0;
+    buffer->key_hash = key_hash;
+    buffer->queue = CACHE_QUEUE_RECENCY;
+    buffer->queue_prev = NULL;
+    buffer->queue_next = NULL;
+    buffer->hits = 0;
+    buffer->retired_next = NULL;
+
+    strcpy(block->key, key);
+    buffer->meta = &block->meta;
+    _InitBufferMeta(buffer->meta, block->key);
+
+    ReadBuffer rcb = {
+        .data = buffer->data,
+        .size = &buffer->size,
+        .used = &buffer->used,
+        .fd = fd,
+        .meta = buffer->meta
+    };
+    memcpy(&buffer->read_handle, &rcb, sizeof(ReadBuffer));
+    WriteBuffer wbc = {
+        .data = buffer->data,
+        .size = &buffer->size,
+        .used = &buffer->used,
+        .meta = buffer->meta
+    };
+    memcpy(&buffer->write_handle, &wbc, sizeof(WriteBuffer));
+
+    return buffer;
+}
+
+// Shared memory file mapped as buffer data
+CacheBuffer *_CreateMemfdCacheBuffer(const char *key, const size_t bufferSize, unsigned long key_hash) {
+    int fd = memfd_create("cache", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, bufferSize) != 0) {
+        close(fd);
+        return NULL;
+    }
+    char *data = mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    CacheBuffer *buffer = _WrapCacheBuffer(key, data, bufferSize, key_hash, fd, NULL);
+    if (buffer == NULL) {
+        munmap(data, bufferSize);
+        close(fd);
+        return NULL;
+    }
+    buffer->mapped = true;
+    return buffer;
+}
+
+// Arena is the one of CACHE_STORAGE_ARENA, NULL otherwise
+CacheBuffer *_CreateCacheBuffer(const char *key, const size_t bufferSize, unsigned long key_hash,
+                                CacheStorage storage, CacheArena *arena) {
+    // Empty buffer has nothing to map
+    if (storage == CACHE_STORAGE_MEMFD && bufferSize > 0) {
+        return _CreateMemfdCacheBuffer(key, bufferSize, key_hash);
+    }
 
-    buffer->meta = _CreateBufferMeta(key, table_size);
+    char *data = arena != NULL ? ArenaAlloc(arena, bufferSize) : malloc(bufferSize);
 
-    if (buffer->meta == NULL) {
-        free(buffer->data);
-        free(buffer);
+    if (data == NULL) {
         return NULL;
     }
 
+    CacheBuffer *buffer = _WrapCacheBuffer(key, data, bufferSize, key_hash, -1, arena);
+    if (buffer == NULL) {
+        if (arena != NULL) {
+            ArenaFree(arena, data, bufferSize);
+        } else {
+            free(data);
+        }
+    }
     return buffer;
 }
 
+// Maps file at path read-only, it shares pages with page cache. Buffer
+// is loaded as soon as it is created.
+int _MapCacheBuffer(const char *path, size_t max_size, unsigned long key_hash, CacheBuffer **buffer) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ERR_FILE_MAP;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return ERR_FILE_MAP;
+    }
+    size_t size = st.st_size;
+    if (size > max_size) {
+        close(fd);
+        return ERR_BUFFER_SIZE_LIMIT;
+    }
+    char *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    // Mapping keeps the file, its descriptor isn't needed
+    close(fd);
+    if (data == MAP_FAILED) {
+        return ERR_FILE_MAP;
+    }
+    // Readahead starts now, so sending it faults on fewer pages
+    madvise(data, size, MADV_WILLNEED);
+
+    *buffer = _WrapCacheBuffer(path, data, size, key_hash, -1, NULL);
+    if (*buffer == NULL) {
+        munmap(data, size);
+        return ERR_MEMORY;
+    }
+    (*buffer)->mapped = true;
+    (*buffer)->used = size;
+    (*buffer)->meta->_has_mtime = true;
+    (*buffer)->meta->_mtime = st.st_mtim;
+    return ERR_OK;
+}
+
 void _DestroyCacheBuffer(CacheBuffer *buffer) {
     if (buffer) {
-        if (buffer->data != NULL) {
+        if (buffer->mapped) {
+            munmap(buffer->data, buffer->size);
+        } else if (buffer->arena != NULL) {
+            ArenaFree(buffer->arena, buffer->data, buffer->size);
+        } else {
             free(buffer->data);
         }
-
-        if (buffer->meta != NULL) {
-            _DestroyBufferMeta(buffer->meta);
+        if (buffer->fd != -1) {
+            close(buffer->fd);
         }
 
-        free(buffer);
+        _DestroyBufferMeta(buffer->meta);
+
+        // Buffer is the start of its block
+        if (buffer->arena != NULL) {
+            ArenaFree(buffer->arena, buffer, _CacheBufferBlockSize(buffer->meta->_key));
+        } else {
+            free(buffer);
+        }
     }
 }
 
-typedef struct HashTableNode HashTableNode;
+// Open addressing table with linear probing. Lookups probe it without
+// shard lock, so slots are filled once and never move: dropped buffers
+// leave tombstones, which are cleared when the table is rehashed.
+typedef struct CacheTable CacheTable;
+
+#define CACHE_TABLE_MIN_SIZE 16
+// Percent of slots filled by buffers and tombstones that starts rehash
+#define CACHE_TABLE_MAX_LOAD 75
+// Old table slots moved to the new one by every change during rehash
+#define CACHE_TABLE_MIGRATE_STEP 32
 
-struct HashTableNode {
+#define CACHE_SLOT_TOMBSTONE ((CacheBuffer *) 1)
+
+typedef struct {
+    // Compared before the key, so probes don't touch other keys
+    unsigned long hash;
+    // Atomic, NULL for never used slot
     CacheBuffer *buffer;
-    HashTableNode *next;
+} CacheSlot;
+
+struct CacheTable {
+    CacheSlot *slots;
+    // Power of two
+    size_t size;
+    // Slots with buffers or tombstones
+    size_t filled;
+
+    // Retired list link, see CacheShard epoch
+    CacheTable *retired_next;
 };
 
-HashTableNode *_CreateHashTableNode(CacheBuffer *buffer) {
-    HashTableNode *node = malloc(sizeof(HashTableNode));
+CacheTable *_CreateCacheTable(size_t entries) {
+    CacheTable *table = malloc(sizeof(CacheTable));
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    // At most half full once created
+    table->size = CACHE_TABLE_MIN_SIZE;
+    while (table->size < 2 * entries) {
+        table->size <<= 1;
+    }
+    table->slots = calloc(table->size, sizeof(CacheSlot));
 
-    if (node == NULL) {
+    if (table->slots == NULL) {
+        free(table);
         return NULL;
     }
 
-    node->buffer = buffer;
-    node->next = NULL;
+    table->filled = 0;
+    table->retired_next = NULL;
+    return table;
+}
+
+void _DestroyCacheTable(CacheTable *table) {
+    if (table) {
+        free(table->slots);
+        free(table);
+    }
+}
+
+// Safe without shard lock inside of epoch
+CacheBuffer *_TableFind(CacheTable *table, unsigned long key_hash, const char *key) {
+    size_t mask = table->size - 1;
+    for (size_t i = key_hash & mask;; i = (i + 1) & mask) {
+        CacheSlot *slot = &table->slots[i];
+        CacheBuffer *buffer = __atomic_load_n(&slot->buffer, __ATOMIC_ACQUIRE);
+        if (buffer == NULL) {
+            return NULL;
+        }
+        if (buffer != CACHE_SLOT_TOMBSTONE && slot->hash == key_hash && strcmp(buffer->meta->_key, key) == 0) {
+            return buffer;
+        }
+    }
+}
 
-    return node;
+// Table has to have a free slot.
+// Shard must be already locked up to this point.
+void _TablePut(CacheTable *table, CacheBuffer *buffer) {
+    size_t mask = table->size - 1;
+    size_t i = buffer->key_hash & mask;
+    while (table->slots[i].buffer != NULL) {
+        i = (i + 1) & mask;
+    }
+    // Published last, lookups see buffer fully created
+    table->slots[i].hash = buffer->key_hash;
+    __atomic_store_n(&table->slots[i].buffer, buffer, __ATOMIC_RELEASE);
+    table->filled++;
 }
 
-void _DestroyHashTableNode(HashTableNode *node) {
-    if (node) {
-        if (node->buffer != NULL) {
-            _DestroyCacheBuffer(node->buffer);
+// Shard must be already locked up to this point.
+bool _TableRemove(CacheTable *table, CacheBuffer *buffer) {
+    size_t mask = table->size - 1;
+    for (size_t i = buffer->key_hash & mask; table->slots[i].buffer != NULL; i = (i + 1) & mask) {
+        if (table->slots[i].buffer == buffer) {
+            __atomic_store_n(&table->slots[i].buffer, CACHE_SLOT_TOMBSTONE, __ATOMIC_RELEASE);
+            return true;
         }
+    }
+    return false;
+}
 
-        free(node);
+// Puts buffer into the slot of old one, lookups see either of them.
+// Shard must be already locked up to this point.
+bool _TableReplace(CacheTable *table, CacheBuffer *old, CacheBuffer *buffer) {
+    size_t mask = table->size - 1;
+    for (size_t i = old->key_hash & mask; table->slots[i].buffer != NULL; i = (i + 1) & mask) {
+        if (table->slots[i].buffer == old) {
+            __atomic_store_n(&table->slots[i].buffer, buffer, __ATOMIC_RELEASE);
+            return true;
+        }
     }
+    return false;
 }
 
-struct CacheManager {
+typedef struct {
+    // From most recently pushed to the next eviction candidate
+    CacheBuffer *head;
+    CacheBuffer *tail;
+    size_t memory;
+    size_t count;
+} CacheQueue;
+
+// Lookups don't take shard lock, so they only count hits on buffer.
+// Policies catch up on them when they look at buffer under the lock.
+typedef struct {
+    // Links new buffer into queues
+    void (*insert)(CacheShard *shard, CacheBuffer *buffer);
+    // Picks next buffer to drop, it has to be not referenced.
+    // NULL if there is none.
+    CacheBuffer *(*victim)(CacheShard *shard);
+    // Hits counted on buffer at most
+    unsigned char hit_limit;
+} EvictionPolicyOps;
+
+#define EPOCH_STRIPES 16
+
+typedef struct {
+    CacheBuffer *buffers;
+    CacheTable *tables;
+} RetiredList;
+
+// Lookups in progress by epoch parity. Threads are spread over stripes,
+// each on its own cache line, so lookups don't contend on a counter.
+typedef struct {
+    _Alignas(64) size_t active[2];
+} EpochStripe;
+
+struct CacheShard {
     pthread_mutex_t mutex;
+    CacheManager *manager;
 
+    // Share of manager limits
     size_t max_memory;
     size_t max_entries;
-    size_t max_buffer_size;
 
     size_t used_memory;
     size_t entry_count;
 
-    HashTableNode **hash_table;
-    size_t hash_table_size;
+    // Lock-free lookups enter current epoch. Unlinked buffers and old
+    // tables are retired by parity of epoch and freed after the epoch was
+    // flipped twice and lookups of the earlier one left.
+    size_t epoch;
+    EpochStripe readers[EPOCH_STRIPES];
+    RetiredList retired[2];
+    // Invalidated buffers that were still referenced. Not found by
+    // lookups anymore, retired once the last reference is released.
+    CacheBuffer *stale;
+
+    // Atomic. While old_table is set, buffers are moved from it to table
+    // and lookups check both. Slots below migrated are moved already.
+    CacheTable *table;
+    CacheTable *old_table;
+    size_t migrated;
+
+    EvictionPolicy policy;
+    const EvictionPolicyOps *ops;
+    CacheQueue queues[CACHE_QUEUE_COUNT];
+
+    // S3-FIFO: hashes of keys recently dropped from small queue. Ring keeps
+    // them in drop order, open addressing set answers membership.
+    unsigned long *ghost_ring;
+    size_t ghost_size;
+    size_t ghost_length;
+    size_t ghost_position;
+    unsigned long *ghost_set;
+    size_t ghost_set_size;
+
+    // W-TinyLFU: reference frequencies, including of already dropped keys
+    FrequencySketch *sketch;
 };
 
-CacheManager *CreateCacheManager(const CacheParams *params) {
-    CacheManager *manager = malloc(sizeof(CacheManager));
+// Keys are split between independently locked shards by hash
+struct CacheManager {
+    CacheShard *shards;
+    size_t shard_count;
 
-    if (manager == NULL) {
-        return NULL;
+    size_t max_memory;
+    size_t max_entries;
+    size_t max_buffer_size;
+    CacheStorage storage;
+    // Only with CACHE_STORAGE_ARENA
+    CacheArena *arena;
+
+    // Totals of all shards, updated atomically. Shards keep to their share
+    // of limits, but may go over it while totals still fit.
+    size_t used_memory;
+    size_t entry_count;
+};
+
+// Shard must be already locked up to this point.
+void _QueueUnlink(CacheShard *shard, CacheBuffer *buffer) {
+    CacheQueue *queue = &shard->queues[buffer->queue];
+    if (buffer->queue_prev != NULL) {
+        buffer->queue_prev->queue_next = buffer->queue_next;
+    } else {
+        queue->head = buffer->queue_next;
     }
+    if (buffer->queue_next != NULL) {
+        buffer->queue_next->queue_prev = buffer->queue_prev;
+    } else {
+        queue->tail = buffer->queue_prev;
+    }
+    buffer->queue_prev = NULL;
+    buffer->queue_next = NULL;
+    queue->memory -= buffer->size;
+    queue->count--;
+}
 
-    pthread_mutex_init(&manager->mutex, NULL);
+// Shard must be already locked up to this point.
+void _QueuePushFront(CacheShard *shard, CacheQueueId id, CacheBuffer *buffer) {
+    CacheQueue *queue = &shard->queues[id];
+    buffer->queue = id;
+    buffer->queue_prev = NULL;
+    buffer->queue_next = queue->head;
+    if (queue->head != NULL) {
+        queue->head->queue_prev = buffer;
+    } else {
+        queue->tail = buffer;
+    }
+    queue->head = buffer;
+    queue->memory += buffer->size;
+    queue->count++;
+}
 
-    manager->max_memory = params->max_memory;
-    manager->max_entries = params->max_entries;
-    manager->max_buffer_size = params->max_buffer_size;
+// Moves buffer to the head of queue id, the same queue included.
+// Shard must be already locked up to this point.
+void _QueueMove(CacheShard *shard, CacheQueueId id, CacheBuffer *buffer) {
+    if (buffer->queue == id && shard->queues[id].head == buffer) {
+        return;
+    }
+    _QueueUnlink(shard, buffer);
+    _QueuePushFront(shard, id, buffer);
+}
 
-    manager->used_memory = 0;
-    manager->entry_count = 0;
+// Buffer takes place of old one in its queue, with hits counted so far.
+// Shard must be already locked up to this point.
+void _QueueReplace(CacheShard *shard, CacheBuffer *old, CacheBuffer *buffer) {
+    CacheQueue *queue = &shard->queues[old->queue];
+    buffer->queue = old->queue;
+    buffer->queue_prev = old->queue_prev;
+    buffer->queue_next = old->queue_next;
+    if (old->queue_prev != NULL) {
+        old->queue_prev->queue_next = buffer;
+    } else {
+        queue->head = buffer;
+    }
+    if (old->queue_next != NULL) {
+        old->queue_next->queue_prev = buffer;
+    } else {
+        queue->tail = buffer;
+    }
+    old->queue_prev = NULL;
+    old->queue_next = NULL;
+    queue->memory += buffer->size;
+    queue->memory -= old->size;
+    __atomic_store_n(&buffer->hits, __atomic_load_n(&old->hits, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
 
-    manager->hash_table = malloc(sizeof(HashTableNode) * manager->max_entries);
+bool _IsBufferReferenced(CacheBuffer *buffer) {
+    return __atomic_load_n(&buffer->meta->_reference_count, __ATOMIC_ACQUIRE) != 0;
+}
 
-    if (manager->hash_table == NULL) {
-        free(manager);
-        return NULL;
+// Takes a reference unless buffer was already unlinked
+bool _TryReferenceBuffer(CacheBuffer *buffer) {
+    size_t count = __atomic_load_n(&buffer->meta->_reference_count, __ATOMIC_RELAXED);
+    do {
+        if (count == BUFFER_UNLINKED) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&buffer->meta->_reference_count, &count, count + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return true;
+}
+
+void _RecordHit(CacheShard *shard, CacheBuffer *buffer) {
+    // Saturated counter is only read, hot buffers don't bounce its line
+    if (__atomic_load_n(&buffer->hits, __ATOMIC_RELAXED) < shard->ops->hit_limit) {
+        __atomic_fetch_add(&buffer->hits, 1, __ATOMIC_RELAXED);
     }
+}
 
-    manager->hash_table_size = manager->max_entries;
+unsigned _TakeHits(CacheBuffer *buffer) {
+    return __atomic_exchange_n(&buffer->hits, 0, __ATOMIC_RELAXED);
+}
 
-    for (size_t i = 0; i < manager->hash_table_size; i++) {
-        manager->hash_table[i] = NULL;
+// Buffer closest to the tail of queue id that is not referenced.
+// Shard must be already locked up to this point.
+CacheBuffer *_QueueVictim(CacheShard *shard, CacheQueueId id) {
+    CacheBuffer *buffer = shard->queues[id].tail;
+    while (buffer != NULL && _IsBufferReferenced(buffer)) {
+        buffer = buffer->queue_prev;
     }
+    return buffer;
+}
 
-    return manager;
+// Queue holds at least share (in percents) of cache memory or entries
+bool _QueueReached(CacheShard *shard, CacheQueueId id, size_t share) {
+    CacheQueue *queue = &shard->queues[id];
+    size_t memory = shard->max_memory / 100 * share;
+    size_t count = shard->max_entries * share / 100;
+    return queue->memory >= memory || queue->count >= (count > 0 ? count : 1);
 }
 
-void DestroyCacheManager(CacheManager *manager) {
-    pthread_mutex_destroy(&manager->mutex);
+// Shard must be already locked up to this point.
+void _LruInsert(CacheShard *shard, CacheBuffer *buffer) {
+    _QueuePushFront(shard, CACHE_QUEUE_RECENCY, buffer);
+}
+
+// Buffers looked up since they were last seen at the tail get moved to
+// head instead, so the order follows recency like LRU (CLOCK).
+// Shard must be already locked up to this point.
+CacheBuffer *_LruVictim(CacheShard *shard) {
+    // Concurrent lookups may keep hitting, bounded to one lap
+    size_t chances = shard->queues[CACHE_QUEUE_RECENCY].count;
+    CacheBuffer *buffer = _QueueVictim(shard, CACHE_QUEUE_RECENCY);
+    while (buffer != NULL && chances-- > 0 && _TakeHits(buffer) > 0) {
+        _QueueMove(shard, CACHE_QUEUE_RECENCY, buffer);
+        buffer = _QueueVictim(shard, CACHE_QUEUE_RECENCY);
+    }
+    return buffer;
+}
 
-    for (size_t i = 0; i < manager->hash_table_size; i++) {
-        HashTableNode *node = manager->hash_table[i];
+// Small queue takes 10% of cache, ghosts remember as many keys as cache holds
+#define S3_FIFO_SMALL_SHARE 10
 
-        while (node != NULL) {
-            HashTableNode *next = node->next;
-            _DestroyHashTableNode(node);
-            node = next;
-        }
+// Ghost set slot of key hash, empty slots hold 0
+size_t _GhostSlot(CacheShard *shard, unsigned long key_hash) {
+    size_t mask = shard->ghost_set_size - 1;
+    size_t slot = ((key_hash * 0x9e3779b97f4a7c15UL) >> 32) & mask;
+    while (shard->ghost_set[slot] != 0 && shard->ghost_set[slot] != key_hash) {
+        slot = (slot + 1) & mask;
     }
+    return slot;
+}
 
-    free(manager->hash_table);
-    free(manager);
+unsigned long _GhostKey(unsigned long key_hash) {
+    return key_hash != 0 ? key_hash : 1;
 }
 
-// Manager must be already locked up to this point.
-int _DeleteBuffer(CacheManager *manager, const char *key) {
-    const unsigned long key_hash = hash(key, manager->hash_table_size);
-    HashTableNode *node = manager->hash_table[key_hash];
-    if (node == NULL) {
-        return ERR_KEY_NOT_FOUND;
-    }
-    pthread_mutex_lock(&node->buffer->meta->_mutex);
-    if (strcmp(node->buffer->meta->_key, key) == 0) {
-        if (node->buffer->meta->_reference_count != 0) {
-            pthread_mutex_unlock(&node->buffer->meta->_mutex);
-            return ERR_BUFFER_REFERENCED;
-        }
-        manager->used_memory -= node->buffer->size;
-        manager->entry_count--;
-        HashTableNode *to_destroy = node;
-        manager->hash_table[key_hash] = node->next;
-        pthread_mutex_unlock(&to_destroy->buffer->meta->_mutex);
-        _DestroyHashTableNode(to_destroy);
-        return ERR_OK;
+bool _GhostContains(CacheShard *shard, unsigned long key_hash) {
+    key_hash = _GhostKey(key_hash);
+    return shard->ghost_set[_GhostSlot(shard, key_hash)] == key_hash;
+}
+
+void _GhostRemove(CacheShard *shard, unsigned long key_hash) {
+    size_t mask = shard->ghost_set_size - 1;
+    size_t slot = _GhostSlot(shard, key_hash);
+    if (shard->ghost_set[slot] == 0) {
+        return;
     }
-    pthread_mutex_unlock(&node->buffer->meta->_mutex);
-    while (node->next != NULL) {
-        pthread_mutex_lock(&node->next->buffer->meta->_mutex);
-        if (strcmp(node->next->buffer->meta->_key, key) == 0) {
-            if (node->next->buffer->meta->_reference_count != 0) {
-                pthread_mutex_unlock(&node->next->buffer->meta->_mutex);
-                return ERR_BUFFER_REFERENCED;
-            }
-            manager->used_memory -= node->next->buffer->size;
-            manager->entry_count--;
-            HashTableNode *to_destroy = node->next;
-            node->next = to_destroy->next;
-            pthread_mutex_unlock(&to_destroy->buffer->meta->_mutex);
-            _DestroyHashTableNode(to_destroy);
-            return ERR_OK;
-        }
-        pthread_mutex_unlock(&node->next->buffer->meta->_mutex);
-        node = node->next;
+    shard->ghost_set[slot] = 0;
+
+    // Shifts back following entries of the cluster, so lookups don't stop
+    // at the freed slot
+    size_t next = (slot + 1) & mask;
+    while (shard->ghost_set[next] != 0) {
+        unsigned long moved = shard->ghost_set[next];
+        shard->ghost_set[next] = 0;
+        shard->ghost_set[_GhostSlot(shard, moved)] = moved;
+        next = (next + 1) & mask;
     }
-    return ERR_KEY_NOT_FOUND;
 }
 
+void _GhostAdd(CacheShard *shard, unsigned long key_hash) {
+    key_hash = _GhostKey(key_hash);
+    if (_GhostContains(shard, key_hash)) {
+        return;
+    }
+    unsigned long *oldest = &shard->ghost_ring[shard->ghost_position];
+    if (shard->ghost_length == shard->ghost_size) {
+        _GhostRemove(shard, *oldest);
+    } else {
+        shard->ghost_length++;
+    }
+    *oldest = key_hash;
+    shard->ghost_set[_GhostSlot(shard, key_hash)] = key_hash;
+    shard->ghost_position = (shard->ghost_position + 1) % shard->ghost_size;
+}
 
-struct _LRUEntry {
-    const char *key;
-    time_t last_reference_time;
-    size_t buffer_size;
-};
+// Keys dropped recently from small queue go straight to main one.
+// Shard must be already locked up to this point.
+void _S3FifoInsert(CacheShard *shard, CacheBuffer *buffer) {
+    if (_GhostContains(shard, buffer->key_hash)) {
+        _QueuePushFront(shard, CACHE_QUEUE_MAIN, buffer);
+    } else {
+        _QueuePushFront(shard, CACHE_QUEUE_SMALL, buffer);
+    }
+}
 
-int _compare_lru_entries(const void *a, const void *b) {
-    const struct _LRUEntry *entryA = a;
-    const struct _LRUEntry *entryB = b;
-    if (entryA->last_reference_time < entryB->last_reference_time) return -1;
-    if (entryA->last_reference_time > entryB->last_reference_time) return 1;
-    return 0;
-}
-
-// Return array of not used LRU (sorted by last reference time in ascending order) entries
-// Manager must be already locker up to this point.
-struct _LRUEntry *_FindNotUsedLruEntries(CacheManager *manager, size_t *count) {
-    // find count of not used LRU entries
-    size_t not_used_count = 0;
-    for (size_t i = 0; i < manager->hash_table_size; i++) {
-        HashTableNode *node = manager->hash_table[i];
-        while (node != NULL) {
-            if (node->buffer->meta->_reference_count == 0) {
-                not_used_count++;
+// Queues are FIFO, hits of buffer are its frequency.
+// Shard must be already locked up to this point.
+CacheBuffer *_S3FifoVictim(CacheShard *shard) {
+    // Every round either drops a buffer, moves one from small queue to
+    // main or decreases frequency, so it ends after a few laps at most.
+    // Concurrent lookups may keep adding hits, so laps are bounded.
+    size_t rounds = (S3_FIFO_MAX_FREQUENCY + 1) * shard->entry_count + 1;
+    while (true) {
+        CacheBuffer *small = _QueueVictim(shard, CACHE_QUEUE_SMALL);
+        CacheBuffer *main = _QueueVictim(shard, CACHE_QUEUE_MAIN);
+        bool last = rounds-- == 0;
+
+        if (small != NULL && (main == NULL || _QueueReached(shard, CACHE_QUEUE_SMALL, S3_FIFO_SMALL_SHARE))) {
+            if (!last && _TakeHits(small) > 0) {
+                _QueueMove(shard, CACHE_QUEUE_MAIN, small);
+                continue;
             }
-            node = node->next;
+            _GhostAdd(shard, small->key_hash);
+            return small;
         }
-    }
 
-    struct _LRUEntry *lru_keys = malloc(sizeof(struct _LRUEntry) * not_used_count);
+        if (main == NULL) {
+            return NULL;
+        }
+        if (!last && __atomic_load_n(&main->hits, __ATOMIC_RELAXED) > 0) {
+            __atomic_fetch_sub(&main->hits, 1, __ATOMIC_RELAXED);
+            _QueueMove(shard, CACHE_QUEUE_MAIN, main);
+            continue;
+        }
+        return main;
+    }
+}
 
-    if (lru_keys == NULL) {
-        return NULL;
+// Window takes 1% of cache, protected segment 80% of the rest
+#define W_TINYLFU_WINDOW_SHARE 1
+#define W_TINYLFU_PROTECTED_SHARE 80
+
+// Main segments have no room for buffers leaving the window
+bool _TinyLfuMainFull(CacheShard *shard) {
+    CacheQueue *probation = &shard->queues[CACHE_QUEUE_PROBATION];
+    CacheQueue *protected = &shard->queues[CACHE_QUEUE_PROTECTED];
+    size_t window_memory = shard->max_memory / 100 * W_TINYLFU_WINDOW_SHARE;
+    size_t window_count = shard->max_entries * W_TINYLFU_WINDOW_SHARE / 100;
+    if (window_count == 0) {
+        window_count = 1;
     }
+    return probation->memory + protected->memory + window_memory >= shard->max_memory ||
+           probation->count + protected->count + window_count >= shard->max_entries;
+}
 
-    size_t index = 0;
+// Shard must be already locked up to this point.
+void _TinyLfuInsert(CacheShard *shard, CacheBuffer *buffer) {
+    IncrementFrequency(shard->sketch, buffer->key_hash);
+    _QueuePushFront(shard, CACHE_QUEUE_WINDOW, buffer);
+
+    // While main has room window overflow moves there freely, once it is
+    // full overflow competes with main's victim on eviction
+    while (shard->queues[CACHE_QUEUE_WINDOW].tail != buffer &&
+           _QueueReached(shard, CACHE_QUEUE_WINDOW, W_TINYLFU_WINDOW_SHARE) &&
+           !_TinyLfuMainFull(shard)) {
+        _QueueMove(shard, CACHE_QUEUE_PROBATION, shard->queues[CACHE_QUEUE_WINDOW].tail);
+    }
+}
 
-    // find all entries with lru sorting
-    for (size_t i = 0; i < manager->hash_table_size; i++) {
-        HashTableNode *node = manager->hash_table[i];
-        while (node != NULL) {
-            if (node->buffer->meta->_reference_count == 0) {
-                lru_keys[index].key = node->buffer->meta->_key;
-                lru_keys[index].last_reference_time = node->buffer->meta->_last_reference_time;
-                lru_keys[index].buffer_size = node->buffer->size;
-                index++;
-            }
-            node = node->next;
-        }
+// Feeds hits of buffer to the sketch and moves it as a lookup under lock
+// would: within window, or from probation to protected segment. Returns
+// whether there were any hits.
+// Shard must be already locked up to this point.
+bool _TinyLfuCatchUp(CacheShard *shard, CacheBuffer *buffer) {
+    unsigned hits = _TakeHits(buffer);
+    if (hits == 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < hits; i++) {
+        IncrementFrequency(shard->sketch, buffer->key_hash);
+    }
+    if (buffer->queue == CACHE_QUEUE_WINDOW) {
+        _QueueMove(shard, CACHE_QUEUE_WINDOW, buffer);
+        return true;
     }
-    qsort(lru_keys, not_used_count, sizeof(struct _LRUEntry), _compare_lru_entries);
 
-    *count = not_used_count;
-    return lru_keys;
+    _QueueMove(shard, CACHE_QUEUE_PROTECTED, buffer);
+    size_t main_memory = shard->max_memory - shard->max_memory / 100 * W_TINYLFU_WINDOW_SHARE;
+    size_t main_count = shard->max_entries - shard->max_entries * W_TINYLFU_WINDOW_SHARE / 100;
+    CacheQueue *protected = &shard->queues[CACHE_QUEUE_PROTECTED];
+    while (protected->tail != buffer &&
+           (protected->memory > main_memory / 100 * W_TINYLFU_PROTECTED_SHARE ||
+            protected->count > main_count * W_TINYLFU_PROTECTED_SHARE / 100)) {
+        _QueueMove(shard, CACHE_QUEUE_PROBATION, protected->tail);
+    }
+    return true;
 }
 
-// Manager must be already locker up to this point.
-int _freeLRUBuffersCount(CacheManager *manager, size_t count) {
-    // Find not referenced buffers
-    size_t not_used_count = 0;
-    struct _LRUEntry *lru_keys = _FindNotUsedLruEntries(manager, &not_used_count);
+// Tail of queue that was not looked up since it was last seen, buffers
+// with hits are moved away from the tail on the way.
+// Shard must be already locked up to this point.
+CacheBuffer *_TinyLfuQueueVictim(CacheShard *shard, CacheQueueId id, size_t *chances) {
+    CacheBuffer *buffer = _QueueVictim(shard, id);
+    while (buffer != NULL && *chances > 0 && _TinyLfuCatchUp(shard, buffer)) {
+        (*chances)--;
+        buffer = _QueueVictim(shard, id);
+    }
+    return buffer;
+}
 
-    // If there are not enough buffers to free - return
-    if (not_used_count < count) {
-        free(lru_keys);
-        return ERR_BUFFERS_USED;
+// Shard must be already locked up to this point.
+CacheBuffer *_TinyLfuVictim(CacheShard *shard) {
+    // Concurrent lookups may keep hitting, bounded to one lap
+    size_t chances = shard->entry_count;
+    CacheBuffer *candidate = NULL;
+    if (_QueueReached(shard, CACHE_QUEUE_WINDOW, W_TINYLFU_WINDOW_SHARE)) {
+        candidate = _TinyLfuQueueVictim(shard, CACHE_QUEUE_WINDOW, &chances);
+    }
+    CacheBuffer *victim = _TinyLfuQueueVictim(shard, CACHE_QUEUE_PROBATION, &chances);
+    if (victim == NULL) {
+        victim = _TinyLfuQueueVictim(shard, CACHE_QUEUE_PROTECTED, &chances);
     }
 
-    // If there are enough buffers to free, free <count> least recently used buffers
-    size_t freed_count = 0;
-    for (size_t i = 0; i < not_used_count; i++) {
-        int err = _DeleteBuffer(manager, lru_keys[i].key);
-        if (err == ERR_OK) {
-            freed_count++;
-        }
-        if (freed_count == count) {
-            break;
+    if (candidate != NULL && victim != NULL) {
+        // Ties keep main's victim, one-hit wonders don't push out buffers
+        // that were referenced at least as often
+        if (EstimateFrequency(shard->sketch, candidate->key_hash) >
+            EstimateFrequency(shard->sketch, victim->key_hash)) {
+            _QueueMove(shard, CACHE_QUEUE_PROBATION, candidate);
+            return victim;
         }
+        return candidate;
     }
-    free(lru_keys);
-    if (freed_count < count) {
-        return ERR_BUFFERS_USED;
+    if (candidate != NULL) {
+        return candidate;
     }
-    return ERR_OK;
+    if (victim != NULL) {
+        return victim;
+    }
+    return _QueueVictim(shard, CACHE_QUEUE_WINDOW);
 }
 
-int _freeLRUBuffersMemory(CacheManager *manager, size_t memory) {
-    // Find not referenced buffers
-    size_t not_used_count = 0;
-    struct _LRUEntry *lru_keys = _FindNotUsedLruEntries(manager, &not_used_count);
+static const EvictionPolicyOps _lru_ops = {_LruInsert, _LruVictim, 1};
+static const EvictionPolicyOps _s3_fifo_ops = {_S3FifoInsert, _S3FifoVictim, S3_FIFO_MAX_FREQUENCY};
+static const EvictionPolicyOps _w_tinylfu_ops = {_TinyLfuInsert, _TinyLfuVictim, SKETCH_MAX_FREQUENCY};
 
-    if (lru_keys == NULL) {
-        return ERR_MEMORY;
+const char *CacheStorageName(CacheStorage storage) {
+    switch (storage) {
+        case CACHE_STORAGE_HEAP: return "heap";
+        case CACHE_STORAGE_MEMFD: return "memfd";
+        case CACHE_STORAGE_ARENA: return "arena";
     }
+    return "unknown";
+}
 
-    // find count of buffers to free
-    size_t free_count = 0;
-    size_t free_memory = 0;
-    for (size_t i = 0; i < not_used_count; i++) {
-        free_memory += lru_keys[i].buffer_size;
-        free_count++;
-        if (free_memory >= memory) {
-            break;
-        }
+const char *EvictionPolicyName(EvictionPolicy policy) {
+    switch (policy) {
+        case EVICTION_POLICY_LRU: return "lru";
+        case EVICTION_POLICY_S3_FIFO: return "s3-fifo";
+        case EVICTION_POLICY_W_TINYLFU: return "w-tinylfu";
     }
-    if (free_memory < memory) {
-        free(lru_keys);
-        return ERR_BUFFERS_USED;
+    return "unknown";
+}
+
+void _DestroyPolicyState(CacheShard *shard) {
+    free(shard->ghost_ring);
+    free(shard->ghost_set);
+    DestroyFrequencySketch(shard->sketch);
+}
+
+int _CreatePolicyState(CacheShard *shard, EvictionPolicy policy) {
+    shard->policy = policy;
+    shard->ghost_ring = NULL;
+    shard->ghost_size = 0;
+    shard->ghost_length = 0;
+    shard->ghost_position = 0;
+    shard->ghost_set = NULL;
+    shard->ghost_set_size = 0;
+    shard->sketch = NULL;
+
+    for (int i = 0; i < CACHE_QUEUE_COUNT; i++) {
+        shard->queues[i].head = NULL;
+        shard->queues[i].tail = NULL;
+        shard->queues[i].memory = 0;
+        shard->queues[i].count = 0;
     }
-    // If there are enough buffers to free, free <count> least recently used buffers
-    size_t freed_count = 0;
-    for (size_t i = 0; i < not_used_count; i++) {
-        int err = _DeleteBuffer(manager, lru_keys[i].key);
-        if (err == ERR_OK) {
-            freed_count++;
-        }
-        if (freed_count >= free_count) {
+
+    switch (policy) {
+        case EVICTION_POLICY_S3_FIFO:
+            shard->ops = &_s3_fifo_ops;
+            shard->ghost_size = shard->max_entries > 0 ? shard->max_entries : 1;
+            // At most half full, so probing stays short
+            shard->ghost_set_size = 1;
+            while (shard->ghost_set_size < 2 * shard->ghost_size) {
+                shard->ghost_set_size <<= 1;
+            }
+            shard->ghost_ring = calloc(shard->ghost_size, sizeof(unsigned long));
+            shard->ghost_set = calloc(shard->ghost_set_size, sizeof(unsigned long));
+            if (shard->ghost_ring == NULL || shard->ghost_set == NULL) {
+                _DestroyPolicyState(shard);
+                return ERR_MEMORY;
+            }
+            break;
+        case EVICTION_POLICY_W_TINYLFU:
+            shard->ops = &_w_tinylfu_ops;
+            shard->sketch = CreateFrequencySketch(shard->max_entries);
+            if (shard->sketch == NULL) {
+                return ERR_MEMORY;
+            }
+            break;
+        default:
+            shard->ops = &_lru_ops;
             break;
-        }
-    }
-    free(lru_keys);
-    if (freed_count < free_count) {
-        return ERR_BUFFERS_USED;
     }
     return ERR_OK;
 }
 
-
-// Creates with key and specified buffer size
-// If buffer size do not fit to max_buffer_size - returns ERR_BUFFER_SIZE_LIMIT
-// If cache with this buffer do not fit to max_memory - tries to free least recently used buffers. If there are not enough buffers to free - returns ERR_MEMORY_LIMIT_EXCEEDED
-// If buffer count limit is reached - tries to free least recently used buffer. If all buffers are used - returns ERR_BUFFER_COUNT_EXCEEDED
-int CreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize) {
-    pthread_mutex_lock(&manager->mutex);
-    
-    if (manager->max_buffer_size < bufferSize) {
-        pthread_mutex_unlock(&manager->mutex);
-        return ERR_BUFFER_SIZE_LIMIT;
+void _DestroyRetiredList(RetiredList *list) {
+    while (list->buffers != NULL) {
+        CacheBuffer *next = list->buffers->retired_next;
+        _DestroyCacheBuffer(list->buffers);
+        list->buffers = next;
     }
+    while (list->tables != NULL) {
+        CacheTable *next = list->tables->retired_next;
+        _DestroyCacheTable(list->tables);
+        list->tables = next;
+    }
+}
 
-    if (manager->used_memory + bufferSize > manager->max_memory) {
-        int err = _freeLRUBuffersMemory(manager, bufferSize - (manager->max_memory - manager->used_memory));
-        if (err != ERR_OK) {
-            pthread_mutex_unlock(&manager->mutex);
-            return ERR_MEMORY_LIMIT_EXCEEDED;
+void _DestroyShard(CacheShard *shard) {
+    pthread_mutex_destroy(&shard->mutex);
+
+    // Buffers not moved yet are only in the old table, moved ones in both
+    CacheTable *table = shard->table;
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->slots[i].buffer != NULL && table->slots[i].buffer != CACHE_SLOT_TOMBSTONE) {
+            _DestroyCacheBuffer(table->slots[i].buffer);
         }
-        if (manager->used_memory + bufferSize > manager->max_memory) {
-            pthread_mutex_unlock(&manager->mutex);
-            return ERR_MEMORY_LIMIT_EXCEEDED;
+    }
+    CacheTable *old = shard->old_table;
+    for (size_t i = shard->migrated; old != NULL && i < old->size; i++) {
+        if (old->slots[i].buffer != NULL && old->slots[i].buffer != CACHE_SLOT_TOMBSTONE) {
+            _DestroyCacheBuffer(old->slots[i].buffer);
         }
     }
+    _DestroyCacheTable(table);
+    _DestroyCacheTable(old);
 
-    if (manager->max_entries <= manager->entry_count) {
-        int err = _freeLRUBuffersCount(manager, manager->max_entries - manager->entry_count + 1);
-        if (err != ERR_OK) {
-            pthread_mutex_unlock(&manager->mutex);
-            return ERR_BUFFER_COUNT_EXCEEDED;
-        }
-        if (manager->max_entries <= manager->entry_count) {
-            pthread_mutex_unlock(&manager->mutex);
-            return ERR_BUFFER_COUNT_EXCEEDED;
-        }
+    for (int i = 0; i < 2; i++) {
+        _DestroyRetiredList(&shard->retired[i]);
     }
+    RetiredList stale = {shard->stale, NULL};
+    _DestroyRetiredList(&stale);
 
-    CacheBuffer *buffer = _CreateCacheBuffer(key, bufferSize, manager->hash_table_size);
+    _DestroyPolicyState(shard);
+}
 
-    if (buffer == NULL) {
-        pthread_mutex_unlock(&manager->mutex);
-        return ERR_MEMORY;
-    }
+int _CreateShard(CacheShard *shard, CacheManager *manager, size_t max_memory, size_t max_entries,
+                 EvictionPolicy policy) {
+    shard->manager = manager;
+    shard->max_memory = max_memory;
+    shard->max_entries = max_entries;
 
-    HashTableNode *new = _CreateHashTableNode(buffer);
+    shard->used_memory = 0;
+    shard->entry_count = 0;
 
-    if (new == NULL) {
-        _DestroyCacheBuffer(buffer);
-        pthread_mutex_unlock(&manager->mutex);
-        return ERR_MEMORY;
+    shard->epoch = 0;
+    for (int i = 0; i < EPOCH_STRIPES; i++) {
+        shard->readers[i].active[0] = 0;
+        shard->readers[i].active[1] = 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        shard->retired[i].buffers = NULL;
+        shard->retired[i].tables = NULL;
     }
+    shard->stale = NULL;
 
-    unsigned long hash = buffer->meta->_hash;
+    if (_CreatePolicyState(shard, policy) != ERR_OK) {
+        return ERR_MEMORY;
+    }
 
-    HashTableNode *node = manager->hash_table[hash];
+    shard->table = _CreateCacheTable(shard->max_entries);
 
-    if (node == NULL) {
-        manager->hash_table[hash] = new;
-    } else {
-        while (node->next != NULL) {
-            node = node->next;
-        }
-        node->next = new;
+    if (shard->table == NULL) {
+        _DestroyPolicyState(shard);
+        return ERR_MEMORY;
     }
-    manager->entry_count++;
-    manager->used_memory += bufferSize;
 
-    pthread_mutex_unlock(&manager->mutex);
+    shard->old_table = NULL;
+    shard->migrated = 0;
+
+    pthread_mutex_init(&shard->mutex, NULL);
     return ERR_OK;
 }
 
-ReadBuffer *_CreateReadBuffer(CacheBuffer *buffer) {
-    ReadBuffer *read_buffer = malloc(sizeof(ReadBuffer));
-    if (read_buffer == NULL) {
+CacheManager *CreateCacheManager(const CacheParams *params) {
+    CacheManager *manager = malloc(sizeof(CacheManager));
+
+    if (manager == NULL) {
         return NULL;
     }
-    ReadBuffer rcb = {
-        .data = buffer->data,
-        .size = &buffer->size,
-        .used = &buffer->used,
-        .meta = buffer->meta
-    };
-    memcpy(read_buffer, &rcb, sizeof(ReadBuffer));
 
-    BufferMeta *meta = buffer->meta;
-    
-    pthread_mutex_lock(&meta->_mutex);
-    
-    meta->_reference_count++;
-    meta->_last_reference_time = time(NULL);
-    pthread_mutex_unlock(&meta->_mutex);
+    manager->max_memory = params->max_memory;
+    manager->max_entries = params->max_entries;
+    manager->max_buffer_size = params->max_buffer_size;
+    manager->storage = params->storage;
+    manager->arena = NULL;
+    if (manager->storage == CACHE_STORAGE_ARENA) {
+        manager->arena = CreateCacheArena();
+        if (manager->arena == NULL) {
+            free(manager);
+            return NULL;
+        }
+    }
 
-    return read_buffer;
+    manager->used_memory = 0;
+    manager->entry_count = 0;
+
+    // Every shard holds at least one entry
+    manager->shard_count = params->shard_count > 0 ? params->shard_count : 1;
+    if (manager->shard_count > manager->max_entries && manager->max_entries > 0) {
+        manager->shard_count = manager->max_entries;
+    }
+
+    // Epoch stripes have to stay on their own cache lines
+    manager->shards = aligned_alloc(_Alignof(CacheShard), sizeof(CacheShard) * manager->shard_count);
+
+    if (manager->shards == NULL) {
+        DestroyCacheArena(manager->arena);
+        free(manager);
+        return NULL;
+    }
+
+    // Limits are split evenly, remainders go to the first shards
+    for (size_t i = 0; i < manager->shard_count; i++) {
+        size_t memory = manager->max_memory / manager->shard_count +
+                        (i < manager->max_memory % manager->shard_count ? 1 : 0);
+        size_t entries = manager->max_entries / manager->shard_count +
+                         (i < manager->max_entries % manager->shard_count ? 1 : 0);
+        if (_CreateShard(&manager->shards[i], manager, memory, entries, params->policy) != ERR_OK) {
+            while (i-- > 0) {
+                _DestroyShard(&manager->shards[i]);
+            }
+            free(manager->shards);
+            DestroyCacheArena(manager->arena);
+            free(manager);
+            return NULL;
+        }
+    }
+
+    return manager;
 }
 
-ReadBuffer *GetBuffer(CacheManager *manager, const char *key) {
-    pthread_mutex_lock(&manager->mutex);
-    unsigned long key_hash = hash(key, manager->hash_table_size);
-    HashTableNode *node = manager->hash_table[key_hash];
-    while (node != NULL) {
-        if (strcmp(node->buffer->meta->_key, key) == 0) {
-            break;
+void DestroyCacheManager(CacheManager *manager) {
+    for (size_t i = 0; i < manager->shard_count; i++) {
+        _DestroyShard(&manager->shards[i]);
+    }
+    free(manager->shards);
+    // Buffers of shards went back to it
+    DestroyCacheArena(manager->arena);
+    free(manager);
+}
+
+void GetCacheUsage(CacheManager *manager, size_t *used_memory, size_t *entry_count) {
+    *used_memory = __atomic_load_n(&manager->used_memory, __ATOMIC_RELAXED);
+    *entry_count = __atomic_load_n(&manager->entry_count, __ATOMIC_RELAXED);
+}
+
+bool GetCacheArenaUsage(CacheManager *manager, CacheArenaStats *stats) {
+    if (manager->arena == NULL) {
+        return false;
+    }
+    *stats = GetCacheArenaStats(manager->arena);
+    return true;
+}
+
+unsigned long _KeyHash(const char *key) {
+    return hash64(key, strlen(key));
+}
+
+CacheShard *_GetShard(CacheManager *manager, unsigned long key_hash) {
+    // High bits, low ones pick table slots within shard
+    return &manager->shards[(key_hash >> 32) % manager->shard_count];
+}
+
+// Takes memory and one entry from total limits
+int _ReserveTotals(CacheManager *manager, size_t memory) {
+    size_t used = __atomic_load_n(&manager->used_memory, __ATOMIC_RELAXED);
+    do {
+        if (used + memory > manager->max_memory) {
+            return ERR_MEMORY_LIMIT_EXCEEDED;
+        }
+    } while (!__atomic_compare_exchange_n(&manager->used_memory, &used, used + memory, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    size_t count = __atomic_load_n(&manager->entry_count, __ATOMIC_RELAXED);
+    do {
+        if (count + 1 > manager->max_entries) {
+            __atomic_fetch_sub(&manager->used_memory, memory, __ATOMIC_RELAXED);
+            return ERR_BUFFER_COUNT_EXCEEDED;
+        }
+    } while (!__atomic_compare_exchange_n(&manager->entry_count, &count, count + 1, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return ERR_OK;
+}
+
+void _ReleaseTotals(CacheManager *manager, size_t memory) {
+    __atomic_fetch_sub(&manager->used_memory, memory, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&manager->entry_count, 1, __ATOMIC_RELAXED);
+}
+
+static _Thread_local unsigned _epoch_stripe = EPOCH_STRIPES;
+static unsigned _epoch_stripe_next = 0;
+
+// Marks lookup of calling thread as in progress, returns counter to pass
+// to _LeaveEpoch
+size_t *_EnterEpoch(CacheShard *shard) {
+    if (_epoch_stripe == EPOCH_STRIPES) {
+        _epoch_stripe = __atomic_fetch_add(&_epoch_stripe_next, 1, __ATOMIC_RELAXED) % EPOCH_STRIPES;
+    }
+    size_t *active;
+    while (true) {
+        size_t epoch = __atomic_load_n(&shard->epoch, __ATOMIC_SEQ_CST);
+        active = &shard->readers[_epoch_stripe].active[epoch & 1];
+        __atomic_fetch_add(active, 1, __ATOMIC_SEQ_CST);
+        // Epoch may have moved on before the counter was seen
+        if (__atomic_load_n(&shard->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            return active;
         }
-        node = node->next;
+        __atomic_fetch_sub(active, 1, __ATOMIC_RELEASE);
     }
-    if (node == NULL) {
-        pthread_mutex_unlock(&manager->mutex);
-        return NULL;
+}
+
+void _LeaveEpoch(size_t *active) {
+    __atomic_fetch_sub(active, 1, __ATOMIC_RELEASE);
+}
+
+bool _IsRetiredListEmpty(RetiredList *list) {
+    return list->buffers == NULL && list->tables == NULL;
+}
+
+// Moves to the next epoch once lookups of the previous one left, buffers
+// and tables retired in it are moved to freed.
+// Shard must be already locked up to this point.
+bool _AdvanceEpoch(CacheShard *shard, RetiredList *freed) {
+    if (_IsRetiredListEmpty(&shard->retired[0]) && _IsRetiredListEmpty(&shard->retired[1])) {
+        return false;
+    }
+    size_t next = shard->epoch + 1;
+    for (int i = 0; i < EPOCH_STRIPES; i++) {
+        if (__atomic_load_n(&shard->readers[i].active[next & 1], __ATOMIC_SEQ_CST) != 0) {
+            return false;
+        }
+    }
+
+    RetiredList *retired = &shard->retired[next & 1];
+    CacheBuffer **buffers = &freed->buffers;
+    while (*buffers != NULL) {
+        buffers = &(*buffers)->retired_next;
+    }
+    *buffers = retired->buffers;
+    CacheTable **tables = &freed->tables;
+    while (*tables != NULL) {
+        tables = &(*tables)->retired_next;
+    }
+    *tables = retired->tables;
+    retired->buffers = NULL;
+    retired->tables = NULL;
+    __atomic_store_n(&shard->epoch, next, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+// Gives back room of unlinked buffer and retires it.
+// Shard must be already locked up to this point.
+void _RetireBuffer(CacheShard *shard, CacheBuffer *buffer) {
+    shard->used_memory -= buffer->size;
+    shard->entry_count--;
+    _ReleaseTotals(shard->manager, buffer->size);
+
+    buffer->retired_next = shard->retired[shard->epoch & 1].buffers;
+    shard->retired[shard->epoch & 1].buffers = buffer;
+}
+
+// Retires stale buffers that are not referenced anymore.
+// Shard must be already locked up to this point.
+void _SweepStale(CacheShard *shard) {
+    CacheBuffer **link = &shard->stale;
+    while (*link != NULL) {
+        CacheBuffer *buffer = *link;
+        size_t unreferenced = 0;
+        if (!__atomic_compare_exchange_n(&buffer->meta->_reference_count, &unreferenced, BUFFER_UNLINKED, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            link = &buffer->retired_next;
+            continue;
+        }
+        *link = buffer->retired_next;
+        _RetireBuffer(shard, buffer);
+    }
+}
+
+// Unlocks shard, what was retired and no lookup can be inside of anymore
+// is freed after
+void _UnlockShard(CacheShard *shard) {
+    _SweepStale(shard);
+    RetiredList freed = {NULL, NULL};
+    // Retired now is freed after two epochs if nothing is looked up
+    if (_AdvanceEpoch(shard, &freed)) {
+        _AdvanceEpoch(shard, &freed);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    _DestroyRetiredList(&freed);
+}
+
+// Moves all remaining slots of old table, or a step of them that keeps
+// ahead of the new table filling up. Old table is retired once all are
+// moved.
+// Shard must be already locked up to this point.
+void _MigrateTable(CacheShard *shard, bool all) {
+    CacheTable *old = shard->old_table;
+    if (old == NULL) {
+        return;
+    }
+    // Shrunk table takes in less than there is to move
+    size_t steps = CACHE_TABLE_MIGRATE_STEP;
+    if (old->size > shard->table->size) {
+        steps *= old->size / shard->table->size;
+    }
+    for (; (all || steps > 0) && shard->migrated < old->size; steps--, shard->migrated++) {
+        CacheBuffer *buffer = old->slots[shard->migrated].buffer;
+        if (buffer != NULL && buffer != CACHE_SLOT_TOMBSTONE) {
+            _TablePut(shard->table, buffer);
+        }
+    }
+    if (shard->migrated < old->size) {
+        return;
+    }
+
+    __atomic_store_n(&shard->old_table, NULL, __ATOMIC_RELEASE);
+    old->retired_next = shard->retired[shard->epoch & 1].tables;
+    shard->retired[shard->epoch & 1].tables = old;
+}
+
+// Makes room for one more buffer in table, starting rehash if it is
+// filled up. Table is grown, or kept if it is mostly tombstones.
+// Shard must be already locked up to this point.
+int _ReserveTableSlot(CacheShard *shard) {
+    _MigrateTable(shard, false);
+
+    CacheTable *table = shard->table;
+    if ((table->filled + 1) * 100 <= table->size * CACHE_TABLE_MAX_LOAD) {
+        return ERR_OK;
+    }
+
+    CacheTable *new = _CreateCacheTable(shard->entry_count + 1);
+    if (new == NULL) {
+        return ERR_MEMORY;
+    }
+    // Only one rehash at a time
+    _MigrateTable(shard, true);
+
+    shard->migrated = 0;
+    __atomic_store_n(&shard->old_table, table, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard->table, new, __ATOMIC_RELEASE);
+    // Every change while migrating moves a step further, so it finishes
+    // long before the new table fills up
+    _MigrateTable(shard, false);
+    return ERR_OK;
+}
+
+// Takes buffer out of tables and eviction queues, so it is not found
+// anymore.
+// Shard must be already locked up to this point.
+bool _UnlinkBuffer(CacheShard *shard, CacheBuffer *buffer) {
+    // Moved buffers are in both tables until rehash is done
+    bool found = _TableRemove(shard->table, buffer);
+    if (shard->old_table != NULL) {
+        found = _TableRemove(shard->old_table, buffer) || found;
+    }
+    if (!found) {
+        return false;
+    }
+    _MigrateTable(shard, false);
+    _QueueUnlink(shard, buffer);
+    return true;
+}
+
+// Shard must be already locked up to this point.
+int _DeleteBuffer(CacheShard *shard, CacheBuffer *buffer) {
+    // Lookups still finding it can't take references after this
+    size_t unreferenced = 0;
+    if (!__atomic_compare_exchange_n(&buffer->meta->_reference_count, &unreferenced, BUFFER_UNLINKED, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return ERR_BUFFER_REFERENCED;
+    }
+
+    if (!_UnlinkBuffer(shard, buffer)) {
+        __atomic_store_n(&buffer->meta->_reference_count, 0, __ATOMIC_RELEASE);
+        return ERR_KEY_NOT_FOUND;
+    }
+    _RetireBuffer(shard, buffer);
+    return ERR_OK;
+}
+
+// Unlinks buffer, referenced one is kept stale until it is released.
+// Shard must be already locked up to this point.
+void _InvalidateBuffer(CacheShard *shard, CacheBuffer *buffer) {
+    if (!_UnlinkBuffer(shard, buffer)) {
+        return;
+    }
+    buffer->retired_next = shard->stale;
+    shard->stale = buffer;
+}
+
+// Frees not referenced buffers picked by eviction policy, at least memory
+// bytes and count of them. Nothing is freed if there are not enough.
+// Shard must be already locked up to this point.
+int _FreeBuffers(CacheShard *shard, size_t memory, size_t count) {
+    // Only queue tails that cover the request are scanned
+    size_t found_memory = 0;
+    size_t found_count = 0;
+    for (int i = 0; i < CACHE_QUEUE_COUNT; i++) {
+        CacheBuffer *buffer = shard->queues[i].tail;
+        while (buffer != NULL && (found_memory < memory || found_count < count)) {
+            if (!_IsBufferReferenced(buffer)) {
+                found_memory += buffer->size;
+                found_count++;
+            }
+            buffer = buffer->queue_prev;
+        }
+    }
+    if (found_memory < memory || found_count < count) {
+        return ERR_BUFFERS_USED;
+    }
+
+    size_t freed_memory = 0;
+    size_t freed_count = 0;
+    while (freed_memory < memory || freed_count < count) {
+        CacheBuffer *buffer = shard->ops->victim(shard);
+        if (buffer == NULL) {
+            return ERR_BUFFERS_USED;
+        }
+        size_t size = buffer->size;
+        if (_DeleteBuffer(shard, buffer) != ERR_OK) {
+            return ERR_BUFFERS_USED;
+        }
+        freed_memory += size;
+        freed_count++;
+    }
+    return ERR_OK;
+}
+
+// Evicts buffers of shard that went over its share of limits.
+// Shard must be already locked up to this point.
+void _ShrinkShard(CacheShard *shard) {
+    while (shard->used_memory > shard->max_memory || shard->entry_count > shard->max_entries) {
+        CacheBuffer *buffer = shard->ops->victim(shard);
+        if (buffer == NULL || _DeleteBuffer(shard, buffer) != ERR_OK) {
+            return;
+        }
+    }
+}
+
+// Takes back room borrowed over their share by shards, own one included.
+// Other shards that are busy are skipped, waiting for them while holding
+// own lock could deadlock.
+// Shard must be already locked up to this point.
+void _ReclaimBorrowed(CacheShard *shard) {
+    CacheManager *manager = shard->manager;
+    _ShrinkShard(shard);
+    for (size_t i = 0; i < manager->shard_count; i++) {
+        CacheShard *other = &manager->shards[i];
+        if (other == shard || pthread_mutex_trylock(&other->mutex) != 0) {
+            continue;
+        }
+        _ShrinkShard(other);
+        _UnlockShard(other);
+    }
+}
+
+// Makes room for a buffer of bufferSize and takes it from totals.
+// If shard with this buffer do not fit to its share of memory or entries - tries to free buffers chosen by eviction policy. If there are not enough buffers to free - nothing is freed.
+// Total limits are checked after, so shard may borrow room others don't use. If they are reached - shards give back what they borrowed, then if it still does not fit returns ERR_MEMORY_LIMIT_EXCEEDED or ERR_BUFFER_COUNT_EXCEEDED
+// Shard must be already locked up to this point.
+int _ReserveRoom(CacheShard *shard, size_t bufferSize) {
+    if (shard->used_memory + bufferSize > shard->max_memory) {
+        size_t over = shard->used_memory + bufferSize - shard->max_memory;
+        // Buffer that is larger than the share can only be borrowed for
+        if (over <= shard->used_memory) {
+            _FreeBuffers(shard, over, 0);
+        }
+    }
+
+    if (shard->max_entries <= shard->entry_count) {
+        _FreeBuffers(shard, 0, shard->entry_count - shard->max_entries + 1);
+    }
+
+    int err = _ReserveTotals(shard->manager, bufferSize);
+    if (err != ERR_OK) {
+        _ReclaimBorrowed(shard);
+        err = _ReserveTotals(shard->manager, bufferSize);
+    }
+    return err;
+}
+
+// Links already allocated buffer into shard, see _ReserveRoom for limits.
+// Shard must be already locked up to this point.
+int _InsertBuffer(CacheShard *shard, CacheBuffer *buffer) {
+    size_t bufferSize = buffer->size;
+
+    int err = _ReserveRoom(shard, bufferSize);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    err = _ReserveTableSlot(shard);
+    if (err != ERR_OK) {
+        _ReleaseTotals(shard->manager, bufferSize);
+        return err;
     }
-    ReadBuffer *buffer = _CreateReadBuffer(node->buffer);
+    _TablePut(shard->table, buffer);
+    shard->entry_count++;
+    shard->used_memory += bufferSize;
+    shard->ops->insert(shard, buffer);
+    return ERR_OK;
+}
+
+// Creates with key and specified buffer size
+// If buffer size do not fit to max_buffer_size - returns ERR_BUFFER_SIZE_LIMIT
+// Buffer is allocated before its shard is locked, see _InsertBuffer for limits
+int CreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize) {
+    if (manager->max_buffer_size < bufferSize) {
+        return ERR_BUFFER_SIZE_LIMIT;
+    }
+
+    unsigned long key_hash = _KeyHash(key);
+    CacheShard *shard = _GetShard(manager, key_hash);
+    CacheBuffer *buffer = _CreateCacheBuffer(key, bufferSize, key_hash, manager->storage, manager->arena);
     if (buffer == NULL) {
-        pthread_mutex_unlock(&manager->mutex);
-        return NULL;
+        return ERR_MEMORY;
     }
 
-    pthread_mutex_unlock(&manager->mutex);
+    pthread_mutex_lock(&shard->mutex);
+    int err = _InsertBuffer(shard, buffer);
+    _UnlockShard(shard);
+
+    if (err != ERR_OK) {
+        _DestroyCacheBuffer(buffer);
+    }
+    return err;
+}
+
+// Shard must be already locked up to this point.
+CacheBuffer *_FindBuffer(CacheShard *shard, unsigned long key_hash, const char *key) {
+    CacheBuffer *buffer = _TableFind(shard->table, key_hash, key);
+    if (buffer == NULL && shard->old_table != NULL) {
+        buffer = _TableFind(shard->old_table, key_hash, key);
+    }
     return buffer;
 }
 
-void ReleaseBuffer(ReadBuffer *buffer) {
-    BufferMeta *meta = buffer->meta;
+// Finds buffer and takes a reference to it without locking shard.
+// NULL if there is none or it is being dropped.
+CacheBuffer *_LookupBuffer(CacheShard *shard, unsigned long key_hash, const char *key) {
+    CacheBuffer *found = NULL;
+
+    size_t *active = _EnterEpoch(shard);
+    CacheTable *table = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+    while (true) {
+        CacheTable *old = __atomic_load_n(&shard->old_table, __ATOMIC_ACQUIRE);
+        found = _TableFind(table, key_hash, key);
+        if (found == NULL && old != NULL) {
+            found = _TableFind(old, key_hash, key);
+        }
+        if (found != NULL && !_TryReferenceBuffer(found)) {
+            found = NULL;
+        }
+        // Table that was replaced meanwhile may miss buffers added since
+        CacheTable *current = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+        if (found != NULL || current == table) {
+            break;
+        }
+        table = current;
+    }
+    _LeaveEpoch(active);
+
+    if (found != NULL) {
+        _RecordHit(shard, found);
+    }
+    return found;
+}
+
+// Finds buffer under lock, inserting spare if there is none, and takes a
+// reference to it. Spare is set to NULL once it was inserted.
+int _GetOrInsertBuffer(CacheShard *shard, const char *key, CacheBuffer **spare, CacheBuffer **buffer) {
+    pthread_mutex_lock(&shard->mutex);
+    CacheBuffer *cache_buffer = _FindBuffer(shard, (*spare)->key_hash, key);
+    if (cache_buffer == NULL) {
+        int err = _InsertBuffer(shard, *spare);
+        if (err != ERR_OK) {
+            _UnlockShard(shard);
+            return err;
+        }
+        cache_buffer = *spare;
+        *spare = NULL;
+    } else {
+        _RecordHit(shard, cache_buffer);
+    }
+    // Linked buffers are only dropped under the lock
+    __atomic_fetch_add(&cache_buffer->meta->_reference_count, 1, __ATOMIC_ACQUIRE);
+    _UnlockShard(shard);
+
+    *buffer = cache_buffer;
+    return ERR_OK;
+}
+
+int GetOrCreateBuffer(CacheManager *manager, const char *key, const size_t bufferSize,
+                      ReadBuffer **buffer, WriteBuffer **loader) {
+    *buffer = NULL;
+    *loader = NULL;
+
+    unsigned long key_hash = _KeyHash(key);
+    CacheShard *shard = _GetShard(manager, key_hash);
+    CacheBuffer *cache_buffer = _LookupBuffer(shard, key_hash, key);
+    if (cache_buffer == NULL) {
+        if (manager->max_buffer_size < bufferSize) {
+            return ERR_BUFFER_SIZE_LIMIT;
+        }
+        // Allocated for a miss outside the lock, dropped if a concurrent
+        // miss created the buffer meanwhile
+        CacheBuffer *spare = _CreateCacheBuffer(key, bufferSize, key_hash, manager->storage, manager->arena);
+        if (spare == NULL) {
+            return ERR_MEMORY;
+        }
+
+        int err = _GetOrInsertBuffer(shard, key, &spare, &cache_buffer);
+        if (spare != NULL) {
+            _DestroyCacheBuffer(spare);
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+    *buffer = &cache_buffer->read_handle;
+
+    // Loaded buffers are hits that need no more than the reference
+    if (__atomic_load_n(&cache_buffer->used, __ATOMIC_ACQUIRE) == cache_buffer->size) {
+        return ERR_OK;
+    }
+
+    // used only changes under load claim, so it is stable while unclaimed
+    BufferMeta *meta = cache_buffer->meta;
     pthread_mutex_lock(&meta->_mutex);
-    
-    meta->_reference_count--;
+    bool claim = !meta->_loading && cache_buffer->used != cache_buffer->size;
+    if (claim) {
+        meta->_loading = true;
+        // Loader holds a reference of its own
+        __atomic_fetch_add(&meta->_reference_count, 1, __ATOMIC_RELAXED);
+    }
     pthread_mutex_unlock(&meta->_mutex);
 
-    free(buffer);
+    if (claim) {
+        *loader = &cache_buffer->write_handle;
+    }
+    return ERR_OK;
 }
 
-WriteBuffer *_CreateWriteBuffer(CacheBuffer *buffer) {
-    WriteBuffer *write_buffer = malloc(sizeof(WriteBuffer));
-    if (write_buffer == NULL) {
-        return NULL;
+int GetOrMapBuffer(CacheManager *manager, const char *path, ReadBuffer **buffer) {
+    *buffer = NULL;
+
+    unsigned long key_hash = _KeyHash(path);
+    CacheShard *shard = _GetShard(manager, key_hash);
+    CacheBuffer *cache_buffer = _LookupBuffer(shard, key_hash, path);
+    if (cache_buffer == NULL) {
+        // Mapped outside the lock like spares of GetOrCreateBuffer
+        CacheBuffer *spare;
+        int err = _MapCacheBuffer(path, manager->max_buffer_size, key_hash, &spare);
+        if (err != ERR_OK) {
+            return err;
+        }
+
+        err = _GetOrInsertBuffer(shard, path, &spare, &cache_buffer);
+        if (spare != NULL) {
+            _DestroyCacheBuffer(spare);
+        }
+        if (err != ERR_OK) {
+            return err;
+        }
     }
-    WriteBuffer wbc = {
-        .data = buffer->data,
-        .size = &buffer->size,
-        .used = &buffer->used,
-        .meta = buffer->meta
-    };
-    memcpy(write_buffer, &wbc, sizeof(WriteBuffer));
+    *buffer = &cache_buffer->read_handle;
+    return ERR_OK;
+}
+
+int InvalidateBuffer(CacheManager *manager, const char *key) {
+    unsigned long key_hash = _KeyHash(key);
+    CacheShard *shard = _GetShard(manager, key_hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    CacheBuffer *buffer = _FindBuffer(shard, key_hash, key);
+    if (buffer == NULL) {
+        _UnlockShard(shard);
+        return ERR_KEY_NOT_FOUND;
+    }
+    _InvalidateBuffer(shard, buffer);
+    _UnlockShard(shard);
+    return ERR_OK;
+}
+
+size_t InvalidateBuffersWithPrefix(CacheManager *manager, const char *prefix) {
+    size_t length = strlen(prefix);
+    size_t count = 0;
+    for (size_t i = 0; i < manager->shard_count; i++) {
+        CacheShard *shard = &manager->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        // Rehash would move buffers around while slots are scanned
+        _MigrateTable(shard, true);
+        CacheTable *table = shard->table;
+        for (size_t j = 0; j < table->size; j++) {
+            CacheBuffer *buffer = table->slots[j].buffer;
+            if (buffer != NULL && buffer != CACHE_SLOT_TOMBSTONE &&
+                strncmp(buffer->meta->_key, prefix, length) == 0) {
+                _InvalidateBuffer(shard, buffer);
+                count++;
+            }
+        }
+        _UnlockShard(shard);
+    }
+    return count;
+}
+
+size_t CollectBuffers(CacheManager *manager, ReadBuffer **buffers, size_t capacity) {
+    size_t count = 0;
+    for (size_t i = 0; i < manager->shard_count && count < capacity; i++) {
+        CacheShard *shard = &manager->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        for (int id = 0; id < CACHE_QUEUE_COUNT; id++) {
+            CacheBuffer *buffer = shard->queues[id].tail;
+            for (; buffer != NULL && count < capacity; buffer = buffer->queue_prev) {
+                if (__atomic_load_n(&buffer->used, __ATOMIC_ACQUIRE) == buffer->size &&
+                    _TryReferenceBuffer(buffer)) {
+                    buffers[count++] = &buffer->read_handle;
+                }
+            }
+        }
+        _UnlockShard(shard);
+    }
+    return count;
+}
+
+const char *GetBufferKey(const ReadBuffer *buffer) {
+    return buffer->meta->_key;
+}
 
+void SetBufferMtime(WriteBuffer *buffer, const struct timespec *mtime) {
     BufferMeta *meta = buffer->meta;
     pthread_mutex_lock(&meta->_mutex);
-    
-    meta->_reference_count++;
-    meta->_last_reference_time = time(NULL);
+    meta->_has_mtime = true;
+    meta->_mtime = *mtime;
     pthread_mutex_unlock(&meta->_mutex);
+}
 
-    return write_buffer;
+bool GetBufferMtime(const ReadBuffer *buffer, struct timespec *mtime) {
+    BufferMeta *meta = buffer->meta;
+    pthread_mutex_lock(&meta->_mutex);
+    bool known = meta->_has_mtime;
+    *mtime = meta->_mtime;
+    pthread_mutex_unlock(&meta->_mutex);
+    return known;
 }
 
-WriteBuffer *GetWriteBuffer(CacheManager *manager, const char *key) {
-    pthread_mutex_lock(&manager->mutex);
-    unsigned long key_hash = hash(key, manager->hash_table_size);
-    HashTableNode *node = manager->hash_table[key_hash];
-    while (node != NULL) {
-        if (strcmp(node->buffer->meta->_key, key) == 0) {
-            break;
-        }
-        node = node->next;
+int StartBufferRefresh(CacheManager *manager, const char *key, const size_t bufferSize, WriteBuffer **shadow) {
+    *shadow = NULL;
+    if (manager->max_buffer_size < bufferSize) {
+        return ERR_BUFFER_SIZE_LIMIT;
     }
-    if (node == NULL) {
-        return NULL;
+
+    unsigned long key_hash = _KeyHash(key);
+    CacheShard *shard = _GetShard(manager, key_hash);
+    pthread_mutex_lock(&shard->mutex);
+    bool found = _FindBuffer(shard, key_hash, key) != NULL;
+    _UnlockShard(shard);
+    if (!found) {
+        return ERR_KEY_NOT_FOUND;
     }
 
-    WriteBuffer *buffer = _CreateWriteBuffer(node->buffer);
+    CacheBuffer *buffer = _CreateCacheBuffer(key, bufferSize, key_hash, manager->storage, manager->arena);
     if (buffer == NULL) {
-        pthread_mutex_unlock(&manager->mutex);
+        return ERR_MEMORY;
+    }
+    // Claimed for the caller, not linked until it is committed
+    buffer->meta->_loading = true;
+    *shadow = &buffer->write_handle;
+    return ERR_OK;
+}
+
+// Swaps loaded buffer in for the current one of its key. Current one is
+// kept stale until it is released, so room for both is needed meanwhile.
+// Shard must be already locked up to this point.
+int _ReplaceBuffer(CacheShard *shard, CacheBuffer *current, CacheBuffer *buffer) {
+    // Making room must not evict the buffer being replaced
+    __atomic_fetch_add(&current->meta->_reference_count, 1, __ATOMIC_ACQUIRE);
+    int err = _ReserveRoom(shard, buffer->size);
+    __atomic_fetch_sub(&current->meta->_reference_count, 1, __ATOMIC_RELEASE);
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    _TableReplace(shard->table, current, buffer);
+    if (shard->old_table != NULL) {
+        _TableReplace(shard->old_table, current, buffer);
+    }
+    _QueueReplace(shard, current, buffer);
+    shard->entry_count++;
+    shard->used_memory += buffer->size;
+
+    current->retired_next = shard->stale;
+    shard->stale = current;
+    return ERR_OK;
+}
+
+// Swaps buffer in for the current one of its key, buffer is consumed
+int _CommitRefresh(CacheManager *manager, CacheBuffer *buffer) {
+    CacheShard *shard = _GetShard(manager, buffer->key_hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    CacheBuffer *current = _FindBuffer(shard, buffer->key_hash, buffer->meta->_key);
+    int err = ERR_OK;
+    if (current == NULL) {
+        // Dropped meanwhile, file may be gone by now
+        err = ERR_KEY_NOT_FOUND;
+    } else if (__atomic_load_n(&buffer->used, __ATOMIC_RELAXED) != buffer->size) {
+        // Old version is known to be outdated
+        _InvalidateBuffer(shard, current);
+        err = ERR_BUFFER_INCOMPLETE;
+    } else {
+        err = _ReplaceBuffer(shard, current, buffer);
+        if (err != ERR_OK) {
+            _InvalidateBuffer(shard, current);
+        }
+    }
+    _UnlockShard(shard);
+
+    if (err != ERR_OK) {
+        _DestroyCacheBuffer(buffer);
+    }
+    return err;
+}
+
+int CommitBufferRefresh(CacheManager *manager, WriteBuffer *shadow) {
+    CacheBuffer *buffer = (CacheBuffer *) ((char *) shadow - offsetof(CacheBuffer, write_handle));
+    // Nobody else sees it before it is linked
+    buffer->meta->_loading = false;
+    return _CommitRefresh(manager, buffer);
+}
+
+int RemapBuffer(CacheManager *manager, const char *path) {
+    unsigned long key_hash = _KeyHash(path);
+    CacheShard *shard = _GetShard(manager, key_hash);
+    pthread_mutex_lock(&shard->mutex);
+    bool found = _FindBuffer(shard, key_hash, path) != NULL;
+    _UnlockShard(shard);
+    if (!found) {
+        return ERR_KEY_NOT_FOUND;
+    }
+
+    CacheBuffer *buffer;
+    int err = _MapCacheBuffer(path, manager->max_buffer_size, key_hash, &buffer);
+    if (err != ERR_OK) {
+        // Old version is known to be outdated
+        InvalidateBuffer(manager, path);
+        return err;
+    }
+    return _CommitRefresh(manager, buffer);
+}
+
+ReadBuffer *GetBuffer(CacheManager *manager, const char *key) {
+    unsigned long key_hash = _KeyHash(key);
+    CacheBuffer *cache_buffer = _LookupBuffer(_GetShard(manager, key_hash), key_hash, key);
+    if (cache_buffer == NULL) {
         return NULL;
     }
+    return &cache_buffer->read_handle;
+}
 
-    pthread_mutex_unlock(&manager->mutex);
-    return buffer;
+void ReleaseBuffer(ReadBuffer *buffer) {
+    __atomic_fetch_sub(&buffer->meta->_reference_count, 1, __ATOMIC_RELEASE);
+}
+
+WriteBuffer *GetWriteBuffer(CacheManager *manager, const char *key) {
+    unsigned long key_hash = _KeyHash(key);
+    CacheBuffer *cache_buffer = _LookupBuffer(_GetShard(manager, key_hash), key_hash, key);
+    if (cache_buffer == NULL) {
+        return NULL;
+    }
+    return &cache_buffer->write_handle;
 }
 
 void ReleaseWriteBuffer(WriteBuffer *buffer) {
-    BufferMeta *meta = buffer->meta;
-    pthread_mutex_lock(&meta->_mutex);
-    meta->_reference_count--;
-    pthread_mutex_unlock(&meta->_mutex);
+    __atomic_fetch_sub(&buffer->meta->_reference_count, 1, __ATOMIC_RELEASE);
+}
 
-    free(buffer);
+size_t GetBufferUsed(const ReadBuffer *buffer) {
+    return __atomic_load_n(buffer->used, __ATOMIC_ACQUIRE);
 }
 
 void LockReadBuffer(ReadBuffer *buffer) {
@@ -567,4 +1804,66 @@ void UnlockWriteBuffer(WriteBuffer *buffer) {
     pthread_rwlock_unlock(&buffer->meta->_lock);
 }
 
+int StartBufferLoad(WriteBuffer *buffer) {
+    BufferMeta *meta = buffer->meta;
+    pthread_mutex_lock(&meta->_mutex);
+    if (meta->_loading) {
+        pthread_mutex_unlock(&meta->_mutex);
+        return ERR_BUFFER_LOADING;
+    }
+    meta->_loading = true;
+    pthread_mutex_unlock(&meta->_mutex);
+    return ERR_OK;
+}
+
+void PublishBufferLoad(WriteBuffer *buffer, size_t used) {
+    // Lookups read it without taking buffer lock
+    LockWriteBuffer(buffer);
+    __atomic_store_n(buffer->used, used, __ATOMIC_RELEASE);
+    UnlockWriteBuffer(buffer);
+
+    BufferMeta *meta = buffer->meta;
+    pthread_mutex_lock(&meta->_mutex);
+    for (BufferWaiter *waiter = meta->_waiters; waiter != NULL; waiter = waiter->_next) {
+        waiter->callback(BUFFER_LOAD_PROGRESS, waiter->userData);
+    }
+    pthread_mutex_unlock(&meta->_mutex);
+}
+
+void FinishBufferLoad(WriteBuffer *buffer) {
+    // Only the claim holder writes used, so it can be read unlocked here
+    BufferLoadEvent event = *buffer->used == *buffer->size ? BUFFER_LOAD_DONE : BUFFER_LOAD_FAILED;
+
+    BufferMeta *meta = buffer->meta;
+    pthread_mutex_lock(&meta->_mutex);
+    meta->_loading = false;
+    BufferWaiter *waiter = meta->_waiters;
+    meta->_waiters = NULL;
+    for (BufferWaiter *w = waiter; w != NULL; w = w->_next) {
+        __atomic_fetch_sub(&meta->_reference_count, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&meta->_mutex);
+
+    // Waiter may be freed as soon as it is notified
+    while (waiter != NULL) {
+        BufferWaiter *next = waiter->_next;
+        waiter->callback(event, waiter->userData);
+        waiter = next;
+    }
+}
+
+int AddBufferWaiter(ReadBuffer *buffer, BufferWaiter *waiter) {
+    BufferMeta *meta = buffer->meta;
+    pthread_mutex_lock(&meta->_mutex);
+    if (!meta->_loading) {
+        pthread_mutex_unlock(&meta->_mutex);
+        return ERR_BUFFER_NOT_LOADING;
+    }
+    waiter->_next = meta->_waiters;
+    meta->_waiters = waiter;
+    __atomic_fetch_add(&meta->_reference_count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&meta->_mutex);
+    return ERR_OK;
+}
+
 
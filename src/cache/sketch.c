@@ -0,0 +1,105 @@
+#include "cache/sketch.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define SKETCH_DEPTH 4
+#define SKETCH_MIN_WIDTH 16
+// Counters per row for each expected entry, keeps collisions rare
+#define SKETCH_WIDTH_FACTOR 4
+#define SKETCH_SAMPLE_FACTOR 10
+
+struct FrequencySketch {
+    uint8_t *counters;
+    // Power of two, counters of a row
+    size_t width;
+
+    size_t additions;
+    size_t sample_size;
+};
+
+static const unsigned long _sketch_seeds[SKETCH_DEPTH] = {
+    0xc3a5c85c97cb3127UL,
+    0xb492b66fbe98f273UL,
+    0x9ae16a3b2f90404fUL,
+    0xcbf29ce484222325UL
+};
+
+FrequencySketch *CreateFrequencySketch(size_t expected_entries) {
+    FrequencySketch *sketch = malloc(sizeof(FrequencySketch));
+    if (sketch == NULL) {
+        return NULL;
+    }
+
+    sketch->width = SKETCH_MIN_WIDTH;
+    while (sketch->width < SKETCH_WIDTH_FACTOR * expected_entries) {
+        sketch->width <<= 1;
+    }
+
+    sketch->counters = calloc(SKETCH_DEPTH * sketch->width, sizeof(uint8_t));
+    if (sketch->counters == NULL) {
+        free(sketch);
+        return NULL;
+    }
+
+    sketch->additions = 0;
+    sketch->sample_size = SKETCH_SAMPLE_FACTOR * (expected_entries > 0 ? expected_entries : 1);
+
+    return sketch;
+}
+
+void DestroyFrequencySketch(FrequencySketch *sketch) {
+    if (sketch == NULL) return;
+    free(sketch->counters);
+    free(sketch);
+}
+
+size_t _SketchIndex(const FrequencySketch *sketch, unsigned long key_hash, int row) {
+    unsigned long h = (key_hash + _sketch_seeds[row]) * _sketch_seeds[row];
+    h ^= h >> 32;
+    return row * sketch->width + (h & (sketch->width - 1));
+}
+
+void _AgeSketch(FrequencySketch *sketch) {
+    for (size_t i = 0; i < SKETCH_DEPTH * sketch->width; i++) {
+        sketch->counters[i] >>= 1;
+    }
+    sketch->additions /= 2;
+}
+
+void IncrementFrequency(FrequencySketch *sketch, unsigned long key_hash) {
+    size_t indexes[SKETCH_DEPTH];
+    unsigned min = SKETCH_MAX_FREQUENCY;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        indexes[row] = _SketchIndex(sketch, key_hash, row);
+        if (sketch->counters[indexes[row]] < min) {
+            min = sketch->counters[indexes[row]];
+        }
+    }
+    if (min == SKETCH_MAX_FREQUENCY) {
+        return;
+    }
+
+    // Conservative update: only the counters holding the estimate grow,
+    // which keeps collisions from inflating other keys
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        if (sketch->counters[indexes[row]] == min) {
+            sketch->counters[indexes[row]]++;
+        }
+    }
+
+    if (++sketch->additions >= sketch->sample_size) {
+        _AgeSketch(sketch);
+    }
+}
+
+unsigned EstimateFrequency(const FrequencySketch *sketch, unsigned long key_hash) {
+    unsigned min = SKETCH_MAX_FREQUENCY;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        unsigned counter = sketch->counters[_SketchIndex(sketch, key_hash, row)];
+        if (counter < min) {
+            min = counter;
+        }
+    }
+    return min;
+}
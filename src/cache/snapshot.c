@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include "cache/snapshot.h"
+#include "utils/log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "CACHESNP"
+#define SNAPSHOT_VERSION 1
+// Entry is followed by contents of file after its key
+#define SNAPSHOT_ENTRY_BODY 1
+// Stream buffer, bodies larger than it bypass it
+#define SNAPSHOT_IO_BUFFER (1024 * 1024)
+
+// Snapshot is header and entries, each followed by its key and body.
+// Fields are in host byte order, snapshots stay on the machine that wrote
+// them.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entry_count;
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t key_length;
+    uint32_t flags;
+} SnapshotEntry;
+
+double _SnapshotElapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int _SaveSnapshotEntry(FILE *file, ReadBuffer *buffer, bool bodies, CacheSnapshotStats *stats) {
+    const char *key = GetBufferKey(buffer);
+    size_t size = *buffer->size;
+    struct timespec mtime;
+    bool known = GetBufferMtime(buffer, &mtime);
+    struct stat st;
+    // Watcher may not have dropped or refreshed a changed file yet
+    if (stat(key, &st) != 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size != size) {
+        stats->skipped++;
+        return ERR_OK;
+    }
+    if (!known && size == 0) {
+        // Empty buffers are loaded by nobody, and can't be out of date
+        mtime = st.st_mtim;
+    } else if (!known || mtime.tv_sec != st.st_mtim.tv_sec || mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        stats->skipped++;
+        return ERR_OK;
+    }
+
+    SnapshotEntry entry = {size, mtime.tv_sec, mtime.tv_nsec, strlen(key), bodies ? SNAPSHOT_ENTRY_BODY : 0};
+    if (fwrite(&entry, sizeof(SnapshotEntry), 1, file) != 1 ||
+        fwrite(key, 1, entry.key_length, file) != entry.key_length) {
+        return ERR_SNAPSHOT_IO;
+    }
+    // Loaded buffers don't change, refreshes swap in new ones
+    if (bodies) {
+        if (fwrite(buffer->data, 1, size, file) != size) {
+            return ERR_SNAPSHOT_IO;
+        }
+        stats->bytes += size;
+    }
+    stats->entries++;
+    return ERR_OK;
+}
+
+int _WriteSnapshot(FILE *file, ReadBuffer **buffers, size_t count, bool bodies, CacheSnapshotStats *stats) {
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    if (fwrite(&header, sizeof(SnapshotHeader), 1, file) != 1) {
+        return ERR_SNAPSHOT_IO;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        int err = _SaveSnapshotEntry(file, buffers[i], bodies, stats);
+        if (err != ERR_OK) {
+            return err;
+        }
+    }
+
+    // Count is known once out of date files were left out
+    header.entry_count = stats->entries;
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(SnapshotHeader), 1, file) != 1 ||
+        fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        return ERR_SNAPSHOT_IO;
+    }
+    return ERR_OK;
+}
+
+int SaveCacheSnapshot(CacheManager *manager, const char *path, bool bodies, CacheSnapshotStats *stats) {
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    memset(stats, 0, sizeof(CacheSnapshotStats));
+
+    size_t used_memory, entry_count;
+    GetCacheUsage(manager, &used_memory, &entry_count);
+    // Buffers added meanwhile are left out
+    ReadBuffer **buffers = malloc((entry_count + 1) * sizeof(ReadBuffer *));
+    char *temp = malloc(strlen(path) + sizeof(".tmp"));
+    if (buffers == NULL || temp == NULL) {
+        free(buffers);
+        free(temp);
+        return ERR_MEMORY;
+    }
+    sprintf(temp, "%s.tmp", path);
+    size_t count = CollectBuffers(manager, buffers, entry_count + 1);
+
+    int err = ERR_SNAPSHOT_IO;
+    FILE *file = fopen(temp, "w");
+    if (file != NULL) {
+        err = _WriteSnapshot(file, buffers, count, bodies, stats);
+        if (fclose(file) != 0 && err == ERR_OK) {
+            err = ERR_SNAPSHOT_IO;
+        }
+        // Previous snapshot stays until the new one is complete
+        if (err == ERR_OK && rename(temp, path) != 0) {
+            err = ERR_SNAPSHOT_IO;
+        }
+        if (err != ERR_OK) {
+            unlink(temp);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ReleaseBuffer(buffers[i]);
+    }
+    free(buffers);
+    free(temp);
+
+    if (err != ERR_OK) {
+        LogErrorF("Failed to save cache snapshot %s: %s", path, strerror(errno));
+        return err;
+    }
+    LogInfoF("Saved %zu cached files (%zu bytes of contents) to %s in %.2f s, %zu out of date", stats->entries,
+             stats->bytes, path, _SnapshotElapsed(&started), stats->skipped);
+    return ERR_OK;
+}
+
+// Snapshot entry is of the file as it is now
+bool _IsSnapshotCurrent(const char *key, const SnapshotEntry *entry) {
+    struct stat st;
+    return stat(key, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t) st.st_size == entry->size &&
+           st.st_mtim.tv_sec == entry->mtime_sec && st.st_mtim.tv_nsec == entry->mtime_nsec;
+}
+
+bool _ReadWholeFile(const char *path, char *data, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    return done == size;
+}
+
+// Fills buffer of key from body that follows in snapshot, or from the
+// file itself if there is none. Sets body_read once body was consumed.
+int _RestoreSnapshotBuffer(CacheManager *manager, FILE *file, const char *key, const SnapshotEntry *entry,
+                           bool map_files, bool *restored, bool *body_read) {
+    ReadBuffer *buffer;
+    if (map_files) {
+        int err = GetOrMapBuffer(manager, key, &buffer);
+        // Files that can't be mapped, like empty ones, are copied
+        if (err != ERR_FILE_MAP) {
+            if (err == ERR_OK) {
+                ReleaseBuffer(buffer);
+                *restored = true;
+            }
+            return ERR_OK;
+        }
+    }
+
+    WriteBuffer *loader;
+    if (GetOrCreateBuffer(manager, key, entry->size, &buffer, &loader) != ERR_OK) {
+        return ERR_OK;
+    }
+    // Empty buffers are loaded as soon as they are created
+    *restored = loader == NULL && GetBufferUsed(buffer) == *buffer->size;
+    ReleaseBuffer(buffer);
+    if (loader == NULL) {
+        return ERR_OK;
+    }
+
+    struct timespec mtime = {entry->mtime_sec, entry->mtime_nsec};
+    SetBufferMtime(loader, &mtime);
+    bool filled;
+    if (entry->flags & SNAPSHOT_ENTRY_BODY) {
+        *body_read = true;
+        filled = fread(loader->data, 1, entry->size, file) == entry->size;
+    } else {
+        filled = _ReadWholeFile(key, loader->data, entry->size);
+    }
+    if (filled) {
+        PublishBufferLoad(loader, entry->size);
+    }
+    FinishBufferLoad(loader);
+    ReleaseWriteBuffer(loader);
+    if (!filled) {
+        // Left for requests to load otherwise
+        InvalidateBuffer(manager, key);
+        return *body_read ? ERR_SNAPSHOT_FORMAT : ERR_OK;
+    }
+    *restored = true;
+    return ERR_OK;
+}
+
+int _ReadSnapshot(CacheManager *manager, FILE *file, bool map_files, CacheSnapshotStats *stats) {
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        return ERR_SNAPSHOT_IO;
+    }
+    SnapshotHeader header;
+    if (fread(&header, sizeof(SnapshotHeader), 1, file) != 1 ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION) {
+        return ERR_SNAPSHOT_FORMAT;
+    }
+
+    char *key = NULL;
+    size_t key_capacity = 0;
+    int err = ERR_OK;
+    for (uint64_t i = 0; i < header.entry_count && err == ERR_OK; i++) {
+        SnapshotEntry entry;
+        if (fread(&entry, sizeof(SnapshotEntry), 1, file) != 1) {
+            err = ERR_SNAPSHOT_FORMAT;
+            break;
+        }
+        // Lengths of damaged entry must not be allocated or read
+        uint64_t left = st.st_size - ftello(file);
+        if (entry.key_length > PATH_MAX || entry.key_length > left ||
+            ((entry.flags & SNAPSHOT_ENTRY_BODY) && entry.size > left - entry.key_length)) {
+            err = ERR_SNAPSHOT_FORMAT;
+            break;
+        }
+        if (entry.key_length + 1 > key_capacity) {
+            char *bigger = realloc(key, entry.key_length + 1);
+            if (bigger == NULL) {
+                err = ERR_MEMORY;
+                break;
+            }
+            key = bigger;
+            key_capacity = entry.key_length + 1;
+        }
+        if (fread(key, 1, entry.key_length, file) != entry.key_length) {
+            err = ERR_SNAPSHOT_FORMAT;
+            break;
+        }
+        key[entry.key_length] = '\0';
+
+        bool restored = false;
+        bool body_read = false;
+        if (_IsSnapshotCurrent(key, &entry)) {
+            err = _RestoreSnapshotBuffer(manager, file, key, &entry, map_files, &restored, &body_read);
+        }
+        if (err == ERR_OK && (entry.flags & SNAPSHOT_ENTRY_BODY) && !body_read &&
+            fseeko(file, entry.size, SEEK_CUR) != 0) {
+            err = ERR_SNAPSHOT_FORMAT;
+        }
+        if (restored) {
+            stats->entries++;
+            stats->bytes += entry.size;
+        } else {
+            stats->skipped++;
+        }
+    }
+    free(key);
+    return err;
+}
+
+int LoadCacheSnapshot(CacheManager *manager, const char *path, bool map_files, CacheSnapshotStats *stats) {
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    memset(stats, 0, sizeof(CacheSnapshotStats));
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            LogInfoF("No cache snapshot at %s, cache starts empty", path);
+            return ERR_SNAPSHOT_NOT_FOUND;
+        }
+        LogErrorF("Failed to open cache snapshot %s: %s", path, strerror(errno));
+        return ERR_SNAPSHOT_IO;
+    }
+    int err = _ReadSnapshot(manager, file, map_files, stats);
+    fclose(file);
+
+    if (err != ERR_OK) {
+        LogWarnF("Failed to restore cache snapshot %s, %zu files were restored before", path, stats->entries);
+        return err;
+    }
+    LogInfoF("Restored %zu cached files (%zu bytes) from %s in %.2f s, %zu out of date or not fitting",
+             stats->entries, stats->bytes, path, _SnapshotElapsed(&started), stats->skipped);
+    return ERR_OK;
+}
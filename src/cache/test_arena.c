@@ -0,0 +1,111 @@
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache/arena.h"
+
+START_TEST(test_arena_rounds_to_classes)
+{
+    CacheArena *arena = CreateCacheArena();
+    ck_assert_ptr_nonnull(arena);
+
+    // 16 bytes apart up to 128, then four classes per doubling
+    size_t sizes[] = {1, 17, 129, 300, 5000};
+    size_t classes[] = {16, 32, 160, 320, 5120};
+    void *data[5];
+    size_t allocated = 0, requested = 0;
+    for (int i = 0; i < 5; i++) {
+        data[i] = ArenaAlloc(arena, sizes[i]);
+        ck_assert_ptr_nonnull(data[i]);
+        memset(data[i], 'x', sizes[i]);
+        allocated += classes[i];
+        requested += sizes[i];
+    }
+    CacheArenaStats stats = GetCacheArenaStats(arena);
+    ck_assert_uint_eq(stats.allocated, allocated);
+    ck_assert_uint_eq(stats.requested, requested);
+    // Each class has its own slab
+    ck_assert_uint_eq(stats.slab_count, 5);
+    ck_assert_uint_ge(stats.reserved, 5 * 2 * 1024 * 1024);
+
+    for (int i = 0; i < 5; i++) {
+        ArenaFree(arena, data[i], sizes[i]);
+    }
+    stats = GetCacheArenaStats(arena);
+    ck_assert_uint_eq(stats.reserved, 0);
+    ck_assert_uint_eq(stats.allocated, 0);
+    ck_assert_uint_eq(stats.requested, 0);
+    ck_assert_uint_eq(stats.slab_count, 0);
+    DestroyCacheArena(arena);
+}
+END_TEST
+
+START_TEST(test_arena_reuses_freed_objects)
+{
+    CacheArena *arena = CreateCacheArena();
+    void *first = ArenaAlloc(arena, 1000);
+    void *second = ArenaAlloc(arena, 1000);
+    ck_assert_ptr_ne(first, second);
+
+    // Same class, so same slot
+    ArenaFree(arena, first, 1000);
+    void *third = ArenaAlloc(arena, 900);
+    ck_assert_ptr_eq(third, first);
+
+    // Full slabs make room for new ones, which go away once empty
+    size_t count = 2 * 1024 * 1024 / 1024 + 1;
+    void **objects = malloc(count * sizeof(void *));
+    for (size_t i = 0; i < count; i++) {
+        objects[i] = ArenaAlloc(arena, 1024);
+        ck_assert_ptr_nonnull(objects[i]);
+    }
+    ck_assert_uint_eq(GetCacheArenaStats(arena).slab_count, 2);
+    for (size_t i = 0; i < count; i++) {
+        ArenaFree(arena, objects[i], 1024);
+    }
+    free(objects);
+    ArenaFree(arena, second, 1000);
+    ArenaFree(arena, third, 900);
+    ck_assert_uint_eq(GetCacheArenaStats(arena).slab_count, 0);
+    DestroyCacheArena(arena);
+}
+END_TEST
+
+START_TEST(test_arena_large_objects)
+{
+    CacheArena *arena = CreateCacheArena();
+    size_t size = ARENA_MAX_CLASS + 1;
+    char *data = ArenaAlloc(arena, size);
+    ck_assert_ptr_nonnull(data);
+    data[0] = 'a';
+    data[size - 1] = 'z';
+
+    CacheArenaStats stats = GetCacheArenaStats(arena);
+    ck_assert_uint_eq(stats.large_count, 1);
+    ck_assert_uint_eq(stats.slab_count, 0);
+    ck_assert_uint_eq(stats.requested, size);
+    // Rounded up to pages only
+    ck_assert_uint_gt(stats.allocated, size);
+    ck_assert_uint_lt(stats.allocated, size + 64 * 1024);
+    ck_assert_uint_eq(stats.reserved, stats.allocated);
+
+    ArenaFree(arena, data, size);
+    stats = GetCacheArenaStats(arena);
+    ck_assert_uint_eq(stats.large_count, 0);
+    ck_assert_uint_eq(stats.reserved, 0);
+    DestroyCacheArena(arena);
+}
+END_TEST
+
+Suite *arena_suite(void)
+{
+    Suite *s = suite_create("Arena");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_arena_rounds_to_classes);
+    tcase_add_test(tc_core, test_arena_reuses_freed_objects);
+    tcase_add_test(tc_core, test_arena_large_objects);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -1,13 +1,17 @@
+#define _GNU_SOURCE
 #include <check.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "cache/cache.h"
+#include "test_files.h"
 
 START_TEST(test_create_cache_manager)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     ck_assert_ptr_nonnull(manager);
     DestroyCacheManager(manager);
@@ -17,7 +21,7 @@ END_TEST
 
 START_TEST(test_create_buffer)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     int result = CreateBuffer(manager, "key1", 50);
     ck_assert_int_eq(result, ERR_OK);
@@ -27,7 +31,7 @@ END_TEST
 
 START_TEST(test_create_buffer_size_limit)
 {
-    CacheParams params = {1000, 10, 50};
+    CacheParams params = {1000, 10, 50, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     int result = CreateBuffer(manager, "key1", 100);
     ck_assert_int_eq(result, ERR_BUFFER_SIZE_LIMIT);
@@ -37,7 +41,7 @@ END_TEST
 
 START_TEST(test_create_buffer_memory_limit)
 {
-    CacheParams params = {50, 10, 100};
+    CacheParams params = {50, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     int result = CreateBuffer(manager, "key1", 40);
     ck_assert_int_eq(result, ERR_OK);
@@ -49,7 +53,7 @@ END_TEST
 
 START_TEST(test_get_buffer)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb = GetBuffer(manager, "key1");
@@ -61,7 +65,7 @@ END_TEST
 
 START_TEST(test_get_buffer_not_found)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     ReadBuffer *rb = GetBuffer(manager, "nonexistent");
     ck_assert_ptr_null(rb);
@@ -71,7 +75,7 @@ END_TEST
 
 START_TEST(test_get_write_buffer)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     WriteBuffer *wb = GetWriteBuffer(manager, "key1");
@@ -83,7 +87,7 @@ END_TEST
 
 START_TEST(test_buffer_operations)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb = GetBuffer(manager, "key1");
@@ -99,7 +103,7 @@ END_TEST
 
 START_TEST(test_lru_memory_eviction_with_used_buffers)
 {
-    CacheParams params = {100, 10, 100};
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb = GetBuffer(manager, "key1"); // ref=1, can't evict
@@ -113,7 +117,7 @@ END_TEST
 
 START_TEST(test_lru_count_eviction_with_used_buffers)
 {
-    CacheParams params = {1000, 2, 100};
+    CacheParams params = {1000, 2, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     CreateBuffer(manager, "key2", 50);
@@ -131,7 +135,7 @@ END_TEST
 
 START_TEST(test_lru_count_popped)
 {
-    CacheParams params = {1000, 2, 100};
+    CacheParams params = {1000, 2, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     CreateBuffer(manager, "key2", 50);
@@ -155,7 +159,7 @@ END_TEST
 START_TEST(test_all_unused_not_enough_memory)
 {
     int result;
-    CacheParams params = {100, 10, 100};
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     result = CreateBuffer(manager, "key1", 50);
     ck_assert_int_eq(result, ERR_OK);
@@ -183,7 +187,7 @@ START_TEST(test_all_unused_not_enough_memory)
 
 START_TEST(test_create_buffer_duplicate_key)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     int result = CreateBuffer(manager, "key1", 50);
     ck_assert_int_eq(result, ERR_OK);
@@ -198,7 +202,7 @@ START_TEST(test_create_buffer_duplicate_key)
 
 START_TEST(test_write_and_read_buffer)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     WriteBuffer *wb = GetWriteBuffer(manager, "key1");
@@ -217,7 +221,7 @@ START_TEST(test_write_and_read_buffer)
 
 START_TEST(test_multiple_references)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb1 = GetBuffer(manager, "key1");
@@ -233,7 +237,7 @@ START_TEST(test_multiple_references)
 
 START_TEST(test_lru_eviction_after_release)
 {
-    CacheParams params = {100, 10, 100};
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     CreateBuffer(manager, "key2", 50);
@@ -248,7 +252,7 @@ START_TEST(test_lru_eviction_after_release)
 
 START_TEST(test_buffer_locks)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb = GetBuffer(manager, "key1");
@@ -267,7 +271,7 @@ START_TEST(test_buffer_locks)
 
 START_TEST(test_destroy_with_active_references)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     CreateBuffer(manager, "key1", 50);
     ReadBuffer *rb = GetBuffer(manager, "key1");
@@ -279,7 +283,7 @@ START_TEST(test_destroy_with_active_references)
 
 START_TEST(test_create_buffer_zero_size)
 {
-    CacheParams params = {1000, 10, 100};
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
     CacheManager *manager = CreateCacheManager(&params);
     int result = CreateBuffer(manager, "key1", 0);
     ck_assert_int_eq(result, ERR_OK); // assuming allowed
@@ -292,6 +296,750 @@ START_TEST(test_create_buffer_zero_size)
 
 // Add more tests as needed
 
+START_TEST(test_buffer_load_claim)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "key1", 50);
+    WriteBuffer *first = GetWriteBuffer(manager, "key1");
+    WriteBuffer *second = GetWriteBuffer(manager, "key1");
+
+    ck_assert_int_eq(StartBufferLoad(first), ERR_OK);
+    ck_assert_int_eq(StartBufferLoad(second), ERR_BUFFER_LOADING);
+
+    FinishBufferLoad(first);
+    ck_assert_int_eq(StartBufferLoad(second), ERR_OK);
+    FinishBufferLoad(second);
+
+    ReleaseWriteBuffer(first);
+    ReleaseWriteBuffer(second);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_lru_evicts_least_recently_referenced)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "key1", 50);
+    CreateBuffer(manager, "key2", 50);
+
+    // key1 is created first but referenced last
+    ReadBuffer *rb = GetBuffer(manager, "key1");
+    ck_assert_ptr_nonnull(rb);
+    ReleaseBuffer(rb);
+
+    int result = CreateBuffer(manager, "key3", 50);
+    ck_assert_int_eq(result, ERR_OK);
+    rb = GetBuffer(manager, "key2");
+    ck_assert_ptr_null(rb);
+    rb = GetBuffer(manager, "key1");
+    ck_assert_ptr_nonnull(rb);
+    ReleaseBuffer(rb);
+
+    // Count limit evicts in the same order
+    CacheParams count_params = {1000, 2, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *count_manager = CreateCacheManager(&count_params);
+    CreateBuffer(count_manager, "key1", 10);
+    CreateBuffer(count_manager, "key2", 10);
+    rb = GetBuffer(count_manager, "key1");
+    ReleaseBuffer(rb);
+    result = CreateBuffer(count_manager, "key3", 10);
+    ck_assert_int_eq(result, ERR_OK);
+    ck_assert_ptr_null(GetBuffer(count_manager, "key2"));
+
+    DestroyCacheManager(count_manager);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+// Waiter notifications recorded by test_waiter_callback
+static int waiter_progress = 0;
+static int waiter_done = 0;
+static int waiter_failed = 0;
+
+void test_waiter_callback(BufferLoadEvent event, void *userData __attribute__((unused))) {
+    if (event == BUFFER_LOAD_PROGRESS) waiter_progress++;
+    if (event == BUFFER_LOAD_DONE) waiter_done++;
+    if (event == BUFFER_LOAD_FAILED) waiter_failed++;
+}
+
+START_TEST(test_get_or_create_single_flight)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    waiter_progress = waiter_done = waiter_failed = 0;
+
+    ReadBuffer *first;
+    WriteBuffer *loader;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 10, &first, &loader), ERR_OK);
+    ck_assert_ptr_nonnull(first);
+    ck_assert_ptr_nonnull(loader);
+
+    // Concurrent miss shares the entry and does not load it again
+    ReadBuffer *second;
+    WriteBuffer *second_loader;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 10, &second, &second_loader), ERR_OK);
+    ck_assert_ptr_eq(second->data, first->data);
+    ck_assert_ptr_null(second_loader);
+
+    BufferWaiter waiter = {.callback = test_waiter_callback, .userData = NULL};
+    ck_assert_int_eq(AddBufferWaiter(second, &waiter), ERR_OK);
+
+    memcpy(loader->data, "hello", 5);
+    PublishBufferLoad(loader, 5);
+    ck_assert_int_eq(waiter_progress, 1);
+    ck_assert_int_eq(*second->used, 5);
+
+    memcpy(loader->data + 5, "world", 5);
+    PublishBufferLoad(loader, 10);
+    FinishBufferLoad(loader);
+    ReleaseWriteBuffer(loader);
+    ck_assert_int_eq(waiter_progress, 2);
+    ck_assert_int_eq(waiter_done, 1);
+    ck_assert_int_eq(waiter_failed, 0);
+
+    // Nothing to wait for once loaded, and loaded buffer is not claimed
+    ck_assert_int_eq(AddBufferWaiter(second, &waiter), ERR_BUFFER_NOT_LOADING);
+    ReadBuffer *third;
+    WriteBuffer *third_loader;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 10, &third, &third_loader), ERR_OK);
+    ck_assert_ptr_null(third_loader);
+    ck_assert_int_eq(*third->used, 10);
+
+    ReleaseBuffer(first);
+    ReleaseBuffer(second);
+    ReleaseBuffer(third);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_get_or_create_failed_load)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    waiter_progress = waiter_done = waiter_failed = 0;
+
+    ReadBuffer *first;
+    WriteBuffer *loader;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 10, &first, &loader), ERR_OK);
+    ck_assert_ptr_nonnull(loader);
+
+    BufferWaiter waiter = {.callback = test_waiter_callback, .userData = NULL};
+    ck_assert_int_eq(AddBufferWaiter(first, &waiter), ERR_OK);
+
+    PublishBufferLoad(loader, 4);
+    FinishBufferLoad(loader);
+    ReleaseWriteBuffer(loader);
+    ck_assert_int_eq(waiter_failed, 1);
+    ck_assert_int_eq(waiter_done, 0);
+
+    // Next miss loads it again
+    ReadBuffer *second;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 10, &second, &loader), ERR_OK);
+    ck_assert_ptr_nonnull(loader);
+    FinishBufferLoad(loader);
+    ReleaseWriteBuffer(loader);
+
+    ReleaseBuffer(first);
+    ReleaseBuffer(second);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_get_or_create_size_limit)
+{
+    CacheParams params = {1000, 10, 50, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ReadBuffer *buffer;
+    WriteBuffer *loader;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "key1", 100, &buffer, &loader), ERR_BUFFER_SIZE_LIMIT);
+    ck_assert_ptr_null(buffer);
+    ck_assert_ptr_null(loader);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+// Count of hot keys that are present, referencing them once more
+int test_touch_hot_keys(CacheManager *manager)
+{
+    char key[32];
+    int present = 0;
+    for (int i = 0; i < 5; i++) {
+        snprintf(key, sizeof(key), "/hot/%d", i);
+        ReadBuffer *rb = GetBuffer(manager, key);
+        if (rb != NULL) {
+            present++;
+            ReleaseBuffer(rb);
+        }
+    }
+    return present;
+}
+
+// Hot keys referenced now and then while one-off keys sweep through the
+// cache. Returns count of hot keys that survived the sweep.
+int test_scan_survivors(EvictionPolicy policy)
+{
+    CacheParams params = {100000, 20, 100, policy, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    char key[32];
+
+    for (int i = 0; i < 5; i++) {
+        snprintf(key, sizeof(key), "/hot/%d", i);
+        ck_assert_int_eq(CreateBuffer(manager, key, 10), ERR_OK);
+    }
+    for (int round = 0; round < 3; round++) {
+        ck_assert_int_eq(test_touch_hot_keys(manager), 5);
+    }
+
+    for (int i = 1; i <= 200; i++) {
+        snprintf(key, sizeof(key), "/scan/%d", i);
+        ck_assert_int_eq(CreateBuffer(manager, key, 10), ERR_OK);
+        // Sweep between references is twice as long as the cache
+        if (i % 40 == 0 && i != 200) {
+            test_touch_hot_keys(manager);
+        }
+    }
+
+    int survivors = test_touch_hot_keys(manager);
+    DestroyCacheManager(manager);
+    return survivors;
+}
+
+START_TEST(test_scan_resistant_policies)
+{
+    // Plain LRU is flushed by the sweep, others keep the hot set
+    ck_assert_int_eq(test_scan_survivors(EVICTION_POLICY_LRU), 0);
+    ck_assert_int_eq(test_scan_survivors(EVICTION_POLICY_S3_FIFO), 5);
+    ck_assert_int_eq(test_scan_survivors(EVICTION_POLICY_W_TINYLFU), 5);
+}
+END_TEST
+
+START_TEST(test_policies_respect_used_buffers)
+{
+    EvictionPolicy policies[] = {EVICTION_POLICY_S3_FIFO, EVICTION_POLICY_W_TINYLFU};
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        CacheParams params = {100, 3, 100, policies[p], 1, CACHE_STORAGE_HEAP};
+        CacheManager *manager = CreateCacheManager(&params);
+        CreateBuffer(manager, "key1", 30);
+        CreateBuffer(manager, "key2", 30);
+        CreateBuffer(manager, "key3", 30);
+        ReadBuffer *rb1 = GetBuffer(manager, "key1");
+        ReadBuffer *rb2 = GetBuffer(manager, "key2");
+        ReadBuffer *rb3 = GetBuffer(manager, "key3");
+
+        // Everything is used, nothing can make room
+        ck_assert_int_eq(CreateBuffer(manager, "key4", 30), ERR_MEMORY_LIMIT_EXCEEDED);
+        ReleaseBuffer(rb2);
+
+        ck_assert_int_eq(CreateBuffer(manager, "key4", 30), ERR_OK);
+        ck_assert_ptr_null(GetBuffer(manager, "key2"));
+        ReleaseBuffer(rb1);
+        ReleaseBuffer(rb3);
+
+        // Large buffer takes several victims at once
+        ck_assert_int_eq(CreateBuffer(manager, "key5", 90), ERR_OK);
+        ReadBuffer *rb5 = GetBuffer(manager, "key5");
+        ck_assert_ptr_nonnull(rb5);
+        ReleaseBuffer(rb5);
+        DestroyCacheManager(manager);
+    }
+}
+END_TEST
+
+START_TEST(test_sharded_totals_hold)
+{
+    CacheParams params = {1000, 8, 100, EVICTION_POLICY_LRU, 4, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    char key[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        ck_assert_int_eq(CreateBuffer(manager, key, 10), ERR_OK);
+    }
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_le(entries, 8);
+    ck_assert_uint_eq(memory, entries * 10);
+
+    size_t present = 0;
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        ReadBuffer *rb = GetBuffer(manager, key);
+        if (rb != NULL) {
+            present++;
+            ReleaseBuffer(rb);
+        }
+    }
+    ck_assert_uint_eq(present, entries);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_shard_borrows_and_gives_back)
+{
+    // Share of each shard is 25 bytes, buffer may still take 60
+    CacheParams params = {100, 100, 60, EVICTION_POLICY_LRU, 4, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ck_assert_int_eq(CreateBuffer(manager, "key1", 60), ERR_OK);
+
+    // Whichever shard key2 lands in, key1 gives its room back
+    ck_assert_int_eq(CreateBuffer(manager, "key2", 60), ERR_OK);
+    ck_assert_ptr_null(GetBuffer(manager, "key1"));
+    ReadBuffer *rb = GetBuffer(manager, "key2");
+    ck_assert_ptr_nonnull(rb);
+
+    // Referenced one can't
+    ck_assert_int_eq(CreateBuffer(manager, "key3", 60), ERR_MEMORY_LIMIT_EXCEEDED);
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 60);
+    ck_assert_uint_eq(entries, 1);
+
+    ReleaseBuffer(rb);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+// Hits and misses from several threads on a sharded cache
+void *test_sharded_worker(void *data)
+{
+    CacheManager *manager = data;
+    char key[32];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(key, sizeof(key), "key%d", (i * 7) % 50);
+        ReadBuffer *rb;
+        WriteBuffer *loader;
+        if (GetOrCreateBuffer(manager, key, 10, &rb, &loader) != ERR_OK) {
+            continue;
+        }
+        if (loader != NULL) {
+            PublishBufferLoad(loader, 10);
+            FinishBufferLoad(loader);
+            ReleaseWriteBuffer(loader);
+        }
+        ReleaseBuffer(rb);
+    }
+    return NULL;
+}
+
+START_TEST(test_sharded_concurrent_access)
+{
+    CacheParams params = {200, 16, 100, EVICTION_POLICY_LRU, 4, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, test_sharded_worker, manager);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_le(entries, 16);
+    ck_assert_uint_le(memory, 200);
+    ck_assert_uint_eq(memory, entries * 10);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+void *test_lookup_worker(void *data)
+{
+    CacheManager *manager = data;
+    char key[32];
+    for (int i = 0; i < 20000; i++) {
+        int id = i % 40;
+        snprintf(key, sizeof(key), "key%d", id);
+        ReadBuffer *rb = GetBuffer(manager, key);
+        if (rb == NULL) {
+            continue;
+        }
+        // Buffer can't be dropped or reused while it is referenced
+        for (size_t j = 0; j < GetBufferUsed(rb); j++) {
+            ck_assert_int_eq(rb->data[j], 'a' + id % 26);
+        }
+        ReleaseBuffer(rb);
+    }
+    return NULL;
+}
+
+void *test_churn_worker(void *data)
+{
+    CacheManager *manager = data;
+    char key[32];
+    for (int i = 0; i < 20000; i++) {
+        int id = i % 40;
+        snprintf(key, sizeof(key), "key%d", id);
+        ReadBuffer *rb;
+        WriteBuffer *loader;
+        if (GetOrCreateBuffer(manager, key, 10, &rb, &loader) != ERR_OK) {
+            continue;
+        }
+        if (loader != NULL) {
+            memset(loader->data, 'a' + id % 26, 10);
+            PublishBufferLoad(loader, 10);
+            FinishBufferLoad(loader);
+            ReleaseWriteBuffer(loader);
+        }
+        ReleaseBuffer(rb);
+    }
+    return NULL;
+}
+
+START_TEST(test_lookups_race_evictions)
+{
+    EvictionPolicy policies[] = {EVICTION_POLICY_LRU, EVICTION_POLICY_S3_FIFO, EVICTION_POLICY_W_TINYLFU};
+    for (int p = 0; p < 3; p++) {
+        // Less room than keys, so lookups keep meeting evicted buffers
+        CacheParams params = {100, 10, 100, policies[p], 2, CACHE_STORAGE_HEAP};
+        CacheManager *manager = CreateCacheManager(&params);
+        pthread_t threads[4];
+        pthread_create(&threads[0], NULL, test_churn_worker, manager);
+        pthread_create(&threads[1], NULL, test_churn_worker, manager);
+        pthread_create(&threads[2], NULL, test_lookup_worker, manager);
+        pthread_create(&threads[3], NULL, test_lookup_worker, manager);
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        size_t memory, entries;
+        GetCacheUsage(manager, &memory, &entries);
+        ck_assert_uint_le(entries, 10);
+        ck_assert_uint_eq(memory, entries * 10);
+        DestroyCacheManager(manager);
+    }
+}
+END_TEST
+
+START_TEST(test_references_share_handle)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "key", 10);
+
+    ReadBuffer *first = GetBuffer(manager, "key");
+    ReadBuffer *second = GetBuffer(manager, "key");
+    ck_assert_ptr_eq(first, second);
+    ReleaseBuffer(first);
+
+    // Still referenced by the second one
+    ck_assert_int_eq(CreateBuffer(manager, "other", 95), ERR_MEMORY_LIMIT_EXCEEDED);
+    ReleaseBuffer(second);
+    ck_assert_int_eq(CreateBuffer(manager, "other", 95), ERR_OK);
+    ck_assert_ptr_null(GetBuffer(manager, "key"));
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_table_rehash_keeps_buffers)
+{
+    // Every eviction leaves a tombstone, so table is rehashed many times
+    CacheParams params = {1000000, 64, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    char key[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "/static/file%d.html", i);
+        ck_assert_int_eq(CreateBuffer(manager, key, 1), ERR_OK);
+
+        int first = i >= 63 ? i - 63 : 0;
+        for (int j = first; j <= i; j++) {
+            snprintf(key, sizeof(key), "/static/file%d.html", j);
+            ReadBuffer *rb = GetBuffer(manager, key);
+            ck_assert_ptr_nonnull(rb);
+            ReleaseBuffer(rb);
+        }
+    }
+    snprintf(key, sizeof(key), "/static/file%d.html", 5000 - 65);
+    ck_assert_ptr_null(GetBuffer(manager, key));
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_invalidate_keeps_held_references)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ck_assert_int_eq(InvalidateBuffer(manager, "/styles.css"), ERR_KEY_NOT_FOUND);
+
+    CreateBuffer(manager, "/styles.css", 10);
+    WriteBuffer *wb = GetWriteBuffer(manager, "/styles.css");
+    memcpy(wb->data, "old", 3);
+
+    ck_assert_int_eq(InvalidateBuffer(manager, "/styles.css"), ERR_OK);
+    ck_assert_ptr_null(GetBuffer(manager, "/styles.css"));
+
+    // New contents are cached next to the held one
+    ck_assert_int_eq(CreateBuffer(manager, "/styles.css", 20), ERR_OK);
+    ReadBuffer *rb = GetBuffer(manager, "/styles.css");
+    ck_assert_uint_eq(*rb->size, 20);
+    ck_assert_int_eq(memcmp(wb->data, "old", 3), 0);
+    ReleaseBuffer(rb);
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 30);
+    ReleaseWriteBuffer(wb);
+    ck_assert_int_eq(CreateBuffer(manager, "/app.js", 5), ERR_OK);
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 25);
+    ck_assert_uint_eq(entries, 2);
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_invalidate_with_prefix)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 4, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "/www/assets/a.js", 1);
+    CreateBuffer(manager, "/www/assets/b.js", 1);
+    CreateBuffer(manager, "/www/assets.js", 1);
+    CreateBuffer(manager, "/www/index.html", 1);
+
+    ck_assert_uint_eq(InvalidateBuffersWithPrefix(manager, "/www/assets/"), 2);
+    ck_assert_ptr_null(GetBuffer(manager, "/www/assets/a.js"));
+    ck_assert_ptr_null(GetBuffer(manager, "/www/assets/b.js"));
+    ReadBuffer *rb = GetBuffer(manager, "/www/assets.js");
+    ck_assert_ptr_nonnull(rb);
+    ReleaseBuffer(rb);
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(entries, 2);
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_refresh_swaps_loaded_shadow)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_S3_FIFO, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    WriteBuffer *shadow;
+    ck_assert_int_eq(StartBufferRefresh(manager, "/index.html", 4, &shadow), ERR_KEY_NOT_FOUND);
+    ck_assert_ptr_null(shadow);
+
+    CreateBuffer(manager, "/index.html", 3);
+    WriteBuffer *wb = GetWriteBuffer(manager, "/index.html");
+    memcpy(wb->data, "old", 3);
+    PublishBufferLoad(wb, 3);
+    ReleaseWriteBuffer(wb);
+    ReadBuffer *held = GetBuffer(manager, "/index.html");
+
+    ck_assert_int_eq(StartBufferRefresh(manager, "/index.html", 101, &shadow), ERR_BUFFER_SIZE_LIMIT);
+    ck_assert_int_eq(StartBufferRefresh(manager, "/index.html", 4, &shadow), ERR_OK);
+    memcpy(shadow->data, "new!", 4);
+    PublishBufferLoad(shadow, 4);
+    // Lookups get current version until shadow is committed
+    ReadBuffer *rb = GetBuffer(manager, "/index.html");
+    ck_assert_ptr_eq(rb, held);
+    ReleaseBuffer(rb);
+    ck_assert_int_eq(CommitBufferRefresh(manager, shadow), ERR_OK);
+
+    rb = GetBuffer(manager, "/index.html");
+    ck_assert_ptr_ne(rb, held);
+    ck_assert_int_eq(memcmp(rb->data, "new!", 4), 0);
+    ReleaseBuffer(rb);
+    ck_assert_int_eq(memcmp(held->data, "old", 3), 0);
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 7);
+    ReleaseBuffer(held);
+    ck_assert_int_eq(CreateBuffer(manager, "/app.js", 5), ERR_OK);
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 9);
+    ck_assert_uint_eq(entries, 2);
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_refresh_not_filled_drops_key)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "/index.html", 3);
+
+    WriteBuffer *shadow;
+    ck_assert_int_eq(StartBufferRefresh(manager, "/index.html", 4, &shadow), ERR_OK);
+    PublishBufferLoad(shadow, 2);
+    ck_assert_int_eq(CommitBufferRefresh(manager, shadow), ERR_BUFFER_INCOMPLETE);
+    ck_assert_ptr_null(GetBuffer(manager, "/index.html"));
+
+    // Key dropped while shadow was filled is not brought back
+    CreateBuffer(manager, "/index.html", 3);
+    ck_assert_int_eq(StartBufferRefresh(manager, "/index.html", 4, &shadow), ERR_OK);
+    PublishBufferLoad(shadow, 4);
+    ck_assert_int_eq(InvalidateBuffer(manager, "/index.html"), ERR_OK);
+    ck_assert_int_eq(CommitBufferRefresh(manager, shadow), ERR_KEY_NOT_FOUND);
+    ck_assert_ptr_null(GetBuffer(manager, "/index.html"));
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 0);
+    ck_assert_uint_eq(entries, 0);
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_memfd_storage)
+{
+    CacheParams params = {100, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_MEMFD};
+    CacheManager *manager = CreateCacheManager(&params);
+    ReadBuffer *rb;
+    WriteBuffer *wb;
+    ck_assert_int_eq(GetOrCreateBuffer(manager, "/index.html", 5, &rb, &wb), ERR_OK);
+    ck_assert_ptr_nonnull(wb);
+    memcpy(wb->data, "hello", 5);
+    PublishBufferLoad(wb, 5);
+    FinishBufferLoad(wb);
+    ReleaseWriteBuffer(wb);
+
+    // Descriptor reads what was written to data
+    ck_assert_int_ne(rb->fd, -1);
+    char read_back[5];
+    ck_assert_int_eq(pread(rb->fd, read_back, 5, 0), 5);
+    ck_assert_int_eq(memcmp(read_back, "hello", 5), 0);
+    ReleaseBuffer(rb);
+
+    // Nothing to map for empty buffer
+    ck_assert_int_eq(CreateBuffer(manager, "/empty.html", 0), ERR_OK);
+    rb = GetBuffer(manager, "/empty.html");
+    ck_assert_int_eq(rb->fd, -1);
+    ReleaseBuffer(rb);
+
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 5);
+    ck_assert_uint_eq(entries, 2);
+    DestroyCacheManager(manager);
+
+    params.storage = CACHE_STORAGE_HEAP;
+    manager = CreateCacheManager(&params);
+    CreateBuffer(manager, "/index.html", 5);
+    rb = GetBuffer(manager, "/index.html");
+    ck_assert_int_eq(rb->fd, -1);
+    ReleaseBuffer(rb);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_arena_storage)
+{
+    CacheParams params = {1000, 10, 500, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_ARENA};
+    CacheManager *manager = CreateCacheManager(&params);
+    ck_assert_ptr_nonnull(manager);
+    ck_assert_int_eq(CreateBuffer(manager, "/index.html", 300), ERR_OK);
+    ck_assert_int_eq(CreateBuffer(manager, "/app.js", 500), ERR_OK);
+    ReadBuffer *rb = GetBuffer(manager, "/index.html");
+    ck_assert_ptr_nonnull(rb);
+    ck_assert_uint_eq(*rb->size, 300);
+    ReleaseBuffer(rb);
+
+    // Data and buffer blocks both come from arena
+    CacheArenaStats stats;
+    ck_assert(GetCacheArenaUsage(manager, &stats));
+    ck_assert_uint_gt(stats.requested, 800);
+    ck_assert_uint_ge(stats.allocated, stats.requested);
+    ck_assert_uint_ge(stats.reserved, stats.allocated);
+
+    // Evicted buffer is given back
+    ck_assert_int_eq(CreateBuffer(manager, "/big.css", 500), ERR_OK);
+    ck_assert_ptr_null(GetBuffer(manager, "/app.js"));
+    CacheArenaStats after;
+    GetCacheArenaUsage(manager, &after);
+    ck_assert_uint_eq(after.requested, stats.requested + strlen("/big.css") - strlen("/app.js"));
+    DestroyCacheManager(manager);
+
+    params.storage = CACHE_STORAGE_HEAP;
+    manager = CreateCacheManager(&params);
+    ck_assert(!GetCacheArenaUsage(manager, &stats));
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+START_TEST(test_map_file_buffer)
+{
+    CacheParams params = {1000, 10, 8, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_write_file("/tmp/test_cache_map.css", "body{}");
+    test_write_file("/tmp/test_cache_map_empty.css", "");
+    test_write_file("/tmp/test_cache_map_big.css", "body{color:red}");
+
+    ReadBuffer *rb;
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_map.css", &rb), ERR_OK);
+    ck_assert_uint_eq(*rb->size, 6);
+    ck_assert_uint_eq(GetBufferUsed(rb), 6);
+    ck_assert_int_eq(memcmp(rb->data, "body{}", 6), 0);
+    // Mtime of the mapped file comes with it
+    struct stat st;
+    struct timespec mtime;
+    ck_assert_int_eq(stat("/tmp/test_cache_map.css", &st), 0);
+    ck_assert(GetBufferMtime(rb, &mtime));
+    ck_assert(mtime.tv_sec == st.st_mtim.tv_sec && mtime.tv_nsec == st.st_mtim.tv_nsec);
+
+    ReadBuffer *again;
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_map.css", &again), ERR_OK);
+    ck_assert_ptr_eq(again, rb);
+    ck_assert_ptr_eq(GetBuffer(manager, "/tmp/test_cache_map.css"), rb);
+    ReleaseBuffer(again);
+    ReleaseBuffer(rb);
+    ReleaseBuffer(rb);
+
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_map_missing.css", &rb), ERR_FILE_MAP);
+    ck_assert_ptr_null(rb);
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_map_empty.css", &rb), ERR_FILE_MAP);
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_map_big.css", &rb), ERR_BUFFER_SIZE_LIMIT);
+
+    // Mapped bytes are accounted like copies
+    size_t memory, entries;
+    GetCacheUsage(manager, &memory, &entries);
+    ck_assert_uint_eq(memory, 6);
+    ck_assert_uint_eq(entries, 1);
+
+    DestroyCacheManager(manager);
+    remove("/tmp/test_cache_map.css");
+    remove("/tmp/test_cache_map_empty.css");
+    remove("/tmp/test_cache_map_big.css");
+}
+END_TEST
+
+START_TEST(test_remap_keeps_held_mapping)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_write_file("/tmp/test_cache_remap.js", "old");
+    ck_assert_int_eq(RemapBuffer(manager, "/tmp/test_cache_remap.js"), ERR_KEY_NOT_FOUND);
+
+    ReadBuffer *held;
+    ck_assert_int_eq(GetOrMapBuffer(manager, "/tmp/test_cache_remap.js", &held), ERR_OK);
+    // Replaced, old mapping keeps the old file
+    test_write_file("/tmp/test_cache_remap.js.new", "new!");
+    ck_assert_int_eq(rename("/tmp/test_cache_remap.js.new", "/tmp/test_cache_remap.js"), 0);
+    ck_assert_int_eq(RemapBuffer(manager, "/tmp/test_cache_remap.js"), ERR_OK);
+
+    ReadBuffer *rb = GetBuffer(manager, "/tmp/test_cache_remap.js");
+    ck_assert_ptr_ne(rb, held);
+    ck_assert_uint_eq(*rb->size, 4);
+    ck_assert_int_eq(memcmp(rb->data, "new!", 4), 0);
+    ck_assert_int_eq(memcmp(held->data, "old", 3), 0);
+    ReleaseBuffer(rb);
+    ReleaseBuffer(held);
+
+    remove("/tmp/test_cache_remap.js");
+    ck_assert_int_eq(RemapBuffer(manager, "/tmp/test_cache_remap.js"), ERR_FILE_MAP);
+    ck_assert_ptr_null(GetBuffer(manager, "/tmp/test_cache_remap.js"));
+
+    DestroyCacheManager(manager);
+}
+END_TEST
+
 Suite *cache_suite(void)
 {
     Suite *s = suite_create("Cache");
@@ -316,6 +1064,27 @@ Suite *cache_suite(void)
     tcase_add_test(tc_core, test_buffer_locks);
     tcase_add_test(tc_core, test_destroy_with_active_references);
     tcase_add_test(tc_core, test_create_buffer_zero_size);
+    tcase_add_test(tc_core, test_buffer_load_claim);
+    tcase_add_test(tc_core, test_lru_evicts_least_recently_referenced);
+    tcase_add_test(tc_core, test_get_or_create_single_flight);
+    tcase_add_test(tc_core, test_get_or_create_failed_load);
+    tcase_add_test(tc_core, test_get_or_create_size_limit);
+    tcase_add_test(tc_core, test_scan_resistant_policies);
+    tcase_add_test(tc_core, test_policies_respect_used_buffers);
+    tcase_add_test(tc_core, test_sharded_totals_hold);
+    tcase_add_test(tc_core, test_shard_borrows_and_gives_back);
+    tcase_add_test(tc_core, test_sharded_concurrent_access);
+    tcase_add_test(tc_core, test_lookups_race_evictions);
+    tcase_add_test(tc_core, test_references_share_handle);
+    tcase_add_test(tc_core, test_table_rehash_keeps_buffers);
+    tcase_add_test(tc_core, test_invalidate_keeps_held_references);
+    tcase_add_test(tc_core, test_invalidate_with_prefix);
+    tcase_add_test(tc_core, test_refresh_swaps_loaded_shadow);
+    tcase_add_test(tc_core, test_refresh_not_filled_drops_key);
+    tcase_add_test(tc_core, test_map_file_buffer);
+    tcase_add_test(tc_core, test_remap_keeps_held_mapping);
+    tcase_add_test(tc_core, test_memfd_storage);
+    tcase_add_test(tc_core, test_arena_storage);
 
     suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,34 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ftw.h>
+#include "test_files.h"
+
+void test_create_tree(char *root, size_t size, const char *name)
+{
+    ck_assert_int_lt(snprintf(root, size, "/tmp/test_%s_XXXXXX", name), (int) size);
+    ck_assert_ptr_nonnull(mkdtemp(root));
+}
+
+int _RemoveTreeEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void) st;
+    (void) type;
+    (void) ftw;
+    return remove(path);
+}
+
+void test_remove_tree(const char *root)
+{
+    // Children are visited before their directory
+    ck_assert_int_eq(nftw(root, _RemoveTreeEntry, 16, FTW_DEPTH | FTW_PHYS), 0);
+}
+
+void test_write_file(const char *path, const char *content)
+{
+    FILE *file = fopen(path, "w");
+    ck_assert_ptr_nonnull(file);
+    fputs(content, file);
+    fclose(file);
+}
@@ -0,0 +1,16 @@
+#ifndef TEST_FILES_H__
+#define TEST_FILES_H__
+
+#include <stddef.h>
+
+// Files on disk for tests of cache modules that work with them. Trees are
+// fresh directories under /tmp, removed with everything in them.
+
+// Creates /tmp/test_<name>_XXXXXX and writes its path to root
+void test_create_tree(char *root, size_t size, const char *name);
+// Symlinks in tree are removed, not followed
+void test_remove_tree(const char *root);
+// Creates or truncates file at path
+void test_write_file(const char *path, const char *content);
+
+#endif // TEST_FILES_H__
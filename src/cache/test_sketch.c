@@ -0,0 +1,70 @@
+#include <check.h>
+#include <stdlib.h>
+#include "cache/sketch.h"
+#include "utils/hash.h"
+
+#include <limits.h>
+
+START_TEST(test_sketch_counts_increments)
+{
+    FrequencySketch *sketch = CreateFrequencySketch(64);
+    ck_assert_ptr_nonnull(sketch);
+    unsigned long key = hash("/index.html", ULONG_MAX);
+
+    ck_assert_uint_eq(EstimateFrequency(sketch, key), 0);
+    for (int i = 0; i < 5; i++) {
+        IncrementFrequency(sketch, key);
+    }
+    ck_assert_uint_eq(EstimateFrequency(sketch, key), 5);
+    ck_assert_uint_eq(EstimateFrequency(sketch, hash("/other.html", ULONG_MAX)), 0);
+
+    DestroyFrequencySketch(sketch);
+}
+END_TEST
+
+START_TEST(test_sketch_saturates)
+{
+    FrequencySketch *sketch = CreateFrequencySketch(64);
+    unsigned long key = hash("/style.css", ULONG_MAX);
+    for (int i = 0; i < 2 * SKETCH_MAX_FREQUENCY; i++) {
+        IncrementFrequency(sketch, key);
+    }
+    ck_assert_uint_eq(EstimateFrequency(sketch, key), SKETCH_MAX_FREQUENCY);
+    DestroyFrequencySketch(sketch);
+}
+END_TEST
+
+START_TEST(test_sketch_ages)
+{
+    // 10 increments per expected entry trigger halving
+    FrequencySketch *sketch = CreateFrequencySketch(2);
+    unsigned long hot = hash("/hot", ULONG_MAX);
+    for (int i = 0; i < 8; i++) {
+        IncrementFrequency(sketch, hot);
+    }
+    ck_assert_uint_eq(EstimateFrequency(sketch, hot), 8);
+
+    char key[32];
+    for (int i = 0; i < 12; i++) {
+        snprintf(key, sizeof(key), "/scan/%d", i);
+        IncrementFrequency(sketch, hash(key, ULONG_MAX));
+    }
+    ck_assert_uint_lt(EstimateFrequency(sketch, hot), 8);
+    ck_assert_uint_ge(EstimateFrequency(sketch, hot), 4);
+    DestroyFrequencySketch(sketch);
+}
+END_TEST
+
+Suite *sketch_suite(void)
+{
+    Suite *s = suite_create("Sketch");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_sketch_counts_increments);
+    tcase_add_test(tc_core, test_sketch_saturates);
+    tcase_add_test(tc_core, test_sketch_ages);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
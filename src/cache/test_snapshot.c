@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "cache/cache.h"
+#include "cache/snapshot.h"
+#include "test_files.h"
+
+static char snapshot_root[64];
+
+void test_snapshot_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", snapshot_root, name);
+}
+
+// File written under root and cached with the same contents
+void test_cache_file(CacheManager *manager, const char *name, const char *content)
+{
+    char path[96];
+    test_snapshot_path(path, sizeof(path), name);
+    test_write_file(path, content);
+
+    struct stat st;
+    ck_assert_int_eq(stat(path, &st), 0);
+    ReadBuffer *rb;
+    WriteBuffer *wb;
+    size_t size = strlen(content);
+    ck_assert_int_eq(GetOrCreateBuffer(manager, path, size, &rb, &wb), ERR_OK);
+    // Empty buffer is loaded already
+    if (wb != NULL) {
+        SetBufferMtime(wb, &st.st_mtim);
+        memcpy(wb->data, content, size);
+        PublishBufferLoad(wb, size);
+        FinishBufferLoad(wb);
+        ReleaseWriteBuffer(wb);
+    }
+    ReleaseBuffer(rb);
+}
+
+bool test_snapshot_cached(CacheManager *manager, const char *name, const char *content)
+{
+    char path[96];
+    test_snapshot_path(path, sizeof(path), name);
+    ReadBuffer *rb = GetBuffer(manager, path);
+    if (rb == NULL) {
+        return false;
+    }
+    bool same = GetBufferUsed(rb) == strlen(content) && *rb->size == strlen(content) &&
+                memcmp(rb->data, content, strlen(content)) == 0;
+    ReleaseBuffer(rb);
+    return same;
+}
+
+START_TEST(test_snapshot_restores_hottest)
+{
+    test_create_tree(snapshot_root, sizeof(snapshot_root), "snapshot");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_cache_file(manager, "a.html", "first");
+    test_cache_file(manager, "b.css", "second");
+    test_cache_file(manager, "c.js", "third");
+    test_cache_file(manager, "d.png", "fourth");
+    char snapshot[96];
+    test_snapshot_path(snapshot, sizeof(snapshot), "cache.snapshot");
+
+    CacheSnapshotStats stats;
+    ck_assert_int_eq(SaveCacheSnapshot(manager, snapshot, true, &stats), ERR_OK);
+    ck_assert_uint_eq(stats.entries, 4);
+    ck_assert_uint_eq(stats.bytes, 22);
+    ck_assert_uint_eq(stats.skipped, 0);
+    DestroyCacheManager(manager);
+
+    // Contents come from snapshot, not from files
+    char path[96];
+    test_snapshot_path(path, sizeof(path), "d.png");
+    FILE *file = fopen(path, "r+");
+    fputs("FOURTH", file);
+    fclose(file);
+    // Same size, different mtime
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+    ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+
+    // Only two fit, the one cached first was the coldest
+    params.max_entries = 2;
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_OK);
+    ck_assert(!test_snapshot_cached(manager, "a.html", "first"));
+    ck_assert(test_snapshot_cached(manager, "b.css", "second"));
+    ck_assert(test_snapshot_cached(manager, "c.js", "third"));
+    // Rewritten file has a new mtime
+    ck_assert(!test_snapshot_cached(manager, "d.png", "fourth"));
+    ck_assert(!test_snapshot_cached(manager, "d.png", "FOURTH"));
+    ck_assert_uint_eq(stats.skipped, 1);
+    DestroyCacheManager(manager);
+    test_remove_tree(snapshot_root);
+}
+END_TEST
+
+START_TEST(test_snapshot_skips_changed_before_save)
+{
+    test_create_tree(snapshot_root, sizeof(snapshot_root), "snapshot");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_cache_file(manager, "index.html", "<html></html>");
+    test_cache_file(manager, "app.js", "run();");
+
+    // Rewritten with the same size while the old version is still cached
+    char path[96];
+    test_snapshot_path(path, sizeof(path), "app.js");
+    FILE *file = fopen(path, "r+");
+    fputs("RUN();", file);
+    fclose(file);
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+    ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+
+    char snapshot[96];
+    test_snapshot_path(snapshot, sizeof(snapshot), "cache.snapshot");
+    CacheSnapshotStats stats;
+    ck_assert_int_eq(SaveCacheSnapshot(manager, snapshot, true, &stats), ERR_OK);
+    ck_assert_uint_eq(stats.entries, 1);
+    ck_assert_uint_eq(stats.skipped, 1);
+    DestroyCacheManager(manager);
+
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_OK);
+    ck_assert(test_snapshot_cached(manager, "index.html", "<html></html>"));
+    ck_assert(!test_snapshot_cached(manager, "app.js", "run();"));
+    ck_assert(!test_snapshot_cached(manager, "app.js", "RUN();"));
+    DestroyCacheManager(manager);
+    test_remove_tree(snapshot_root);
+}
+END_TEST
+
+START_TEST(test_snapshot_without_bodies)
+{
+    test_create_tree(snapshot_root, sizeof(snapshot_root), "snapshot");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_S3_FIFO, 2, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_cache_file(manager, "index.html", "<html></html>");
+    test_cache_file(manager, "empty.txt", "");
+    char snapshot[96];
+    test_snapshot_path(snapshot, sizeof(snapshot), "cache.snapshot");
+
+    CacheSnapshotStats stats;
+    ck_assert_int_eq(SaveCacheSnapshot(manager, snapshot, false, &stats), ERR_OK);
+    ck_assert_uint_eq(stats.entries, 2);
+    ck_assert_uint_eq(stats.bytes, 0);
+    DestroyCacheManager(manager);
+
+    // Files are read again
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_OK);
+    ck_assert_uint_eq(stats.entries, 2);
+    ck_assert(test_snapshot_cached(manager, "index.html", "<html></html>"));
+    ck_assert(test_snapshot_cached(manager, "empty.txt", ""));
+    DestroyCacheManager(manager);
+
+    // Mapped when cache maps files, empty one can't be
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, true, &stats), ERR_OK);
+    ck_assert_uint_eq(stats.entries, 2);
+    ck_assert(test_snapshot_cached(manager, "index.html", "<html></html>"));
+    DestroyCacheManager(manager);
+    test_remove_tree(snapshot_root);
+}
+END_TEST
+
+START_TEST(test_snapshot_missing_or_damaged)
+{
+    test_create_tree(snapshot_root, sizeof(snapshot_root), "snapshot");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    char snapshot[96];
+    test_snapshot_path(snapshot, sizeof(snapshot), "cache.snapshot");
+    CacheSnapshotStats stats;
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_SNAPSHOT_NOT_FOUND);
+
+    test_cache_file(manager, "index.html", "<html></html>");
+    ck_assert_int_eq(SaveCacheSnapshot(manager, snapshot, true, &stats), ERR_OK);
+    // Cut in the middle of the body
+    struct stat st;
+    ck_assert_int_eq(stat(snapshot, &st), 0);
+    ck_assert_int_eq(truncate(snapshot, st.st_size - 5), 0);
+    DestroyCacheManager(manager);
+
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_SNAPSHOT_FORMAT);
+    ck_assert(!test_snapshot_cached(manager, "index.html", "<html></html>"));
+    DestroyCacheManager(manager);
+    test_remove_tree(snapshot_root);
+}
+END_TEST
+
+// Overwrites bytes of snapshot at offset
+void test_damage_snapshot(const char *snapshot, long offset, const void *bytes, size_t size)
+{
+    FILE *file = fopen(snapshot, "r+");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fseek(file, offset, SEEK_SET), 0);
+    ck_assert_uint_eq(fwrite(bytes, 1, size, file), size);
+    fclose(file);
+}
+
+START_TEST(test_snapshot_bad_lengths)
+{
+    test_create_tree(snapshot_root, sizeof(snapshot_root), "snapshot");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    test_cache_file(manager, "index.html", "<html></html>");
+    char snapshot[96];
+    test_snapshot_path(snapshot, sizeof(snapshot), "cache.snapshot");
+    CacheSnapshotStats stats;
+    ck_assert_int_eq(SaveCacheSnapshot(manager, snapshot, true, &stats), ERR_OK);
+    DestroyCacheManager(manager);
+
+    // First entry follows 24 bytes of header: size, mtime, key length
+    uint32_t key_length = UINT32_MAX;
+    test_damage_snapshot(snapshot, 24 + 24, &key_length, sizeof(key_length));
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_SNAPSHOT_FORMAT);
+    DestroyCacheManager(manager);
+
+    // Body larger than what is left of snapshot
+    key_length = strlen(snapshot_root) + strlen("/index.html");
+    test_damage_snapshot(snapshot, 24 + 24, &key_length, sizeof(key_length));
+    uint64_t size = 1ULL << 40;
+    test_damage_snapshot(snapshot, 24, &size, sizeof(size));
+    manager = CreateCacheManager(&params);
+    ck_assert_int_eq(LoadCacheSnapshot(manager, snapshot, false, &stats), ERR_SNAPSHOT_FORMAT);
+    DestroyCacheManager(manager);
+    test_remove_tree(snapshot_root);
+}
+END_TEST
+
+Suite *snapshot_suite(void)
+{
+    Suite *s = suite_create("Snapshot");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_snapshot_restores_hottest);
+    tcase_add_test(tc_core, test_snapshot_skips_changed_before_save);
+    tcase_add_test(tc_core, test_snapshot_without_bodies);
+    tcase_add_test(tc_core, test_snapshot_missing_or_damaged);
+    tcase_add_test(tc_core, test_snapshot_bad_lengths);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache/cache.h"
+#include "cache/warmup.h"
+#include "test_files.h"
+
+static char warmup_root[64];
+
+void test_warmup_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", warmup_root, name);
+}
+
+void test_warmup_file(const char *name, const char *content)
+{
+    char path[96];
+    test_warmup_path(path, sizeof(path), name);
+    test_write_file(path, content);
+}
+
+// Site with a nested directory
+void test_warmup_tree(void)
+{
+    test_create_tree(warmup_root, sizeof(warmup_root), "warmup");
+    char dir[64];
+    test_warmup_path(dir, sizeof(dir), "assets");
+    ck_assert_int_eq(mkdir(dir, 0755), 0);
+    test_warmup_file("index.html", "<html></html>");
+    test_warmup_file("about.html", "<p>about</p>");
+    test_warmup_file("assets/app.js", "run();");
+    test_warmup_file("assets/big.js", "0123456789012345678901234567890123456789");
+    test_warmup_file("assets/style.css", "a{}");
+}
+
+bool test_is_cached(CacheManager *manager, const char *name)
+{
+    char path[96];
+    test_warmup_path(path, sizeof(path), name);
+    ReadBuffer *rb = GetBuffer(manager, path);
+    if (rb == NULL) {
+        return false;
+    }
+    bool loaded = GetBufferUsed(rb) == *rb->size;
+    ReleaseBuffer(rb);
+    return loaded;
+}
+
+START_TEST(test_warmup_loads_manifest_matches)
+{
+    test_warmup_tree();
+    // Kept in the tree, none of its patterns matches it
+    char manifest[96];
+    test_warmup_path(manifest, sizeof(manifest), "warmup.list");
+    test_write_file(manifest, "# hot set\n/index.html\n*.js\n\nmissing.png\n");
+
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ReaderPoolParams pool_params = {16, 2};
+    FileReaderPool *pool = CreateFileReaderPool(&pool_params);
+    CacheWarmupParams warmup_params = {warmup_root, manifest, 0, 1000, 10, pool, 2, false};
+    CacheWarmup *warmup = CreateCacheWarmup(manager, &warmup_params);
+    ck_assert_ptr_nonnull(warmup);
+    WaitCacheWarmup(warmup);
+
+    CacheWarmupProgress progress = GetCacheWarmupProgress(warmup);
+    ck_assert(progress.done);
+    ck_assert_uint_eq(progress.total_files, 3);
+    ck_assert_uint_eq(progress.loaded_files, 3);
+    ck_assert_uint_eq(progress.loaded_bytes, 13 + 6 + 40);
+    ck_assert_uint_eq(progress.skipped_files, 0);
+    ck_assert(test_is_cached(manager, "index.html"));
+    ck_assert(test_is_cached(manager, "assets/app.js"));
+    ck_assert(test_is_cached(manager, "assets/big.js"));
+    ck_assert(!test_is_cached(manager, "about.html"));
+    ck_assert(!test_is_cached(manager, "assets/style.css"));
+
+    DestroyCacheWarmup(warmup);
+    ShutdownFileReaderPool(pool);
+    DestroyFileReaderPool(pool);
+    DestroyCacheManager(manager);
+    test_remove_tree(warmup_root);
+}
+END_TEST
+
+START_TEST(test_warmup_keeps_to_limits)
+{
+    test_warmup_tree();
+    // Everything but big.js fits under file size limit, about.html then
+    // no longer fits into memory next to files loaded before it
+    CacheParams params = {25, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ReaderPoolParams pool_params = {16, 2};
+    FileReaderPool *pool = CreateFileReaderPool(&pool_params);
+    CacheWarmupParams warmup_params = {warmup_root, NULL, 20, 25, 10, pool, 1, false};
+    CacheWarmup *warmup = CreateCacheWarmup(manager, &warmup_params);
+    ck_assert_ptr_nonnull(warmup);
+    WaitCacheWarmup(warmup);
+
+    // Loaded by path: about.html, assets/app.js, assets/style.css, index.html
+    CacheWarmupProgress progress = GetCacheWarmupProgress(warmup);
+    ck_assert_uint_eq(progress.total_files, 4);
+    ck_assert_uint_eq(progress.loaded_files, 3);
+    ck_assert_uint_eq(progress.skipped_files, 1);
+    ck_assert(test_is_cached(manager, "about.html"));
+    ck_assert(test_is_cached(manager, "assets/app.js"));
+    ck_assert(test_is_cached(manager, "assets/style.css"));
+    ck_assert(!test_is_cached(manager, "index.html"));
+    ck_assert(!test_is_cached(manager, "assets/big.js"));
+
+    DestroyCacheWarmup(warmup);
+    ShutdownFileReaderPool(pool);
+    DestroyFileReaderPool(pool);
+    DestroyCacheManager(manager);
+    test_remove_tree(warmup_root);
+}
+END_TEST
+
+START_TEST(test_warmup_symlink_loop)
+{
+    test_warmup_tree();
+    char link[96];
+    test_warmup_path(link, sizeof(link), "assets/up");
+    ck_assert_int_eq(symlink("..", link), 0);
+
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ReaderPoolParams pool_params = {16, 2};
+    FileReaderPool *pool = CreateFileReaderPool(&pool_params);
+    CacheWarmupParams warmup_params = {warmup_root, NULL, 0, 1000, 10, pool, 2, false};
+    CacheWarmup *warmup = CreateCacheWarmup(manager, &warmup_params);
+    ck_assert_ptr_nonnull(warmup);
+    WaitCacheWarmup(warmup);
+
+    // Link leads back to root, its files are only found once
+    CacheWarmupProgress progress = GetCacheWarmupProgress(warmup);
+    ck_assert_uint_eq(progress.total_files, 5);
+    ck_assert_uint_eq(progress.loaded_files, 5);
+
+    DestroyCacheWarmup(warmup);
+    ShutdownFileReaderPool(pool);
+    DestroyFileReaderPool(pool);
+    DestroyCacheManager(manager);
+    test_remove_tree(warmup_root);
+}
+END_TEST
+
+START_TEST(test_warmup_missing_manifest)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CacheWarmupParams warmup_params = {"/tmp", "/tmp/test_warmup_missing.list", 0, 1000, 10, NULL, 1, false};
+    ck_assert_ptr_null(CreateCacheWarmup(manager, &warmup_params));
+    DestroyCacheWarmup(NULL);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+Suite *warmup_suite(void)
+{
+    Suite *s = suite_create("Warmup");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_warmup_loads_manifest_matches);
+    tcase_add_test(tc_core, test_warmup_keeps_to_limits);
+    tcase_add_test(tc_core, test_warmup_symlink_loop);
+    tcase_add_test(tc_core, test_warmup_missing_manifest);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "cache/cache.h"
+#include "cache/watcher.h"
+#include "test_files.h"
+
+static char watched_root[64];
+
+void test_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", watched_root, name);
+}
+
+// Watcher drops buffers from its own thread, so it is waited for. File
+// at rewrite path, if any, is written again meanwhile.
+bool test_wait_dropped(CacheManager *manager, const char *key, const char *rewrite)
+{
+    for (int i = 0; i < 200; i++) {
+        ReadBuffer *rb = GetBuffer(manager, key);
+        if (rb == NULL) {
+            return true;
+        }
+        ReleaseBuffer(rb);
+        if (rewrite != NULL) {
+            test_write_file(rewrite, "2");
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+CacheManager *test_watched_cache(void)
+{
+    test_create_tree(watched_root, sizeof(watched_root), "watcher");
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    ck_assert_ptr_nonnull(manager);
+    return manager;
+}
+
+START_TEST(test_watcher_drops_modified_file)
+{
+    CacheManager *manager = test_watched_cache();
+    char path[64];
+    test_path(path, sizeof(path), "styles.css");
+    test_write_file(path, "a{}");
+    ck_assert_int_eq(CreateBuffer(manager, path, 3), ERR_OK);
+
+    CacheWatcherParams watcher_params = {watched_root, NULL, false};
+    CacheWatcher *watcher = CreateCacheWatcher(manager, &watcher_params);
+    ck_assert_ptr_nonnull(watcher);
+    test_write_file(path, "a{color:red}");
+    ck_assert(test_wait_dropped(manager, path, NULL));
+
+    DestroyCacheWatcher(watcher);
+    DestroyCacheManager(manager);
+    test_remove_tree(watched_root);
+}
+END_TEST
+
+START_TEST(test_watcher_drops_moved_and_deleted_files)
+{
+    CacheManager *manager = test_watched_cache();
+    char moved[64], deleted[64], other[64];
+    test_path(moved, sizeof(moved), "moved.js");
+    test_path(deleted, sizeof(deleted), "deleted.js");
+    test_path(other, sizeof(other), "other.js");
+    test_write_file(moved, "1");
+    test_write_file(deleted, "2");
+    test_write_file(other, "3");
+    ck_assert_int_eq(CreateBuffer(manager, moved, 1), ERR_OK);
+    ck_assert_int_eq(CreateBuffer(manager, deleted, 1), ERR_OK);
+    ck_assert_int_eq(CreateBuffer(manager, other, 1), ERR_OK);
+
+    CacheWatcherParams watcher_params = {watched_root, NULL, false};
+    CacheWatcher *watcher = CreateCacheWatcher(manager, &watcher_params);
+    ck_assert_ptr_nonnull(watcher);
+    char renamed[64];
+    test_path(renamed, sizeof(renamed), "renamed.js");
+    ck_assert_int_eq(rename(moved, renamed), 0);
+    ck_assert_int_eq(unlink(deleted), 0);
+    ck_assert(test_wait_dropped(manager, moved, NULL));
+    ck_assert(test_wait_dropped(manager, deleted, NULL));
+
+    ReadBuffer *rb = GetBuffer(manager, other);
+    ck_assert_ptr_nonnull(rb);
+    ReleaseBuffer(rb);
+
+    DestroyCacheWatcher(watcher);
+    DestroyCacheManager(manager);
+    test_remove_tree(watched_root);
+}
+END_TEST
+
+START_TEST(test_watcher_follows_directories)
+{
+    CacheManager *manager = test_watched_cache();
+    CacheWatcherParams watcher_params = {watched_root, NULL, false};
+    CacheWatcher *watcher = CreateCacheWatcher(manager, &watcher_params);
+    ck_assert_ptr_nonnull(watcher);
+
+    // Created after watcher started
+    char dir[64], path[80];
+    test_path(dir, sizeof(dir), "assets");
+    ck_assert_int_eq(mkdir(dir, 0755), 0);
+    snprintf(path, sizeof(path), "%s/app.js", dir);
+    test_write_file(path, "1");
+    ck_assert_int_eq(CreateBuffer(manager, path, 1), ERR_OK);
+    // Watch of new directory is added by watcher thread, changes made
+    // before that are not seen
+    ck_assert(test_wait_dropped(manager, path, path));
+
+    // Moving directory away drops everything below it
+    ck_assert_int_eq(CreateBuffer(manager, path, 1), ERR_OK);
+    char moved[64];
+    test_path(moved, sizeof(moved), "assets.old");
+    ck_assert_int_eq(rename(dir, moved), 0);
+    ck_assert(test_wait_dropped(manager, path, NULL));
+
+    DestroyCacheWatcher(watcher);
+    DestroyCacheManager(manager);
+    test_remove_tree(watched_root);
+}
+END_TEST
+
+START_TEST(test_watcher_refreshes_written_file)
+{
+    CacheManager *manager = test_watched_cache();
+    ReaderPoolParams pool_params = {16, 1};
+    FileReaderPool *pool = CreateFileReaderPool(&pool_params);
+    ck_assert_ptr_nonnull(pool);
+    char path[64], deleted[64];
+    test_path(path, sizeof(path), "index.html");
+    test_path(deleted, sizeof(deleted), "deleted.html");
+    test_write_file(path, "old");
+    test_write_file(deleted, "1");
+    ck_assert_int_eq(CreateBuffer(manager, path, 3), ERR_OK);
+    ck_assert_int_eq(CreateBuffer(manager, deleted, 1), ERR_OK);
+    ReadBuffer *held = GetBuffer(manager, path);
+
+    CacheWatcherParams watcher_params = {watched_root, pool, false};
+    CacheWatcher *watcher = CreateCacheWatcher(manager, &watcher_params);
+    ck_assert_ptr_nonnull(watcher);
+    test_write_file(path, "new!");
+    ck_assert_int_eq(unlink(deleted), 0);
+
+    // Entry is never missing, it is swapped for the new version
+    ReadBuffer *rb = NULL;
+    for (int i = 0; i < 200; i++) {
+        rb = GetBuffer(manager, path);
+        ck_assert_ptr_nonnull(rb);
+        if (rb != held) {
+            break;
+        }
+        ReleaseBuffer(rb);
+        rb = NULL;
+        usleep(10000);
+    }
+    ck_assert_ptr_nonnull(rb);
+    ck_assert_uint_eq(*rb->size, 4);
+    ck_assert_uint_eq(GetBufferUsed(rb), 4);
+    ck_assert_int_eq(memcmp(rb->data, "new!", 4), 0);
+    ReleaseBuffer(rb);
+    ReleaseBuffer(held);
+    ck_assert(test_wait_dropped(manager, deleted, NULL));
+
+    DestroyCacheWatcher(watcher);
+    ShutdownFileReaderPool(pool);
+    DestroyFileReaderPool(pool);
+    DestroyCacheManager(manager);
+    test_remove_tree(watched_root);
+}
+END_TEST
+
+START_TEST(test_watcher_drops_mapping_being_written)
+{
+    CacheManager *manager = test_watched_cache();
+    ReaderPoolParams pool_params = {16, 1};
+    FileReaderPool *pool = CreateFileReaderPool(&pool_params);
+    ck_assert_ptr_nonnull(pool);
+    char path[64];
+    test_path(path, sizeof(path), "app.js");
+    test_write_file(path, "run();");
+    ReadBuffer *rb;
+    ck_assert_int_eq(GetOrMapBuffer(manager, path, &rb), ERR_OK);
+    ReleaseBuffer(rb);
+
+    CacheWatcherParams watcher_params = {watched_root, pool, true};
+    CacheWatcher *watcher = CreateCacheWatcher(manager, &watcher_params);
+    ck_assert_ptr_nonnull(watcher);
+    // Written in place by a writer that keeps it open
+    int fd = open(path, O_WRONLY);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(write(fd, "RUN", 3), 3);
+    ck_assert(test_wait_dropped(manager, path, NULL));
+    close(fd);
+
+    DestroyCacheWatcher(watcher);
+    ShutdownFileReaderPool(pool);
+    DestroyFileReaderPool(pool);
+    DestroyCacheManager(manager);
+    test_remove_tree(watched_root);
+}
+END_TEST
+
+START_TEST(test_watcher_missing_root)
+{
+    CacheParams params = {1000, 10, 100, EVICTION_POLICY_LRU, 1, CACHE_STORAGE_HEAP};
+    CacheManager *manager = CreateCacheManager(&params);
+    CacheWatcherParams watcher_params = {"/tmp/test_watcher_missing_root", NULL, false};
+    ck_assert_ptr_null(CreateCacheWatcher(manager, &watcher_params));
+    DestroyCacheWatcher(NULL);
+    DestroyCacheManager(manager);
+}
+END_TEST
+
+Suite *watcher_suite(void)
+{
+    Suite *s = suite_create("Watcher");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_watcher_drops_modified_file);
+    tcase_add_test(tc_core, test_watcher_drops_moved_and_deleted_files);
+    tcase_add_test(tc_core, test_watcher_follows_directories);
+    tcase_add_test(tc_core, test_watcher_refreshes_written_file);
+    tcase_add_test(tc_core, test_watcher_drops_mapping_being_written);
+    tcase_add_test(tc_core, test_watcher_missing_root);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+#include "cache/warmup.h"
+#include "utils/log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Seconds between progress reports
+#define WARMUP_LOG_INTERVAL 1.0
+
+typedef struct {
+    char *path;
+    size_t size;
+    struct timespec mtime;
+    // Manifest line of first matching pattern, files are loaded in its order
+    size_t rank;
+} WarmupFile;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} WarmupDirectory;
+
+typedef struct {
+    CacheWarmup *warmup;
+    WriteBuffer *loader;
+} WarmupRead;
+
+struct CacheWarmup {
+    CacheManager *manager;
+    char *root;
+    // Without manifest every file is loaded
+    bool has_manifest;
+    char **patterns;
+    size_t pattern_count;
+    size_t max_file_size;
+    size_t max_memory;
+    size_t max_entries;
+
+    FileReaderPool *pool;
+    size_t parallel_reads;
+    bool map_files;
+
+    // Owned by thread
+    WarmupFile *files;
+    size_t file_count;
+    size_t file_capacity;
+    // Listed so far, symlinks may lead to them again
+    WarmupDirectory *directories;
+    size_t directory_count;
+    size_t directory_capacity;
+    struct timespec started;
+    struct timespec logged;
+
+    pthread_t thread;
+    bool joined;
+
+    pthread_mutex_t mutex;
+    // Signaled when a read finishes
+    pthread_cond_t read_done;
+    // Guarded by mutex
+    size_t reads_in_flight;
+    bool stop;
+    CacheWarmupProgress progress;
+};
+
+void *_CacheWarmupThread(void *data);
+
+double _SecondsSince(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Patterns in manifest order, paths relative to root
+int _ReadManifest(CacheWarmup *warmup, const char *manifest) {
+    FILE *file = fopen(manifest, "r");
+    if (file == NULL) {
+        LogErrorF("Failed to open warm-up manifest %s: %s", manifest, strerror(errno));
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' ')) {
+            line[--length] = '\0';
+        }
+        char *pattern = line;
+        while (*pattern == ' ' || *pattern == '/') {
+            pattern++;
+        }
+        if (*pattern == '\0' || *pattern == '#') {
+            continue;
+        }
+
+        if (warmup->pattern_count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            char **patterns = realloc(warmup->patterns, capacity * sizeof(char *));
+            if (patterns == NULL) {
+                break;
+            }
+            warmup->patterns = patterns;
+        }
+        warmup->patterns[warmup->pattern_count] = strdup(pattern);
+        if (warmup->patterns[warmup->pattern_count] == NULL) {
+            break;
+        }
+        warmup->pattern_count++;
+    }
+    bool failed = !feof(file);
+    free(line);
+    fclose(file);
+    if (failed) {
+        LogErrorF("Failed to read warm-up manifest %s", manifest);
+        return -1;
+    }
+    return 0;
+}
+
+// Index of first pattern that matches, pattern_count if none does
+size_t _MatchPatterns(const CacheWarmup *warmup, const char *relative) {
+    for (size_t i = 0; i < warmup->pattern_count; i++) {
+        if (fnmatch(warmup->patterns[i], relative, 0) == 0) {
+            return i;
+        }
+    }
+    return warmup->pattern_count;
+}
+
+void _AddWarmupFile(CacheWarmup *warmup, const char *path, const struct stat *st) {
+    size_t size = st->st_size;
+    size_t rank = 0;
+    if (warmup->has_manifest) {
+        rank = _MatchPatterns(warmup, path + strlen(warmup->root) + 1);
+        if (rank == warmup->pattern_count) {
+            return;
+        }
+    }
+    if (warmup->max_file_size > 0 && size > warmup->max_file_size) {
+        return;
+    }
+
+    if (warmup->file_count == warmup->file_capacity) {
+        size_t capacity = warmup->file_capacity > 0 ? warmup->file_capacity * 2 : 64;
+        WarmupFile *files = realloc(warmup->files, capacity * sizeof(WarmupFile));
+        if (files == NULL) {
+            return;
+        }
+        warmup->files = files;
+        warmup->file_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return;
+    }
+    warmup->files[warmup->file_count++] = (WarmupFile) {copy, size, st->st_mtim, rank};
+}
+
+// False if directory was visited before or can't be recorded
+bool _VisitDirectory(CacheWarmup *warmup, const struct stat *st) {
+    for (size_t i = 0; i < warmup->directory_count; i++) {
+        if (warmup->directories[i].dev == st->st_dev && warmup->directories[i].ino == st->st_ino) {
+            return false;
+        }
+    }
+    if (warmup->directory_count == warmup->directory_capacity) {
+        size_t capacity = warmup->directory_capacity > 0 ? warmup->directory_capacity * 2 : 16;
+        WarmupDirectory *directories = realloc(warmup->directories, capacity * sizeof(WarmupDirectory));
+        if (directories == NULL) {
+            return false;
+        }
+        warmup->directories = directories;
+        warmup->directory_capacity = capacity;
+    }
+    warmup->directories[warmup->directory_count++] = (WarmupDirectory) {st->st_dev, st->st_ino};
+    return true;
+}
+
+// Collects files under path that are to be loaded
+void _CollectFiles(CacheWarmup *warmup, const char *path) {
+    DIR *stream = opendir(path);
+    if (stream == NULL) {
+        LogWarnF("Failed to list %s for warm-up: %s", path, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(stream)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        if (child == NULL) {
+            break;
+        }
+        sprintf(child, "%s/%s", path, entry->d_name);
+        // Followed like requests follow them, each directory listed once
+        struct stat st;
+        if (stat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                if (_VisitDirectory(warmup, &st)) {
+                    _CollectFiles(warmup, child);
+                }
+            } else if (S_ISREG(st.st_mode)) {
+                _AddWarmupFile(warmup, child, &st);
+            }
+        }
+        free(child);
+    }
+    closedir(stream);
+}
+
+int _CompareWarmupFiles(const void *a, const void *b) {
+    const WarmupFile *first = a;
+    const WarmupFile *second = b;
+    if (first->rank != second->rank) {
+        return first->rank < second->rank ? -1 : 1;
+    }
+    return strcmp(first->path, second->path);
+}
+
+CacheWarmup *CreateCacheWarmup(CacheManager *manager, const CacheWarmupParams *params) {
+    CacheWarmup *warmup = malloc(sizeof(CacheWarmup));
+    if (warmup == NULL) {
+        return NULL;
+    }
+    memset(warmup, 0, sizeof(CacheWarmup));
+    warmup->manager = manager;
+    warmup->max_file_size = params->max_file_size;
+    warmup->max_memory = params->max_memory;
+    warmup->max_entries = params->max_entries;
+    warmup->pool = params->pool;
+    warmup->parallel_reads = params->parallel_reads > 0 ? params->parallel_reads : 1;
+    warmup->map_files = params->map_files;
+
+    warmup->root = strdup(params->root);
+    if (warmup->root == NULL) {
+        free(warmup);
+        return NULL;
+    }
+    // Cache keys are root without trailing slash and request path
+    size_t length = strlen(warmup->root);
+    if (length > 1 && warmup->root[length - 1] == '/') {
+        warmup->root[length - 1] = '\0';
+    }
+
+    warmup->has_manifest = params->manifest != NULL;
+    if (warmup->has_manifest && _ReadManifest(warmup, params->manifest) != 0) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&warmup->mutex, NULL);
+    pthread_cond_init(&warmup->read_done, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &warmup->started);
+    if (pthread_create(&warmup->thread, NULL, _CacheWarmupThread, warmup) != 0) {
+        LogError("Failed to start warm-up thread");
+        pthread_mutex_destroy(&warmup->mutex);
+        pthread_cond_destroy(&warmup->read_done);
+        goto fail;
+    }
+    return warmup;
+
+fail:
+    for (size_t i = 0; i < warmup->pattern_count; i++) {
+        free(warmup->patterns[i]);
+    }
+    free(warmup->patterns);
+    free(warmup->root);
+    free(warmup);
+    return NULL;
+}
+
+void WaitCacheWarmup(CacheWarmup *warmup) {
+    if (!warmup->joined) {
+        pthread_join(warmup->thread, NULL);
+        warmup->joined = true;
+    }
+}
+
+void DestroyCacheWarmup(CacheWarmup *warmup) {
+    if (warmup == NULL) return;
+
+    pthread_mutex_lock(&warmup->mutex);
+    warmup->stop = true;
+    pthread_mutex_unlock(&warmup->mutex);
+    WaitCacheWarmup(warmup);
+
+    pthread_mutex_destroy(&warmup->mutex);
+    pthread_cond_destroy(&warmup->read_done);
+    for (size_t i = 0; i < warmup->pattern_count; i++) {
+        free(warmup->patterns[i]);
+    }
+    free(warmup->patterns);
+    free(warmup->root);
+    free(warmup);
+}
+
+CacheWarmupProgress GetCacheWarmupProgress(CacheWarmup *warmup) {
+    pthread_mutex_lock(&warmup->mutex);
+    CacheWarmupProgress progress = warmup->progress;
+    pthread_mutex_unlock(&warmup->mutex);
+    return progress;
+}
+
+// Warmup must be already locked up to this point.
+void _CountWarmupFile(CacheWarmup *warmup, bool loaded, size_t bytes) {
+    if (loaded) {
+        warmup->progress.loaded_files++;
+        warmup->progress.loaded_bytes += bytes;
+    } else {
+        warmup->progress.skipped_files++;
+    }
+}
+
+void _WarmupReadCallback(FileReadResponse *response, void *userData) {
+    WarmupRead *read = userData;
+    CacheWarmup *warmup = read->warmup;
+    bool loaded = response->error == ERR_OK && response->bytesRead == *read->loader->size;
+    if (response->error == ERR_OK) {
+        PublishBufferLoad(read->loader, response->bytesRead);
+    }
+    FinishBufferLoad(read->loader);
+    ReleaseWriteBuffer(read->loader);
+
+    pthread_mutex_lock(&warmup->mutex);
+    _CountWarmupFile(warmup, loaded, response->bytesRead);
+    warmup->reads_in_flight--;
+    pthread_cond_signal(&warmup->read_done);
+    pthread_mutex_unlock(&warmup->mutex);
+
+    free(read);
+    free(response);
+}
+
+// Adding file must not evict anything loaded before
+bool _WarmupFits(CacheWarmup *warmup, size_t size) {
+    size_t used_memory, entry_count;
+    GetCacheUsage(warmup->manager, &used_memory, &entry_count);
+    return used_memory + size <= warmup->max_memory && entry_count < warmup->max_entries;
+}
+
+// Returns false once pool stops taking reads
+bool _WarmupFile(CacheWarmup *warmup, const WarmupFile *file) {
+    ReadBuffer *buffer;
+    if (warmup->map_files) {
+        int err = GetOrMapBuffer(warmup->manager, file->path, &buffer);
+        // Files that can't be mapped, like empty ones, are copied
+        if (err != ERR_FILE_MAP) {
+            if (err == ERR_OK) {
+                ReleaseBuffer(buffer);
+            }
+            pthread_mutex_lock(&warmup->mutex);
+            _CountWarmupFile(warmup, err == ERR_OK, file->size);
+            pthread_mutex_unlock(&warmup->mutex);
+            return true;
+        }
+    }
+
+    WriteBuffer *loader;
+    int err = GetOrCreateBuffer(warmup->manager, file->path, file->size, &buffer, &loader);
+    if (err == ERR_OK) {
+        // Loader keeps a reference of its own
+        ReleaseBuffer(buffer);
+    }
+    // Already cached or being loaded by a request, or reader would have
+    // nothing to read
+    if (err != ERR_OK || loader == NULL || file->size == 0) {
+        if (loader != NULL) {
+            PublishBufferLoad(loader, 0);
+            FinishBufferLoad(loader);
+            ReleaseWriteBuffer(loader);
+        }
+        pthread_mutex_lock(&warmup->mutex);
+        _CountWarmupFile(warmup, err == ERR_OK, file->size);
+        pthread_mutex_unlock(&warmup->mutex);
+        return true;
+    }
+
+    WarmupRead *read = malloc(sizeof(WarmupRead));
+    if (read == NULL) {
+        FinishBufferLoad(loader);
+        ReleaseWriteBuffer(loader);
+        pthread_mutex_lock(&warmup->mutex);
+        _CountWarmupFile(warmup, false, 0);
+        pthread_mutex_unlock(&warmup->mutex);
+        return true;
+    }
+    read->warmup = warmup;
+    read->loader = loader;
+
+    // Size and mtime are of the same stat, taken before reading
+    SetBufferMtime(loader, &file->mtime);
+    // Left partially filled by failed load
+    PublishBufferLoad(loader, 0);
+    FileReadRequest request = {
+        .path = file->path,
+        .buffer = loader->data,
+        .bufferSize = *loader->size,
+        .callback = _WarmupReadCallback,
+        .userData = read,
+        .progress = NULL
+    };
+    pthread_mutex_lock(&warmup->mutex);
+    warmup->reads_in_flight++;
+    pthread_mutex_unlock(&warmup->mutex);
+    FileReadSet set = QueueFile(warmup->pool, request);
+    if (set.error != ERR_OK) {
+        free(read);
+        FinishBufferLoad(loader);
+        ReleaseWriteBuffer(loader);
+        pthread_mutex_lock(&warmup->mutex);
+        warmup->reads_in_flight--;
+        _CountWarmupFile(warmup, false, 0);
+        pthread_mutex_unlock(&warmup->mutex);
+        return set.error != ERR_SHUTDOWN;
+    }
+    return true;
+}
+
+void _LogWarmupProgress(CacheWarmup *warmup) {
+    if (_SecondsSince(&warmup->logged) < WARMUP_LOG_INTERVAL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &warmup->logged);
+    CacheWarmupProgress progress = GetCacheWarmupProgress(warmup);
+    LogInfoF("Warm-up: %zu of %zu files, %zu of %zu bytes loaded, %zu skipped",
+             progress.loaded_files, progress.total_files, progress.loaded_bytes, progress.total_bytes,
+             progress.skipped_files);
+}
+
+void *_CacheWarmupThread(void *data) {
+    CacheWarmup *warmup = data;
+
+    struct stat st;
+    if (stat(warmup->root, &st) != 0 || _VisitDirectory(warmup, &st)) {
+        _CollectFiles(warmup, warmup->root);
+    }
+    free(warmup->directories);
+    warmup->directories = NULL;
+    qsort(warmup->files, warmup->file_count, sizeof(WarmupFile), _CompareWarmupFiles);
+    pthread_mutex_lock(&warmup->mutex);
+    warmup->progress.total_files = warmup->file_count;
+    for (size_t i = 0; i < warmup->file_count; i++) {
+        warmup->progress.total_bytes += warmup->files[i].size;
+    }
+    pthread_mutex_unlock(&warmup->mutex);
+    LogInfoF("Warming up cache with %zu files (%zu bytes) under %s", warmup->progress.total_files,
+             warmup->progress.total_bytes, warmup->root);
+    warmup->logged = warmup->started;
+
+    for (size_t i = 0; i < warmup->file_count; i++) {
+        pthread_mutex_lock(&warmup->mutex);
+        while (warmup->reads_in_flight >= warmup->parallel_reads && !warmup->stop) {
+            pthread_cond_wait(&warmup->read_done, &warmup->mutex);
+        }
+        bool stop = warmup->stop;
+        // Stopped files count as skipped
+        if (stop) {
+            warmup->progress.skipped_files += warmup->file_count - i;
+        }
+        pthread_mutex_unlock(&warmup->mutex);
+        if (stop) {
+            break;
+        }
+
+        // Smaller files further down may still fit
+        if (!_WarmupFits(warmup, warmup->files[i].size)) {
+            pthread_mutex_lock(&warmup->mutex);
+            _CountWarmupFile(warmup, false, 0);
+            pthread_mutex_unlock(&warmup->mutex);
+        } else if (!_WarmupFile(warmup, &warmup->files[i])) {
+            pthread_mutex_lock(&warmup->mutex);
+            warmup->stop = true;
+            warmup->progress.skipped_files += warmup->file_count - i - 1;
+            pthread_mutex_unlock(&warmup->mutex);
+            break;
+        }
+        _LogWarmupProgress(warmup);
+    }
+
+    // Reads in flight still finish into the cache
+    pthread_mutex_lock(&warmup->mutex);
+    while (warmup->reads_in_flight > 0) {
+        pthread_cond_wait(&warmup->read_done, &warmup->mutex);
+    }
+    warmup->progress.done = true;
+    CacheWarmupProgress progress = warmup->progress;
+    pthread_mutex_unlock(&warmup->mutex);
+
+    LogInfoF("Warm-up done in %.2f s: %zu files, %zu bytes loaded, %zu skipped", _SecondsSince(&warmup->started),
+             progress.loaded_files, progress.loaded_bytes, progress.skipped_files);
+
+    for (size_t i = 0; i < warmup->file_count; i++) {
+        free(warmup->files[i].path);
+    }
+    free(warmup->files);
+    warmup->files = NULL;
+    return NULL;
+}
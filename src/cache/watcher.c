@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include "cache/watcher.h"
+#include "utils/log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+// Whatever may change what a cached path holds
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+#define WATCH_EVENTS_SIZE (64 * 1024)
+
+typedef struct {
+    int wd;
+    char *path;
+} WatchedDir;
+
+typedef struct FileRefresh FileRefresh;
+
+// Changed file being read into shadow buffer by reader pool
+struct FileRefresh {
+    CacheWatcher *watcher;
+    char *path;
+    WriteBuffer *shadow;
+    // Changed again while being read, so it is read once more after
+    bool again;
+    bool done;
+    FileRefresh *next;
+};
+
+struct CacheWatcher {
+    CacheManager *manager;
+    char *root;
+    // NULL if changed files are dropped instead
+    FileReaderPool *refresh_pool;
+    bool map_files;
+
+    int inotify_fd;
+    // Wakes thread up to stop
+    int stop_fd;
+    // Wakes thread up to collect finished refreshes
+    int refresh_fd;
+    pthread_t thread;
+
+    // Ordered by watch descriptor, kernel hands them out increasing
+    WatchedDir *dirs;
+    size_t dir_count;
+    size_t dir_capacity;
+
+    // Refreshes are finished from reader threads
+    pthread_mutex_t refresh_mutex;
+    pthread_cond_t refresh_done;
+    FileRefresh *refreshes;
+};
+
+void *_CacheWatcherThread(void *data);
+
+WatchedDir *_FindWatchedDir(CacheWatcher *watcher, int wd) {
+    size_t low = 0;
+    size_t high = watcher->dir_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (watcher->dirs[middle].wd < wd) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < watcher->dir_count && watcher->dirs[low].wd == wd) {
+        return &watcher->dirs[low];
+    }
+    return NULL;
+}
+
+void _ForgetWatchedDir(CacheWatcher *watcher, WatchedDir *dir) {
+    free(dir->path);
+    size_t index = dir - watcher->dirs;
+    memmove(dir, dir + 1, (watcher->dir_count - index - 1) * sizeof(WatchedDir));
+    watcher->dir_count--;
+}
+
+char *_JoinPath(const char *dir, const char *name) {
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path == NULL) {
+        return NULL;
+    }
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+// Watches directory and everything below it
+int _WatchTree(CacheWatcher *watcher, const char *path) {
+    int wd = inotify_add_watch(watcher->inotify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        LogWarnF("Failed to watch %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    WatchedDir *dir = _FindWatchedDir(watcher, wd);
+    if (dir != NULL) {
+        // Directory moved within the tree keeps its watch
+        free(dir->path);
+        dir->path = copy;
+    } else {
+        if (watcher->dir_count == watcher->dir_capacity) {
+            size_t capacity = watcher->dir_capacity > 0 ? watcher->dir_capacity * 2 : 16;
+            WatchedDir *dirs = realloc(watcher->dirs, capacity * sizeof(WatchedDir));
+            if (dirs == NULL) {
+                free(copy);
+                return -1;
+            }
+            watcher->dirs = dirs;
+            watcher->dir_capacity = capacity;
+        }
+        size_t index = watcher->dir_count;
+        while (index > 0 && watcher->dirs[index - 1].wd > wd) {
+            index--;
+        }
+        memmove(&watcher->dirs[index + 1], &watcher->dirs[index],
+                (watcher->dir_count - index) * sizeof(WatchedDir));
+        watcher->dirs[index].wd = wd;
+        watcher->dirs[index].path = copy;
+        watcher->dir_count++;
+    }
+
+    DIR *stream = opendir(path);
+    if (stream == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(stream)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char *child = _JoinPath(path, entry->d_name);
+        if (child == NULL) {
+            break;
+        }
+        struct stat st;
+        bool is_dir = entry->d_type == DT_DIR ||
+                      (entry->d_type == DT_UNKNOWN && lstat(child, &st) == 0 && S_ISDIR(st.st_mode));
+        if (is_dir) {
+            _WatchTree(watcher, child);
+        }
+        free(child);
+    }
+    closedir(stream);
+    return 0;
+}
+
+// Stops watching directory that left the tree and everything below it
+void _UnwatchTree(CacheWatcher *watcher, const char *path) {
+    size_t length = strlen(path);
+    size_t i = 0;
+    while (i < watcher->dir_count) {
+        WatchedDir *dir = &watcher->dirs[i];
+        if (strncmp(dir->path, path, length) == 0 && (dir->path[length] == '\0' || dir->path[length] == '/')) {
+            inotify_rm_watch(watcher->inotify_fd, dir->wd);
+            _ForgetWatchedDir(watcher, dir);
+            continue;
+        }
+        i++;
+    }
+}
+
+void _InvalidateTree(CacheWatcher *watcher, const char *path) {
+    char *prefix = _JoinPath(path, "");
+    if (prefix == NULL) {
+        return;
+    }
+    size_t count = InvalidateBuffersWithPrefix(watcher->manager, prefix);
+    LogDebugF("Invalidated %zu cached files under %s", count, path);
+    free(prefix);
+}
+
+void _DropFile(CacheWatcher *watcher, const char *path) {
+    if (InvalidateBuffer(watcher->manager, path) == ERR_OK) {
+        LogDebugF("Invalidated cached file %s", path);
+    }
+}
+
+// Called from reader thread while reader pool is locked, so the file is
+// read again by watcher thread if needed
+void _FinishRefresh(FileRefresh *refresh) {
+    CacheWatcher *watcher = refresh->watcher;
+    int err = CommitBufferRefresh(watcher->manager, refresh->shadow);
+    if (err == ERR_OK) {
+        LogDebugF("Refreshed cached file %s", refresh->path);
+    } else if (err != ERR_KEY_NOT_FOUND) {
+        LogDebugF("Invalidated cached file %s, it could not be refreshed", refresh->path);
+    }
+
+    pthread_mutex_lock(&watcher->refresh_mutex);
+    refresh->done = true;
+    // Watcher may be destroyed as soon as the lock is released
+    eventfd_write(watcher->refresh_fd, 1);
+    pthread_cond_broadcast(&watcher->refresh_done);
+    pthread_mutex_unlock(&watcher->refresh_mutex);
+}
+
+void _RefreshReadCallback(FileReadResponse *response, void *userData) {
+    FileRefresh *refresh = userData;
+    if (response->error == ERR_OK) {
+        PublishBufferLoad(refresh->shadow, response->bytesRead);
+    }
+    free(response);
+    _FinishRefresh(refresh);
+}
+
+// Reads changed file into shadow buffer, cached version is served until
+// it is swapped in. Mapped files are mapped again, their old mapping was
+// dropped once they were written to.
+void _RefreshFile(CacheWatcher *watcher, const char *path) {
+    if (watcher->map_files) {
+        int err = RemapBuffer(watcher->manager, path);
+        if (err == ERR_OK) {
+            LogDebugF("Refreshed cached file %s", path);
+        } else if (err != ERR_KEY_NOT_FOUND) {
+            LogDebugF("Invalidated cached file %s, it could not be refreshed", path);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&watcher->refresh_mutex);
+    for (FileRefresh *r = watcher->refreshes; r != NULL; r = r->next) {
+        if (strcmp(r->path, path) == 0) {
+            r->again = true;
+            pthread_mutex_unlock(&watcher->refresh_mutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&watcher->refresh_mutex);
+
+    struct stat st;
+    // Reader doesn't take empty buffers
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        _DropFile(watcher, path);
+        return;
+    }
+    WriteBuffer *shadow;
+    int err = StartBufferRefresh(watcher->manager, path, st.st_size, &shadow);
+    if (err == ERR_KEY_NOT_FOUND) {
+        return;
+    }
+    if (err != ERR_OK) {
+        _DropFile(watcher, path);
+        return;
+    }
+    SetBufferMtime(shadow, &st.st_mtim);
+
+    FileRefresh *refresh = malloc(sizeof(FileRefresh));
+    char *copy = strdup(path);
+    if (refresh == NULL || copy == NULL) {
+        free(refresh);
+        free(copy);
+        // Shadow that was not filled drops cached version
+        CommitBufferRefresh(watcher->manager, shadow);
+        return;
+    }
+    refresh->watcher = watcher;
+    refresh->path = copy;
+    refresh->shadow = shadow;
+    refresh->again = false;
+    refresh->done = false;
+
+    pthread_mutex_lock(&watcher->refresh_mutex);
+    refresh->next = watcher->refreshes;
+    watcher->refreshes = refresh;
+    pthread_mutex_unlock(&watcher->refresh_mutex);
+
+    FileReadRequest request = {
+        .path = refresh->path,
+        .buffer = shadow->data,
+        .bufferSize = *shadow->size,
+        .callback = _RefreshReadCallback,
+        .userData = refresh,
+        .progress = NULL
+    };
+    FileReadSet set = QueueFile(watcher->refresh_pool, request);
+    if (set.error != ERR_OK) {
+        _FinishRefresh(refresh);
+    }
+}
+
+// Frees finished refreshes, files changed while they were read are read
+// again
+void _CollectRefreshes(CacheWatcher *watcher) {
+    eventfd_t count;
+    eventfd_read(watcher->refresh_fd, &count);
+
+    FileRefresh *again = NULL;
+    pthread_mutex_lock(&watcher->refresh_mutex);
+    FileRefresh **link = &watcher->refreshes;
+    while (*link != NULL) {
+        FileRefresh *refresh = *link;
+        if (!refresh->done) {
+            link = &refresh->next;
+            continue;
+        }
+        *link = refresh->next;
+        refresh->next = again;
+        again = refresh;
+    }
+    pthread_mutex_unlock(&watcher->refresh_mutex);
+
+    while (again != NULL) {
+        FileRefresh *next = again->next;
+        if (again->again) {
+            _RefreshFile(watcher, again->path);
+        }
+        free(again->path);
+        free(again);
+        again = next;
+    }
+}
+
+void _HandleWatchEvent(CacheWatcher *watcher, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        LogWarn("File change events were lost, dropping whole cache");
+        _InvalidateTree(watcher, watcher->root);
+        return;
+    }
+
+    WatchedDir *dir = _FindWatchedDir(watcher, event->wd);
+    if (dir == NULL) {
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        _ForgetWatchedDir(watcher, dir);
+        return;
+    }
+    if (event->len == 0) {
+        return;
+    }
+
+    char *path = _JoinPath(dir->path, event->name);
+    if (path == NULL) {
+        return;
+    }
+
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            _WatchTree(watcher, path);
+            _InvalidateTree(watcher, path);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            _InvalidateTree(watcher, path);
+            _UnwatchTree(watcher, path);
+        }
+    } else if (watcher->refresh_pool != NULL && !(event->mask & (IN_DELETE | IN_MOVED_FROM))) {
+        // Copied version is served while file is being written, mapping
+        // is the file being written and is dropped instead
+        if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)) {
+            _RefreshFile(watcher, path);
+        } else if (watcher->map_files) {
+            _DropFile(watcher, path);
+        }
+    } else {
+        _DropFile(watcher, path);
+    }
+    free(path);
+}
+
+void *_CacheWatcherThread(void *data) {
+    CacheWatcher *watcher = data;
+    char *events = malloc(WATCH_EVENTS_SIZE);
+    if (events == NULL) {
+        LogError("Failed to allocate watcher event buffer");
+        return NULL;
+    }
+
+    struct pollfd fds[3] = {
+        {.fd = watcher->inotify_fd, .events = POLLIN},
+        {.fd = watcher->stop_fd, .events = POLLIN},
+        {.fd = watcher->refresh_fd, .events = POLLIN}
+    };
+    while (true) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogErrorF("Watcher poll failed: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        if (fds[2].revents & POLLIN) {
+            _CollectRefreshes(watcher);
+        }
+
+        ssize_t length = read(watcher->inotify_fd, events, WATCH_EVENTS_SIZE);
+        if (length <= 0) {
+            continue;
+        }
+        // Kernel pads names, so every event starts aligned
+        for (char *p = events; p < events + length;) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            _HandleWatchEvent(watcher, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    free(events);
+    return NULL;
+}
+
+CacheWatcher *CreateCacheWatcher(CacheManager *manager, const CacheWatcherParams *params) {
+    CacheWatcher *watcher = malloc(sizeof(CacheWatcher));
+    if (watcher == NULL) {
+        return NULL;
+    }
+    memset(watcher, 0, sizeof(CacheWatcher));
+    watcher->manager = manager;
+    watcher->refresh_pool = params->refresh_pool;
+    watcher->map_files = params->map_files;
+
+    watcher->root = strdup(params->root);
+    if (watcher->root == NULL) {
+        free(watcher);
+        return NULL;
+    }
+    // Cache keys are root without trailing slash and request path
+    size_t length = strlen(watcher->root);
+    if (length > 1 && watcher->root[length - 1] == '/') {
+        watcher->root[length - 1] = '\0';
+    }
+
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watcher->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    watcher->refresh_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (watcher->inotify_fd < 0 || watcher->stop_fd < 0 || watcher->refresh_fd < 0) {
+        LogErrorF("Failed to create watcher descriptors: %s", strerror(errno));
+        goto fail;
+    }
+    if (_WatchTree(watcher, watcher->root) != 0) {
+        goto fail;
+    }
+    LogInfoF("Watching %zu directories under %s for changes, %s changed files", watcher->dir_count,
+             watcher->root, watcher->refresh_pool != NULL ? "refreshing" : "dropping");
+    pthread_mutex_init(&watcher->refresh_mutex, NULL);
+    pthread_cond_init(&watcher->refresh_done, NULL);
+    if (pthread_create(&watcher->thread, NULL, _CacheWatcherThread, watcher) != 0) {
+        LogError("Failed to start watcher thread");
+        pthread_mutex_destroy(&watcher->refresh_mutex);
+        pthread_cond_destroy(&watcher->refresh_done);
+        goto fail;
+    }
+    return watcher;
+
+fail:
+    if (watcher->inotify_fd >= 0) {
+        close(watcher->inotify_fd);
+    }
+    if (watcher->stop_fd >= 0) {
+        close(watcher->stop_fd);
+    }
+    if (watcher->refresh_fd >= 0) {
+        close(watcher->refresh_fd);
+    }
+    for (size_t i = 0; i < watcher->dir_count; i++) {
+        free(watcher->dirs[i].path);
+    }
+    free(watcher->dirs);
+    free(watcher->root);
+    free(watcher);
+    return NULL;
+}
+
+void DestroyCacheWatcher(CacheWatcher *watcher) {
+    if (watcher == NULL) return;
+
+    eventfd_write(watcher->stop_fd, 1);
+    pthread_join(watcher->thread, NULL);
+
+    // Reads in flight still finish into the cache
+    pthread_mutex_lock(&watcher->refresh_mutex);
+    FileRefresh *refresh = watcher->refreshes;
+    while (refresh != NULL) {
+        if (!refresh->done) {
+            pthread_cond_wait(&watcher->refresh_done, &watcher->refresh_mutex);
+            refresh = watcher->refreshes;
+            continue;
+        }
+        refresh = refresh->next;
+    }
+    pthread_mutex_unlock(&watcher->refresh_mutex);
+    while (watcher->refreshes != NULL) {
+        refresh = watcher->refreshes->next;
+        free(watcher->refreshes->path);
+        free(watcher->refreshes);
+        watcher->refreshes = refresh;
+    }
+    pthread_mutex_destroy(&watcher->refresh_mutex);
+    pthread_cond_destroy(&watcher->refresh_done);
+
+    close(watcher->inotify_fd);
+    close(watcher->stop_fd);
+    close(watcher->refresh_fd);
+    for (size_t i = 0; i < watcher->dir_count; i++) {
+        free(watcher->dirs[i].path);
+    }
+    free(watcher->dirs);
+    free(watcher->root);
+    free(watcher);
+}
@@ -14,6 +14,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <sys/resource.h>
 
 Server *server;
 
@@ -51,6 +52,35 @@ size_t parse_size(const char *str) {
     return 0;
 }
 
+WorkerBackend parse_worker_backend(const char *str) {
+    if (strcasecmp(str, "pselect") == 0) return WORKER_BACKEND_PSELECT;
+    if (strcasecmp(str, "epoll") == 0) return WORKER_BACKEND_EPOLL;
+    if (strcasecmp(str, "io_uring") == 0) return WORKER_BACKEND_IO_URING;
+    return WORKER_BACKEND_EPOLL; // default
+}
+
+AssignPolicy parse_assign_policy(const char *str) {
+    if (strcasecmp(str, "round-robin") == 0) return ASSIGN_POLICY_ROUND_ROBIN;
+    if (strcasecmp(str, "least-conn") == 0) return ASSIGN_POLICY_LEAST_CONNECTIONS;
+    if (strcasecmp(str, "least-bytes") == 0) return ASSIGN_POLICY_LEAST_BYTES;
+    if (strcasecmp(str, "p2c") == 0) return ASSIGN_POLICY_POWER_OF_TWO;
+    return ASSIGN_POLICY_LEAST_CONNECTIONS; // default
+}
+
+CacheStorage parse_cache_storage(const char *str) {
+    if (strcasecmp(str, "heap") == 0) return CACHE_STORAGE_HEAP;
+    if (strcasecmp(str, "memfd") == 0) return CACHE_STORAGE_MEMFD;
+    if (strcasecmp(str, "arena") == 0) return CACHE_STORAGE_ARENA;
+    return CACHE_STORAGE_HEAP; // default
+}
+
+EvictionPolicy parse_eviction_policy(const char *str) {
+    if (strcasecmp(str, "lru") == 0) return EVICTION_POLICY_LRU;
+    if (strcasecmp(str, "s3-fifo") == 0) return EVICTION_POLICY_S3_FIFO;
+    if (strcasecmp(str, "w-tinylfu") == 0) return EVICTION_POLICY_W_TINYLFU;
+    return EVICTION_POLICY_LRU; // default
+}
+
 LogLevel parse_log_level(const char *str) {
     if (strcasecmp(str, "debug") == 0) return LOG_LEVEL_DEBUG;
     if (strcasecmp(str, "info") == 0) return LOG_LEVEL_INFO;
@@ -73,23 +103,42 @@ char* human_size(size_t size) {
     return buf;
 }
 
+void print_usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("Options:\n");
+    printf("  -r <root>       Static root directory (default: data)\n");
+    printf("  -p <port>       Port number (default: 8080)\n");
+    printf("  -c <size>       Max cache size (e.g., 1024m, default: 4g)\n");
+    printf("  -e <num>        Max cache entries (default: 1024)\n");
+    printf("  -s <size>       Max cache entry size (e.g., 2g, default: 2g)\n");
+    printf("  -E <policy>     Cache eviction policy (lru, s3-fifo, w-tinylfu, default: lru)\n");
+    printf("  -H <num>        Cache shards, each with its share of cache limits (default: 16)\n");
+    printf("  -R              Serve changed files from cache while they are read again (with -M dropped while written)\n");
+    printf("  -M              Cache files as read-only mappings instead of copies (replace, don't truncate them)\n");
+    printf("  -T <storage>    Cache storage of copied files (heap, memfd - sent with sendfile(), arena - huge page slabs, default: heap)\n");
+    printf("  -W <manifest>   Preload files listed in manifest, paths or globs under root, at startup\n");
+    printf("  -U <size>       Preload files up to this size at startup, every one under root without -W\n");
+    printf("  -P <file>       Save cache to snapshot file on graceful shutdown, restore it at startup\n");
+    printf("  -B              Save contents of cached files in snapshot, not only their paths\n");
+    printf("  -a <num>        Number of async readers (default: 4)\n");
+    printf("  -m <num>        Max requests per worker (default: 1024)\n");
+    printf("  -w <num>        Number of workers (default: 8)\n");
+    printf("  -b <backend>    Worker I/O backend (pselect, epoll, io_uring, default: epoll)\n");
+    printf("  -L              Accept in workers on per-worker SO_REUSEPORT sockets\n");
+    printf("  -A <policy>     Connection assignment (round-robin, least-conn, least-bytes, p2c, default: least-conn)\n");
+    printf("  -k <seconds>    Keep-alive idle timeout, 0 disables keep-alive (default: 5)\n");
+    printf("  -K <num>        Max requests per keep-alive connection, 0 - unlimited (default: 100)\n");
+    printf("  -S <size>       Send files of at least this size with sendfile(), 0 disables (default: 16m)\n");
+    printf("  -l <level>      Minimum log level (debug, info, warn, error, default: info)\n");
+    printf("  -h              Show this help\n");
+}
+
 int main(int argc, char **argv) {
     LogInit();
 
     // Check for --help
     if (argc > 1 && strcmp(argv[1], "--help") == 0) {
-        printf("Usage: %s [options]\n", argv[0]);
-        printf("Options:\n");
-        printf("  -r <root>       Static root directory (default: data)\n");
-        printf("  -p <port>       Port number (default: 8080)\n");
-        printf("  -c <size>       Max cache size (e.g., 1024m, default: 4g)\n");
-        printf("  -e <num>        Max cache entries (default: 1024)\n");
-        printf("  -s <size>       Max cache entry size (e.g., 2g, default: 2g)\n");
-        printf("  -a <num>        Number of async readers (default: 4)\n");
-        printf("  -m <num>        Max requests per worker (default: 1024)\n");
-        printf("  -w <num>        Number of workers (default: 8)\n");
-        printf("  -l <level>      Minimum log level (debug, info, warn, error, default: info)\n");
-        printf("  -h              Show this help\n");
+        print_usage(argv[0]);
         return 0;
     }
 
@@ -99,13 +148,28 @@ int main(int argc, char **argv) {
     size_t max_cache_size = 4LL * 1024 * 1024 * 1024;
     int max_cache_entries = 1024;
     size_t max_cache_entry_size = 2048LL * 1024 * 1024;
+    EvictionPolicy cache_policy = EVICTION_POLICY_LRU;
+    int cache_shards = 16;
+    bool cache_refresh = false;
+    bool cache_mmap = false;
+    CacheStorage cache_storage = CACHE_STORAGE_HEAP;
+    const char *warmup_manifest = NULL;
+    size_t warmup_max_file_size = 0;
+    const char *cache_snapshot = NULL;
+    bool snapshot_bodies = false;
     int reader_count = 4;
     int max_requests = 1024;
     int worker_count = 8;
+    WorkerBackend worker_backend = WORKER_BACKEND_EPOLL;
+    bool reuseport = false;
+    AssignPolicy assign_policy = ASSIGN_POLICY_LEAST_CONNECTIONS;
+    int keepalive_timeout = 5;
+    int keepalive_max_requests = 100;
+    size_t sendfile_threshold = 16LL * 1024 * 1024;
     LogLevel log_level = LOG_LEVEL_INFO;
 
     int opt;
-    while ((opt = getopt(argc, argv, "r:p:c:e:s:a:m:w:l:h")) != -1) {
+    while ((opt = getopt(argc, argv, "r:p:c:e:s:E:H:RMT:W:U:P:Ba:m:w:b:LA:k:K:S:l:h")) != -1) {
         switch (opt) {
             case 'r':
                 static_root = optarg;
@@ -122,6 +186,33 @@ int main(int argc, char **argv) {
             case 's':
                 max_cache_entry_size = parse_size(optarg);
                 break;
+            case 'E':
+                cache_policy = parse_eviction_policy(optarg);
+                break;
+            case 'H':
+                cache_shards = atoi(optarg);
+                break;
+            case 'R':
+                cache_refresh = true;
+                break;
+            case 'M':
+                cache_mmap = true;
+                break;
+            case 'T':
+                cache_storage = parse_cache_storage(optarg);
+                break;
+            case 'W':
+                warmup_manifest = optarg;
+                break;
+            case 'U':
+                warmup_max_file_size = parse_size(optarg);
+                break;
+            case 'P':
+                cache_snapshot = optarg;
+                break;
+            case 'B':
+                snapshot_bodies = true;
+                break;
             case 'a':
                 reader_count = atoi(optarg);
                 break;
@@ -131,22 +222,29 @@ int main(int argc, char **argv) {
             case 'w':
                 worker_count = atoi(optarg);
                 break;
+            case 'b':
+                worker_backend = parse_worker_backend(optarg);
+                break;
+            case 'L':
+                reuseport = true;
+                break;
+            case 'A':
+                assign_policy = parse_assign_policy(optarg);
+                break;
+            case 'k':
+                keepalive_timeout = atoi(optarg);
+                break;
+            case 'K':
+                keepalive_max_requests = atoi(optarg);
+                break;
+            case 'S':
+                sendfile_threshold = parse_size(optarg);
+                break;
             case 'l':
                 log_level = parse_log_level(optarg);
                 break;
             case 'h':
-                printf("Usage: %s [options]\n", argv[0]);
-                printf("Options:\n");
-                printf("  -r <root>       Static root directory (default: data)\n");
-                printf("  -p <port>       Port number (default: 8080)\n");
-                printf("  -c <size>       Cache size (e.g., 1024m, default: 4.0 g)\n");
-                printf("  -e <num>        Max cache entries (default: 1024)\n");
-                printf("  -s <size>       Max cache entry size (e.g., 2g, default: 2.0 g)\n");
-                printf("  -a <num>        Number of async readers (default: 4)\n");
-                printf("  -m <num>        Max requests per worker (default: 1024)\n");
-                printf("  -w <num>        Number of workers (default: 8)\n");
-                printf("  -l <level>      Minimum log level (debug, info, warn, error, default: info)\n");
-                printf("  -h              Show this help\n");
+                print_usage(argv[0]);
                 return 0;
             default:
                 fprintf(stderr, "Usage: %s [options]\n", argv[0]);
@@ -162,9 +260,41 @@ int main(int argc, char **argv) {
     LogInfoF("Cache size: %zu bytes (%s)", max_cache_size, human_size(max_cache_size));
     LogInfoF("Max cache entries: %d", max_cache_entries);
     LogInfoF("Max cache entry size: %zu bytes (%s)", max_cache_entry_size, human_size(max_cache_entry_size));
+    LogInfoF("Cache eviction policy: %s", EvictionPolicyName(cache_policy));
+    LogInfoF("Cache shards: %d", cache_shards);
+    LogInfoF("Changed cached files: %s", cache_refresh ? "refreshed" : "dropped");
+    LogInfoF("Cached files: %s", cache_mmap ? "mapped" : "copied");
+    LogInfoF("Cache storage: %s", CacheStorageName(cache_storage));
+    if (warmup_manifest != NULL || warmup_max_file_size > 0) {
+        LogInfoF("Cache warm-up: %s, files up to %s", warmup_manifest != NULL ? warmup_manifest : "every file",
+                 warmup_max_file_size > 0 ? human_size(warmup_max_file_size) : "any size");
+    }
+    if (cache_snapshot != NULL) {
+        LogInfoF("Cache snapshot: %s, %s", cache_snapshot, snapshot_bodies ? "with contents" : "paths only");
+    }
     LogInfoF("Reader count: %d", reader_count);
     LogInfoF("Max requests per worker: %d", max_requests);
     LogInfoF("Worker count: %d", worker_count);
+    LogInfoF("Worker backend: %s", WorkerBackendName(worker_backend));
+    LogInfoF("Per-worker listeners: %s", reuseport ? "yes" : "no");
+    LogInfoF("Assignment policy: %s", AssignPolicyName(assign_policy));
+    LogInfoF("Keep-alive timeout: %d s, max requests: %d", keepalive_timeout, keepalive_max_requests);
+    LogInfoF("Sendfile threshold: %zu bytes (%s)", sendfile_threshold, human_size(sendfile_threshold));
+
+    if (cache_storage == CACHE_STORAGE_MEMFD) {
+        // Every cached buffer holds a descriptor next to connections
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            if (limit.rlim_cur < limit.rlim_max) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+            if (limit.rlim_cur < (rlim_t) max_cache_entries + (rlim_t) max_requests * worker_count) {
+                LogWarnF("Open files limit %llu may not fit cache entries and connections",
+                         (unsigned long long) limit.rlim_cur);
+            }
+        }
+    }
 
     ServerParams server_params;
     server_params.static_root = static_root;
@@ -172,9 +302,25 @@ int main(int argc, char **argv) {
     server_params.max_cache_size = max_cache_size;
     server_params.max_cache_entries = max_cache_entries;
     server_params.max_cache_entry_size = max_cache_entry_size;
+    server_params.cache_policy = cache_policy;
+    server_params.cache_shards = cache_shards;
+    server_params.cache_refresh = cache_refresh;
+    server_params.cache_mmap = cache_mmap;
+    server_params.cache_storage = cache_storage;
+    server_params.cache_warmup = warmup_manifest != NULL || warmup_max_file_size > 0;
+    server_params.warmup_manifest = warmup_manifest;
+    server_params.warmup_max_file_size = warmup_max_file_size;
+    server_params.cache_snapshot = cache_snapshot;
+    server_params.snapshot_bodies = snapshot_bodies;
     server_params.reader_count = reader_count;
     server_params.max_requests = max_requests;
     server_params.worker_count = worker_count;
+    server_params.worker_backend = worker_backend;
+    server_params.reuseport = reuseport;
+    server_params.assign_policy = assign_policy;
+    server_params.keepalive_timeout = keepalive_timeout;
+    server_params.keepalive_max_requests = keepalive_max_requests;
+    server_params.sendfile_threshold = sendfile_threshold;
 
     server = CreateServer(&server_params);
     if (server == NULL) {
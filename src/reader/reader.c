@@ -384,6 +384,44 @@ int _SendDone(uuid_t request_id, FileReadRequest request, size_t bytesRead) {
     return ERR_OK;
 }
 
+// Closes file unless canceling did and frees worker slot.
+// Assumed mutex is locked by calling side
+void _ReleasePendingFile(FileReaderPool *pool, size_t worker_id, PendingFile *pending) {
+    if (!pending->is_canceled) {
+        close(pending->fd);
+    }
+    free(pending);
+    pool->worker_requests[worker_id] = NULL;
+}
+
+// Reads file into request buffer chunk by chunk until EOF or buffer end.
+// Returns bytes read or -1 with errno set.
+ssize_t _ReadFileChunks(PendingFile *pending) {
+    FileReadRequest *request = &pending->request;
+    size_t total = 0;
+    while (total < request->bufferSize) {
+        size_t len = request->bufferSize - total;
+        if (len > READER_CHUNK_SIZE) {
+            len = READER_CHUNK_SIZE;
+        }
+        ssize_t bytes_read = read(pending->fd, request->buffer + total, len);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        total += bytes_read;
+        if (request->progress != NULL && total < request->bufferSize) {
+            request->progress(total, request->userData);
+        }
+    }
+    return total;
+}
+
 void *_FileReaderWorker(void *data) {
     WorkerParams *params = data;
     FileReaderPool *pool = params->pool;
@@ -449,6 +487,7 @@ void *_FileReaderWorker(void *data) {
             }
             pool->failed_requests++;
             pool->pending_tasks--;
+            _ReleasePendingFile(pool, worker_id, pending);
             pthread_mutex_unlock(&pool->mutex);
             continue;
         }
@@ -458,6 +497,7 @@ void *_FileReaderWorker(void *data) {
             _SendError(pending->request_id, pending->request, ERR_FILE_NOT_REGULAR_FILE);
             pool->failed_requests++;
             pool->pending_tasks--;
+            _ReleasePendingFile(pool, worker_id, pending);
             pthread_mutex_unlock(&pool->mutex);
             continue;
         }
@@ -467,12 +507,13 @@ void *_FileReaderWorker(void *data) {
             _SendError(pending->request_id, pending->request, ERR_FILE_TOO_LARGE);
             pool->failed_requests++;
             pool->pending_tasks--;
+            _ReleasePendingFile(pool, worker_id, pending);
             pthread_mutex_unlock(&pool->mutex);
             continue;
         }
 
         // Read from file
-        ssize_t bytes_read = read(pending->fd, pending->request.buffer, pending->request.bufferSize);
+        ssize_t bytes_read = _ReadFileChunks(pending);
         
         pthread_mutex_lock(&pool->mutex);
         if (bytes_read == -1) {
@@ -485,8 +526,7 @@ void *_FileReaderWorker(void *data) {
                 pool->failed_requests++;
             }
             pool->pending_tasks--;
-            free(pending);
-            pool->worker_requests[worker_id] = NULL;
+            _ReleasePendingFile(pool, worker_id, pending);
             pthread_mutex_unlock(&pool->mutex);
             continue;
         }
@@ -495,8 +535,7 @@ void *_FileReaderWorker(void *data) {
             _SendCancel(pending->request_id, pending->request);
             pool->canceled_requests++;
             pool->pending_tasks--;
-            free(pending);
-            pool->worker_requests[worker_id] = NULL;
+            _ReleasePendingFile(pool, worker_id, pending);
             pthread_mutex_unlock(&pool->mutex);
             continue;
         }
@@ -505,8 +544,7 @@ void *_FileReaderWorker(void *data) {
         _SendDone(pending->request_id, pending->request, bytes_read);
         pool->completed_requests++;
         pool->pending_tasks--;
-        free(pending);
-        pool->worker_requests[worker_id] = NULL;
+        _ReleasePendingFile(pool, worker_id, pending);
         pthread_mutex_unlock(&pool->mutex);
     }
     pthread_exit(NULL);
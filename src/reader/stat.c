@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <reader/stat.h>
 
 #include <sys/types.h>
@@ -21,6 +22,7 @@ FileStatResponse _MakeStatResponse(struct stat *sb) {
     }
 
     response.last_modified = sb->st_mtime;
+    response.mtime = sb->st_mtim;
     response.last_accessed = sb->st_atime;
     response.created = sb->st_ctime;
     
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/stat.h>
 #include <check.h>
 #include <stdlib.h>
@@ -494,6 +495,77 @@ START_TEST(test_queue_file_binary_file)
 }
 END_TEST
 
+// Progress test state
+static size_t progress_calls = 0;
+static size_t progress_last = 0;
+static int progress_monotonic = 1;
+
+void test_progress(size_t bytesRead, void *userData __attribute__((unused))) {
+    pthread_mutex_lock(&response_mutex);
+    if (bytesRead <= progress_last) {
+        progress_monotonic = 0;
+    }
+    progress_last = bytesRead;
+    progress_calls++;
+    pthread_mutex_unlock(&response_mutex);
+}
+
+START_TEST(test_queue_file_progress)
+{
+    ReaderPoolParams params = {10, 2};
+    FileReaderPool *pool = CreateFileReaderPool(&params);
+    ck_assert_ptr_nonnull(pool);
+
+    // File of several read chunks
+    size_t file_size = 3 * READER_CHUNK_SIZE + 100;
+    char path[] = "/tmp/test_reader_XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ne(fd, -1);
+    char *data = malloc(file_size);
+    ck_assert_ptr_nonnull(data);
+    memset(data, 'x', file_size);
+    ck_assert_int_eq(write(fd, data, file_size), file_size);
+    close(fd);
+    free(data);
+
+    char *buffer = malloc(file_size);
+    ck_assert_ptr_nonnull(buffer);
+    progress_calls = 0;
+    progress_last = 0;
+    progress_monotonic = 1;
+    FileReadRequest req = {
+        .path = path,
+        .buffer = buffer,
+        .bufferSize = file_size,
+        .callback = test_callback,
+        .userData = NULL,
+        .progress = test_progress
+    };
+
+    FileReadSet set = QueueFile(pool, req);
+    ck_assert_int_eq(set.error, ERR_OK);
+
+    wait_for_responses(1);
+    ck_assert_ptr_nonnull(responses[0]);
+    ck_assert_int_eq(responses[0]->error, ERR_OK);
+    ck_assert_int_eq(responses[0]->bytesRead, file_size);
+
+    // Reported after every chunk but the last one
+    pthread_mutex_lock(&response_mutex);
+    ck_assert_int_eq(progress_calls, 3);
+    ck_assert_int_eq(progress_last, 3 * READER_CHUNK_SIZE);
+    ck_assert_int_eq(progress_monotonic, 1);
+    pthread_mutex_unlock(&response_mutex);
+
+    ShutdownFileReaderPool(pool);
+
+    reset_responses();
+    DestroyFileReaderPool(pool);
+    free(buffer);
+    unlink(path);
+}
+END_TEST
+
 // Cancel Tests
 START_TEST(test_cancel_file)
 {
@@ -886,6 +958,7 @@ Suite *reader_suite(void)
     tcase_add_test(tc_operations, test_queue_file_large_file);
     tcase_add_test(tc_operations, test_queue_file_empty_file);
     tcase_add_test(tc_operations, test_queue_file_binary_file);
+    tcase_add_test(tc_operations, test_queue_file_progress);
     tcase_add_test(tc_operations, test_cancel_file);
     tcase_add_test(tc_operations, test_cancel_file_after_shutdown);
     tcase_add_test(tc_operations, test_cancel_file_nonexistent);
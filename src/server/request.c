@@ -9,9 +9,12 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 RawHttpRequest *_CreateRawHttpRequest(void) {
     LogDebug("Creating RawHttpRequest");
@@ -25,6 +28,7 @@ RawHttpRequest *_CreateRawHttpRequest(void) {
         free(request);
         return NULL;
     }
+    request->head_size = 0;
     return request;
 }
 
@@ -36,6 +40,7 @@ ParsedHttpRequest *_CreateParsedHttpRequest(void) {
         return NULL;
     }
     request->method = HTTP_REQUEST_UNSUPPORTED;
+    request->keep_alive = false;
     request->path = CreateDynamicString(INITITAL_PARSED_BUFFERS_SIZE);
     if (request->path == NULL) {
         free(request);
@@ -67,6 +72,7 @@ HttpResponseData *_CreateHttpResponseData(void) {
     response->header.last_modified = 0;
     response->header.content_length = 0;
     response->body.body = NULL;
+    response->body.file_fd = -1;
     return response;
 }
 
@@ -76,6 +82,8 @@ HttpResponseRaw *_CreateHttpResponseRaw(void) {
         return NULL;
     }
     response->body_buffer = NULL;
+    response->body_fd = -1;
+    response->body_file_size = 0;
     response->header_buffer = CreateDynamicString(INITIAL_RESPONSE_HEADER_SIZE);
     if (response->header_buffer == NULL) {
         free(response);
@@ -83,6 +91,7 @@ HttpResponseRaw *_CreateHttpResponseRaw(void) {
     }
     response->header_bytes_written = 0;
     response->body_bytes_written = 0;
+    response->next = NULL;
     return response;
 }
 
@@ -130,6 +139,9 @@ void _DestroyHttpResponseData(HttpResponseData *response) {
     if (response->body.body != NULL) {
         ReleaseBuffer(response->body.body);
     }
+    if (response->body.file_fd != -1) {
+        close(response->body.file_fd);
+    }
     free(response);
 }
 
@@ -143,10 +155,18 @@ void _DestroyHttpResponseRaw(HttpResponseRaw *response) {
     if (response->body_buffer != NULL) {
         ReleaseBuffer(response->body_buffer);
     }
+    if (response->body_fd != -1) {
+        close(response->body_fd);
+    }
     free(response);
 }
 
 void DestroyHttpRequest(HttpRequest *request) {
+    while (request->queued_responses != NULL) {
+        HttpResponseRaw *next = request->queued_responses->next;
+        _DestroyHttpResponseRaw(request->queued_responses);
+        request->queued_responses = next;
+    }
     _DestroyHttpRequestRaw(request->raw_request);
     _DestroyHttpRequestParsed(request->parsed_request);
     _DestroyHttpResponseData(request->response);
@@ -169,6 +189,12 @@ int ParseHttpRequest(HttpRequest *request) {
     char *rest = request->raw_request->request_buffer->data;
     char *line;
 
+    // Stop parsing at the end of the first request head, leaving the
+    // rest of buffer intact ("\r\n\r\n" -> "\r\n\r\0")
+    if (request->raw_request->head_size > 0) {
+        rest[request->raw_request->head_size - 1] = '\0';
+    }
+
     // Parse method
     line = strtok_r(rest, "\r\n", &rest);
     if (line == NULL) {
@@ -215,6 +241,7 @@ int ParseHttpRequest(HttpRequest *request) {
         _DestroyHttpRequestParsed(parsed_request);
         return ERR_UNSUPPORTED_HTTP_VERSION;
     }
+    parsed_request->keep_alive = strncmp(status_line, HTTP_ONE_DOT_ONE_VERSION, 8) == 0;
 
     while ((line = strtok_r(rest, "\r\n", &rest)) != NULL) {
         if (strncmp(line, "User-Agent: ", 12) == 0) {
@@ -231,6 +258,13 @@ int ParseHttpRequest(HttpRequest *request) {
                 _DestroyHttpRequestParsed(parsed_request);
                 return ERR_HTTP_MEMORY;
             }
+        } else if (strncasecmp(line, HTTP_HEADER_CONNECTION, 11) == 0) {
+            line = line + 11;
+            if (strcasestr(line, HTTP_CONNECTION_CLOSE) != NULL) {
+                parsed_request->keep_alive = false;
+            } else if (strcasestr(line, HTTP_CONNECTION_KEEP_ALIVE) != NULL) {
+                parsed_request->keep_alive = true;
+            }
         };
     }
     if (request->parsed_request) {
@@ -275,8 +309,23 @@ int AddHttpResponseBody(HttpRequest *request, ReadBuffer *body) {
     return ERR_OK;
 }
 
+int AddHttpResponseFile(HttpRequest *request, int fd) {
+    if (!request->response) {
+        return ERR_RESPONSE_NOT_FILLED;
+    }
+
+    HttpResponseData *response = request->response;
+    if (response->body.file_fd != -1) {
+        close(response->body.file_fd);
+    }
+    response->body.file_fd = fd;
+    return ERR_OK;
+}
+
 int _WriteStatusLine(HttpResponseRaw *response, const char *version, const char *status);
 int _AddHeader(HttpResponseRaw *response, const char *header, const char *value);
+int _AddConnectionHeader(HttpResponseRaw *response, bool keep_alive);
+int _AddEmptyBodyHeaders(HttpResponseRaw *response, bool keep_alive);
 
 int PrepareHttpResponseOk(HttpRequest *request) {
     if (!request->response) {
@@ -353,6 +402,13 @@ int PrepareHttpResponseOk(HttpRequest *request) {
         return ERR_HTTP_MEMORY;
     }
 
+    // Connection
+    err = _AddConnectionHeader(raw_response, request->keep_alive);
+    if (err != ERR_OK) {
+        _DestroyHttpResponseRaw(raw_response);
+        return ERR_HTTP_MEMORY;
+    }
+
     // Final Delimiter
     err = AppendDynamicStringChar(raw_response->header_buffer, HTTP_HEADER_DELIMITER);
     if (err != ERR_OK) {
@@ -363,6 +419,9 @@ int PrepareHttpResponseOk(HttpRequest *request) {
     // Transfer body
     raw_response->body_buffer = response->body.body;
     response->body.body = NULL;
+    raw_response->body_fd = response->body.file_fd;
+    raw_response->body_file_size = response->header.content_length;
+    response->body.file_fd = -1;
 
     raw_response->header_bytes_written = 0;
     raw_response->body_bytes_written = 0;
@@ -391,6 +450,12 @@ int PrepareHttpResponseForbidden(HttpRequest *request) {
         return err;
     }
 
+    err = _AddEmptyBodyHeaders(raw_response, request->keep_alive);
+    if (err != ERR_OK) {
+        _DestroyHttpResponseRaw(raw_response);
+        return ERR_HTTP_MEMORY;
+    }
+
     // Final Delimiter
     err = AppendDynamicStringChar(raw_response->header_buffer, HTTP_HEADER_DELIMITER);
     if (err != ERR_OK) {
@@ -421,6 +486,12 @@ int PrepareHttpResponseNotFound(HttpRequest *request) {
         return err;
     }
 
+    err = _AddEmptyBodyHeaders(raw_response, request->keep_alive);
+    if (err != ERR_OK) {
+        _DestroyHttpResponseRaw(raw_response);
+        return ERR_HTTP_MEMORY;
+    }
+
     // Final Delimiter
     err = AppendDynamicStringChar(raw_response->header_buffer, HTTP_HEADER_DELIMITER);
     if (err != ERR_OK) {
@@ -449,6 +520,12 @@ int PrepareHttpResponseUnsupportedMethod(HttpRequest *request) {
         return err;
     }
 
+    err = _AddEmptyBodyHeaders(raw_response, request->keep_alive);
+    if (err != ERR_OK) {
+        _DestroyHttpResponseRaw(raw_response);
+        return ERR_HTTP_MEMORY;
+    }
+
     // Final Delimiter
     err = AppendDynamicStringChar(raw_response->header_buffer, HTTP_HEADER_DELIMITER);
     if (err != ERR_OK) {
@@ -502,6 +579,20 @@ int _AddHeader(HttpResponseRaw *response, const char *header, const char *value)
     return ERR_OK;
 }
 
+int _AddConnectionHeader(HttpResponseRaw *response, bool keep_alive) {
+    const char *value = keep_alive ? HTTP_CONNECTION_KEEP_ALIVE : HTTP_CONNECTION_CLOSE;
+    return _AddHeader(response, HTTP_HEADER_CONNECTION, value);
+}
+
+// Error responses carry no body, length lets client reuse connection
+int _AddEmptyBodyHeaders(HttpResponseRaw *response, bool keep_alive) {
+    int err = _AddHeader(response, HTTP_HEADER_CONTENT_LENGTH, "0");
+    if (err != ERR_OK) {
+        return err;
+    }
+    return _AddConnectionHeader(response, keep_alive);
+}
+
 int ResetRawRequest(HttpRequest *request) {
     if (request->raw_request == NULL) {
         return ERR_OK;
@@ -510,18 +601,100 @@ int ResetRawRequest(HttpRequest *request) {
     return ERR_OK;
 }
 
-int ReadRequest(HttpRequest *request) {
-    LogDebug("Reading request data");
-    size_t upto = request->raw_request->request_buffer->capacity - request->raw_request->request_buffer->size;
-    if (upto == 0) {
-        int err = ExpandDynamicString(request->raw_request->request_buffer, request->raw_request->request_buffer->capacity);
+int GetRequestReadBuffer(HttpRequest *request, char **to, size_t *upto) {
+    DynamicString *buffer = request->raw_request->request_buffer;
+    size_t left = buffer->capacity - buffer->size;
+    if (left == 0) {
+        int err = ExpandDynamicString(buffer, buffer->capacity);
         if (err != ERR_OK) {
             LogError("Failed to expand request buffer");
             return ERR_HTTP_MEMORY;
         }
-        upto = request->raw_request->request_buffer->capacity - request->raw_request->request_buffer->size;
+        left = buffer->capacity - buffer->size;
+    }
+    *to = buffer->data + buffer->size;
+    *upto = left;
+    return ERR_OK;
+}
+
+int CommitRequestRead(HttpRequest *request, size_t bytes_read) {
+    DynamicString *buffer = request->raw_request->request_buffer;
+    buffer->size += bytes_read;
+
+    char *end = strnstr(buffer->data, "\r\n\r\n", buffer->size);
+    if (end != NULL) {
+        LogDebug("Request read complete");
+        request->raw_request->head_size = end - buffer->data + 4;
+        return ERR_REQUEST_READ_END;
+    }
+
+    return ERR_OK;
+}
+
+int ResetHttpRequest(HttpRequest *request) {
+    RawHttpRequest *raw_request = request->raw_request;
+    DynamicString *buffer = raw_request->request_buffer;
+
+    size_t consumed = raw_request->head_size;
+    if (consumed > buffer->size) {
+        consumed = buffer->size;
+    }
+    memmove(buffer->data, buffer->data + consumed, buffer->size - consumed);
+    buffer->size -= consumed;
+    raw_request->head_size = 0;
+
+    _DestroyHttpRequestParsed(request->parsed_request);
+    request->parsed_request = NULL;
+    _DestroyHttpResponseData(request->response);
+    request->response = NULL;
+    _DestroyHttpResponseRaw(request->raw_response);
+    request->raw_response = NULL;
+
+    request->keep_alive = false;
+    request->state = HTTP_STATE_READ;
+
+    if (buffer->size > 0) {
+        return CommitRequestRead(request, 0);
+    }
+    return ERR_OK;
+}
+
+bool HasPipelinedRequest(HttpRequest *request) {
+    RawHttpRequest *raw_request = request->raw_request;
+    DynamicString *buffer = raw_request->request_buffer;
+    if (raw_request->head_size == 0 || buffer->size <= raw_request->head_size) {
+        return false;
+    }
+    return strnstr(buffer->data + raw_request->head_size, "\r\n\r\n",
+                   buffer->size - raw_request->head_size) != NULL;
+}
+
+int QueueHttpResponse(HttpRequest *request) {
+    if (!request->raw_response) {
+        return ERR_RESPONSE_NOT_FILLED;
+    }
+
+    HttpResponseRaw *raw_response = request->raw_response;
+    request->raw_response = NULL;
+    raw_response->next = NULL;
+    if (request->queued_tail != NULL) {
+        request->queued_tail->next = raw_response;
+    } else {
+        request->queued_responses = raw_response;
+    }
+    request->queued_tail = raw_response;
+    request->queued_count++;
+    return ERR_OK;
+}
+
+int ReadRequest(HttpRequest *request) {
+    LogDebug("Reading request data");
+    char *to;
+    size_t upto;
+    int err = GetRequestReadBuffer(request, &to, &upto);
+    if (err != ERR_OK) {
+        return err;
     }
-    char *to = request->raw_request->request_buffer->data + request->raw_request->request_buffer->size;
 
     ssize_t bytes_read = read(request->socketfd, to, upto);
     if (bytes_read == -1) {
@@ -532,14 +705,12 @@ int ReadRequest(HttpRequest *request) {
         LogErrorF("Read error: %s", strerror(errno));
         return ERR_REQUEST_READ_ERROR;
     }
-    request->raw_request->request_buffer->size += bytes_read;
-
-    if (strnstr(request->raw_request->request_buffer->data, "\r\n\r\n", request->raw_request->request_buffer->size) != NULL) {
-        LogDebug("Request read complete");
-        return ERR_REQUEST_READ_END;
+    if (bytes_read == 0) {
+        LogDebug("Connection closed by peer");
+        return ERR_REQUEST_CLOSED;
     }
 
-    return ERR_OK;
+    return CommitRequestRead(request, bytes_read);
 }
 
 int AddPathPrefix(HttpRequest *request, const char *prefix) {
@@ -566,64 +737,276 @@ int ReplacePath(HttpRequest *request, const char *path) {
     return ERR_OK; 
 }
 
-int WriteRequest(HttpRequest *request) {
-    LogDebug("Writing response");
-    if (!request->raw_response) {
-        LogError("Response not prepared");
-        return ERR_RESPONSE_NOT_FILLED;
+// Descriptor body is sent from with sendfile(), -1 if it is gathered
+int _ResponseBodyFd(HttpRequest *request, HttpResponseRaw *raw_response) {
+    if (raw_response->body_fd != -1) {
+        return raw_response->body_fd;
     }
+    if (request->sendfile_buffers && raw_response->body_buffer != NULL) {
+        return raw_response->body_buffer->fd;
+    }
+    return -1;
+}
 
-    HttpResponseRaw *raw_response = request->raw_response;
-    if (raw_response->header_buffer == NULL) {
-        LogError("Header buffer not set");
-        return ERR_RESPONSE_NOT_FILLED;
+size_t _ResponseBodyLeft(HttpResponseRaw *raw_response, bool *loaded) {
+    if (raw_response->body_fd != -1) {
+        *loaded = true;
+        return raw_response->body_file_size - raw_response->body_bytes_written;
+    }
+    if (raw_response->body_buffer == NULL) {
+        *loaded = true;
+        return 0;
     }
 
+    // Written part of buffer never changes, only used counter grows
+    size_t used = GetBufferUsed(raw_response->body_buffer);
+
+    *loaded = used == *raw_response->body_buffer->size;
+    return used - raw_response->body_bytes_written;
+}
+
+// Adds unsent parts of response to iov. Returns false if nothing may
+// follow it: iov is full (truncated is set) or its body is not loaded
+// completely yet.
+bool _AddResponseVector(HttpRequest *request, HttpResponseRaw *raw_response, struct iovec *iov, int max_iov,
+                        int *iov_count, bool *truncated) {
     size_t header_left = raw_response->header_buffer->size - raw_response->header_bytes_written;
     if (header_left > 0) {
-        char *header_from = raw_response->header_buffer->data + raw_response->header_bytes_written;
+        if (*iov_count == max_iov) {
+            *truncated = true;
+            return false;
+        }
+        iov[*iov_count].iov_base = raw_response->header_buffer->data + raw_response->header_bytes_written;
+        iov[*iov_count].iov_len = header_left;
+        (*iov_count)++;
+    }
+
+    bool loaded;
+    size_t body_left = _ResponseBodyLeft(raw_response, &loaded);
+    if (_ResponseBodyFd(request, raw_response) != -1) {
+        // Body is sent by sendfile() after gathered segments
+        if (body_left > 0) {
+            *truncated = true;
+            return false;
+        }
+        return loaded;
+    }
+    if (body_left > 0) {
+        if (*iov_count == max_iov) {
+            *truncated = true;
+            return false;
+        }
+        iov[*iov_count].iov_base = (char *) raw_response->body_buffer->data + raw_response->body_bytes_written;
+        iov[*iov_count].iov_len = body_left;
+        (*iov_count)++;
+    }
+    return loaded;
+}
 
-        ssize_t bytes_written = write(request->socketfd, header_from, header_left);
-        if (bytes_written == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                LogDebug("Write would block");
-                return ERR_RESPONSE_NONBLOCKED_ERROR;
-            }
-            LogErrorF("Write error: %s", strerror(errno));
-            return ERR_RESPONSE_WRITE_ERROR;
+int GetResponseWriteVector(HttpRequest *request, struct iovec *iov, int max_iov,
+                           int *iov_count, bool *truncated) {
+    *iov_count = 0;
+    *truncated = false;
+
+    bool more = true;
+    HttpResponseRaw *raw_response = request->queued_responses;
+    while (raw_response != NULL && more) {
+        more = _AddResponseVector(request, raw_response, iov, max_iov, iov_count, truncated);
+        raw_response = raw_response->next;
+    }
+
+    if (more && request->raw_response != NULL) {
+        more = _AddResponseVector(request, request->raw_response, iov, max_iov, iov_count, truncated);
+    } else if (more && request->state == HTTP_STATE_WRITE) {
+        LogError("Response not prepared");
+        return ERR_RESPONSE_NOT_FILLED;
+    }
+
+    if (*iov_count == 0) {
+        if (!more && !*truncated) {
+            LogDebug("Response body not loaded yet");
+            return ERR_RESPONSE_BODY_PENDING;
         }
-        raw_response->header_bytes_written += bytes_written;
-        return ERR_OK;
+        LogDebug("Response write complete");
+        return ERR_RESPONSE_WRITE_END;
     }
+    return ERR_OK;
+}
 
-    if (raw_response->body_buffer == NULL) {
+int GetResponseWriteFile(HttpRequest *request, int *fd, off_t *offset, size_t *count) {
+    // First response with unsent bytes decides what goes next
+    HttpResponseRaw *raw_response = request->queued_responses;
+    while (raw_response != NULL) {
+        bool loaded;
+        if (raw_response->header_buffer->size > raw_response->header_bytes_written ||
+            _ResponseBodyLeft(raw_response, &loaded) > 0 || !loaded) {
+            break;
+        }
+        raw_response = raw_response->next;
+    }
+    if (raw_response == NULL) {
+        raw_response = request->raw_response;
+    }
+
+    if (raw_response == NULL || _ResponseBodyFd(request, raw_response) == -1 ||
+        raw_response->header_bytes_written < raw_response->header_buffer->size) {
+        return ERR_RESPONSE_WRITE_END;
+    }
+    // Cached body is sent as far as it is loaded
+    bool loaded;
+    size_t left = _ResponseBodyLeft(raw_response, &loaded);
+    if (left == 0) {
         return ERR_RESPONSE_WRITE_END;
     }
 
-    LockReadBuffer(raw_response->body_buffer);
-    size_t body_left = *raw_response->body_buffer->used - raw_response->body_bytes_written;
-    if (body_left > 0) {
-        const char *body_from = raw_response->body_buffer->data + raw_response->body_bytes_written;
+    *fd = _ResponseBodyFd(request, raw_response);
+    *offset = (off_t) raw_response->body_bytes_written;
+    *count = left;
+    return ERR_OK;
+}
+
+// Returns bytes left after the part belonging to response
+size_t _CommitResponseRawWrite(HttpResponseRaw *raw_response, size_t bytes_written, bool *done) {
+    size_t header_left = raw_response->header_buffer->size - raw_response->header_bytes_written;
+    size_t header_part = bytes_written < header_left ? bytes_written : header_left;
+    raw_response->header_bytes_written += header_part;
+    bytes_written -= header_part;
+
+    // Body still being loaded ends gathered segments, so bytes past it
+    // never belong to the next response, even if more of it was loaded
+    // since gathering
+    bool loaded;
+    size_t body_left = _ResponseBodyLeft(raw_response, &loaded);
+    size_t body_part = bytes_written < body_left ? bytes_written : body_left;
+    raw_response->body_bytes_written += body_part;
+    bytes_written -= body_part;
+
+    *done = header_part == header_left && body_part == body_left;
+    return bytes_written;
+}
+
+int CommitResponseWrite(HttpRequest *request, size_t bytes_written) {
+    bool done;
+    while (request->queued_responses != NULL) {
+        HttpResponseRaw *raw_response = request->queued_responses;
+        bytes_written = _CommitResponseRawWrite(raw_response, bytes_written, &done);
+        if (!done) {
+            return ERR_OK;
+        }
+
+        request->queued_responses = raw_response->next;
+        if (request->queued_responses == NULL) {
+            request->queued_tail = NULL;
+        }
+        request->queued_count--;
+        _DestroyHttpResponseRaw(raw_response);
+    }
+
+    if (request->raw_response != NULL) {
+        _CommitResponseRawWrite(request->raw_response, bytes_written, &done);
+    }
+    return ERR_OK;
+}
 
-        ssize_t bytes_written = write(request->socketfd, body_from, body_left);
+size_t GetResponseBytesLeft(HttpRequest *request) {
+    size_t left = 0;
+    for (HttpResponseRaw *queued = request->queued_responses; queued != NULL; queued = queued->next) {
+        left += queued->header_buffer->size - queued->header_bytes_written;
+        if (queued->body_fd != -1) {
+            left += queued->body_file_size - queued->body_bytes_written;
+        } else if (queued->body_buffer != NULL) {
+            left += *queued->body_buffer->size - queued->body_bytes_written;
+        }
+    }
+
+    HttpResponseRaw *raw_response = request->raw_response;
+    if (raw_response != NULL) {
+        left += raw_response->header_buffer->size - raw_response->header_bytes_written;
+        if (raw_response->body_buffer == NULL && raw_response->body_fd == -1) {
+            return left;
+        }
+    } else if (request->response == NULL ||
+               request->parsed_request->method == HTTP_REQUEST_HEAD) {
+        return left;
+    }
+
+    size_t body_size = request->response->header.content_length;
+    size_t body_written = raw_response != NULL ? raw_response->body_bytes_written : 0;
+    if (body_written < body_size) {
+        left += body_size - body_written;
+    }
+    return left;
+}
+
+int WriteRequest(HttpRequest *request) {
+    LogDebug("Writing response");
+    struct iovec iov[RESPONSE_MAX_IOV];
+    int iov_count;
+    bool truncated;
+
+    // Sends until socket buffer is full, so finished response is detected
+    // right away instead of on the next writable event
+    while (1) {
+        int fd;
+        off_t offset;
+        size_t count;
+        if (GetResponseWriteFile(request, &fd, &offset, &count) == ERR_OK) {
+            ssize_t bytes_sent = sendfile(request->socketfd, fd, &offset, count);
+            if (bytes_sent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    LogDebug("Write would block");
+                    return ERR_RESPONSE_NONBLOCKED_ERROR;
+                }
+                LogErrorF("sendfile error: %s", strerror(errno));
+                return ERR_RESPONSE_WRITE_ERROR;
+            }
+            if (bytes_sent == 0) {
+                LogError("File shrank while being sent");
+                return ERR_RESPONSE_WRITE_ERROR;
+            }
+
+            CommitResponseWrite(request, bytes_sent);
+            if ((size_t) bytes_sent < count) {
+                return ERR_OK;
+            }
+            continue;
+        }
+
+        int err = GetResponseWriteVector(request, iov, RESPONSE_MAX_IOV, &iov_count, &truncated);
+        if (err != ERR_OK) {
+            return err;
+        }
+
+        size_t gathered = 0;
+        for (int i = 0; i < iov_count; i++) {
+            gathered += iov[i].iov_len;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        // Rest of gathered responses follows immediately, don't push
+        // partial segment out
+        int flags = MSG_NOSIGNAL;
+        if (truncated) {
+            flags |= MSG_MORE;
+        }
+
+        ssize_t bytes_written = sendmsg(request->socketfd, &msg, flags);
         if (bytes_written == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                LogDebug("Body write would block");
-                UnlockReadBuffer(raw_response->body_buffer);
+                LogDebug("Write would block");
                 return ERR_RESPONSE_NONBLOCKED_ERROR;
             }
-            LogErrorF("Body write error: %s", strerror(errno));
-            UnlockReadBuffer(raw_response->body_buffer);
+            LogErrorF("Write error: %s", strerror(errno));
             return ERR_RESPONSE_WRITE_ERROR;
         }
-        raw_response->body_bytes_written += bytes_written;
-    }
-    UnlockReadBuffer(raw_response->body_buffer);
 
-    if (body_left == 0) {
-        LogDebug("Response write complete");
-        return ERR_RESPONSE_WRITE_END;
+        CommitResponseWrite(request, bytes_written);
+        if ((size_t) bytes_written < gathered) {
+            return ERR_OK;
+        }
     }
-
-    return ERR_OK;
-}
\ No newline at end of file
+}
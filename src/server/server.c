@@ -6,6 +6,9 @@
 #include "server/request.h"
 #include "reader/reader.h"
 #include "cache/cache.h"
+#include "cache/watcher.h"
+#include "cache/warmup.h"
+#include "cache/snapshot.h"
 #include "utils/log.h"
 
 #include <pthread.h>
@@ -13,33 +16,86 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
 #define SERVER_SLEEP_TIME 1000
+#define SERVER_LISTEN_BACKLOG 1000
 
 
 struct Server {
     pthread_mutex_t mutex;
     FileReaderPool *reader_pool;
     CacheManager *cache_manager;
+    // Drops cached files changed on disk, NULL if static root can't be
+    // watched
+    CacheWatcher *cache_watcher;
+    // NULL unless files are preloaded
+    CacheWarmup *cache_warmup;
+    // Saved on graceful shutdown, NULL if not
+    const char *cache_snapshot;
+    bool snapshot_bodies;
+    // Set by GracefullyShutdownServer, snapshot is saved by DestroyServer
+    // since the former may run in a signal handler
+    bool save_snapshot;
+    bool cache_mmap;
 
     Worker **workers;
     size_t worker_count;
     size_t last_assigned_worker;
+    AssignPolicy assign_policy;
+    uint32_t assign_seed;
 
     int running;
     int shutdown;
     
     int listenfd;
     struct sockaddr_in listen_addr;
+
+    // Every worker accepts from own SO_REUSEPORT socket, listenfd is unused
+    bool reuseport;
+    WorkerBackend worker_backend;
+
+    // Accept loop blocks on listenfd and shutdownfd
+    int epollfd;
+    int shutdownfd;
 };
 
 void _ServerLoop(void *arg);
 
+// Preloads files that would be cached when requested
+CacheWarmup *_StartCacheWarmup(Server *server, const ServerParams *params) {
+    size_t max_file_size = params->max_cache_entry_size;
+    if (params->warmup_max_file_size > 0 && params->warmup_max_file_size < max_file_size) {
+        max_file_size = params->warmup_max_file_size;
+    }
+    // Larger files are streamed, never cached
+    if (params->sendfile_threshold > 0 && params->sendfile_threshold <= max_file_size) {
+        max_file_size = params->sendfile_threshold - 1;
+    }
+
+    CacheWarmupParams warmup_params;
+    warmup_params.root = params->static_root;
+    warmup_params.manifest = params->warmup_manifest;
+    warmup_params.max_file_size = max_file_size;
+    warmup_params.max_memory = params->max_cache_size;
+    warmup_params.max_entries = params->max_cache_entries;
+    warmup_params.pool = server->reader_pool;
+    // Every reader is kept busy, leaving room in the pool for requests
+    warmup_params.parallel_reads = params->reader_count * 2;
+    if (warmup_params.parallel_reads > params->max_requests / 2) {
+        warmup_params.parallel_reads = params->max_requests / 2;
+    }
+    warmup_params.map_files = params->cache_mmap;
+
+    return CreateCacheWarmup(server->cache_manager, &warmup_params);
+}
+
 Server *CreateServer(const ServerParams *params) {
     LogInfo("Creating server...");
 
@@ -66,10 +122,20 @@ Server *CreateServer(const ServerParams *params) {
     server->running = 0;
     server->shutdown = 0;
     server->listenfd = -1;
+    server->epollfd = -1;
+    server->shutdownfd = -1;
 
     server->listen_addr.sin_family = AF_INET;
     server->listen_addr.sin_port = htons(params->port);
     server->listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    server->reuseport = params->reuseport;
+    server->assign_policy = params->assign_policy;
+    server->assign_seed = 2463534242u;
+    server->worker_backend = params->worker_backend;
+    server->cache_snapshot = params->cache_snapshot;
+    server->snapshot_bodies = params->snapshot_bodies;
+    server->save_snapshot = false;
+    server->cache_mmap = params->cache_mmap;
 
     LogInfoF("Server params: port=%d, workers=%zu", params->port, params->worker_count);
 
@@ -90,6 +156,9 @@ Server *CreateServer(const ServerParams *params) {
     cache_manager_params.max_memory = params->max_cache_size;
     cache_manager_params.max_entries = params->max_cache_entries;
     cache_manager_params.max_buffer_size = params->max_cache_entry_size;
+    cache_manager_params.policy = params->cache_policy;
+    cache_manager_params.shard_count = params->cache_shards;
+    cache_manager_params.storage = params->cache_storage;
 
     server->cache_manager = CreateCacheManager(&cache_manager_params);
     if (server->cache_manager == NULL) {
@@ -98,11 +167,28 @@ Server *CreateServer(const ServerParams *params) {
         free(server);
         return NULL;
     }
+
+    CacheWatcherParams cache_watcher_params;
+    cache_watcher_params.root = params->static_root;
+    cache_watcher_params.refresh_pool = params->cache_refresh ? server->reader_pool : NULL;
+    cache_watcher_params.map_files = params->cache_mmap;
+
+    server->cache_watcher = CreateCacheWatcher(server->cache_manager, &cache_watcher_params);
+    if (server->cache_watcher == NULL) {
+        LogWarn("Cached files won't be reloaded when they change on disk");
+    }
+
+    // Before warm-up, which then finds restored files cached already
+    if (server->cache_snapshot != NULL) {
+        CacheSnapshotStats snapshot_stats;
+        LoadCacheSnapshot(server->cache_manager, server->cache_snapshot, server->cache_mmap, &snapshot_stats);
+    }
     
     server->worker_count = params->worker_count;
     server->workers = malloc(sizeof(Worker *) * params->worker_count);
     if (server->workers == NULL) {
         LogError("malloc for workers failed");
+        DestroyCacheWatcher(server->cache_watcher);
         DestroyCacheManager(server->cache_manager);
         DestroyFileReaderPool(server->reader_pool);
         free(server);
@@ -113,8 +199,15 @@ Server *CreateServer(const ServerParams *params) {
         WorkerParams worker_params;
         worker_params.static_root = params->static_root;
         worker_params.max_requests = params->max_requests;
+        worker_params.backend = params->worker_backend;
+        worker_params.keepalive_timeout = params->keepalive_timeout;
+        worker_params.keepalive_max_requests = params->keepalive_max_requests;
+        worker_params.sendfile_threshold = params->sendfile_threshold;
         worker_params.cache_manager = server->cache_manager;
         worker_params.reader_pool = server->reader_pool;
+        // Without watcher nothing would ever replace outdated versions
+        worker_params.cache_refresh = params->cache_refresh && server->cache_watcher != NULL;
+        worker_params.cache_mmap = params->cache_mmap;
 
         Worker *worker = CreateWorker(&worker_params);
         if (worker == NULL) {
@@ -122,6 +215,7 @@ Server *CreateServer(const ServerParams *params) {
             for (size_t j = 0; j < i; j++) {
                 DestroyWorker(server->workers[j]);
             }
+            DestroyCacheWatcher(server->cache_watcher);
             DestroyCacheManager(server->cache_manager);
             DestroyFileReaderPool(server->reader_pool);
             free(server->workers);
@@ -132,6 +226,13 @@ Server *CreateServer(const ServerParams *params) {
         server->workers[i] = worker;
     }
 
+    if (params->cache_warmup) {
+        server->cache_warmup = _StartCacheWarmup(server, params);
+        if (server->cache_warmup == NULL) {
+            LogWarn("Cache starts cold, warm-up failed");
+        }
+    }
+
     LogInfo("Server created successfully");
     return server;
 }
@@ -147,9 +248,31 @@ void DestroyServer(Server *server) {
     if (server->listenfd != -1) {
         close(server->listenfd);
     }
+    if (server->epollfd != -1) {
+        close(server->epollfd);
+    }
+    if (server->shutdownfd != -1) {
+        close(server->shutdownfd);
+    }
+    // Reads it has in flight finish into cache
+    DestroyCacheWarmup(server->cache_warmup);
     for (size_t i = 0; i < server->worker_count; i++) {
         DestroyWorker(server->workers[i]);
     }
+    DestroyCacheWatcher(server->cache_watcher);
+    // Mapped files are mapped again on restore, their contents aren't needed
+    if (server->save_snapshot) {
+        CacheSnapshotStats snapshot_stats;
+        SaveCacheSnapshot(server->cache_manager, server->cache_snapshot,
+                          server->snapshot_bodies && !server->cache_mmap, &snapshot_stats);
+    }
+    CacheArenaStats arena;
+    if (GetCacheArenaUsage(server->cache_manager, &arena)) {
+        LogInfoF("Cache arena: %zu bytes mapped, %zu lost to size classes, %zu to free slab space "
+                 "(%zu slabs, %zu of them hugetlb, %zu large objects)",
+                 arena.reserved, arena.allocated - arena.requested, arena.reserved - arena.allocated,
+                 arena.slab_count, arena.hugetlb_slab_count, arena.large_count);
+    }
     DestroyCacheManager(server->cache_manager);
     DestroyFileReaderPool(server->reader_pool);
     free(server->workers);
@@ -158,6 +281,43 @@ void DestroyServer(Server *server) {
     LogInfo("Server destroyed");
 }
 
+// Returns bound listening socket or -1
+int _CreateListenSocket(Server *server, bool reuseport, bool nonblock) {
+    int flags = SOCK_STREAM | SOCK_CLOEXEC;
+    if (nonblock) {
+        flags |= SOCK_NONBLOCK;
+    }
+
+    int listenfd = socket(AF_INET, flags, 0);
+    if (listenfd == -1) {
+        LogError("socket() failed");
+        return -1;
+    }
+
+    int on = 1;
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        LogErrorF("setsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
+        close(listenfd);
+        return -1;
+    }
+
+    int result = bind(listenfd, (struct sockaddr *) &server->listen_addr, sizeof(server->listen_addr));
+    if (result == -1) {
+        LogError("bind() failed");
+        close(listenfd);
+        return -1;
+    }
+
+    result = listen(listenfd, SERVER_LISTEN_BACKLOG);
+    if (result == -1) {
+        LogError("listen() failed");
+        close(listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
 int StartServer(Server *server) {
     if (server == NULL) {
         LogError("StartServer: server == NULL");
@@ -173,26 +333,52 @@ int StartServer(Server *server) {
 
     LogInfo("Starting server...");
 
-    server->listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server->listenfd == -1) {
+    if (server->reuseport) {
+        // io_uring accept on non-blocking socket completes with -EAGAIN
+        bool nonblock = server->worker_backend != WORKER_BACKEND_IO_URING;
+        for (size_t i = 0; i < server->worker_count; i++) {
+            int listenfd = _CreateListenSocket(server, true, nonblock);
+            if (listenfd == -1) {
+                pthread_mutex_unlock(&server->mutex);
+                return ERR_SERVER_MEMORY;
+            }
+            if (SetWorkerListener(server->workers[i], listenfd) != ERR_OK) {
+                close(listenfd);
+                pthread_mutex_unlock(&server->mutex);
+                LogErrorF("Failed to set listener of worker #%zu", i);
+                return ERR_SERVER_MEMORY;
+            }
+        }
+    } else {
+        server->listenfd = _CreateListenSocket(server, false, true);
+        if (server->listenfd == -1) {
+            pthread_mutex_unlock(&server->mutex);
+            return ERR_SERVER_MEMORY;
+        }
+    }
+
+    server->shutdownfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->shutdownfd == -1 || server->epollfd == -1) {
         pthread_mutex_unlock(&server->mutex);
-        LogError("socket() failed");
+        LogErrorF("Failed to set up accept loop: %s", strerror(errno));
         return ERR_SERVER_MEMORY;
     }
 
-    fcntl(server->listenfd, F_SETFL, O_NONBLOCK);
-
-    int result = bind(server->listenfd, (struct sockaddr *) &server->listen_addr, sizeof(server->listen_addr));
-    if (result == -1) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = server->listenfd;
+    if (server->listenfd != -1 &&
+        epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->listenfd, &ev) == -1) {
         pthread_mutex_unlock(&server->mutex);
-        LogError("bind() failed");
+        LogErrorF("epoll_ctl(listenfd) failed: %s", strerror(errno));
         return ERR_SERVER_MEMORY;
     }
-
-    result = listen(server->listenfd, 1000);
-    if (result == -1) {
+    ev.data.fd = server->shutdownfd;
+    if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->shutdownfd, &ev) == -1) {
         pthread_mutex_unlock(&server->mutex);
-        LogError("listen() failed");
+        LogErrorF("epoll_ctl(shutdownfd) failed: %s", strerror(errno));
         return ERR_SERVER_MEMORY;
     }
 
@@ -214,6 +400,14 @@ int StartServer(Server *server) {
     return ERR_OK;
 }
 
+// Interrupts blocking wait of the accept loop
+void _WakeServerLoop(Server *server) {
+    uint64_t value = 1;
+    if (server->shutdownfd != -1 && write(server->shutdownfd, &value, sizeof(value)) == -1) {
+        LogErrorF("Failed to wake server loop: %s", strerror(errno));
+    }
+}
+
 int ShutdownServer(Server *server) {
     if (server == NULL) {
         LogError("ShutdownServer: server == NULL");
@@ -229,6 +423,7 @@ int ShutdownServer(Server *server) {
         return ERR_SERVER_NOT_RUNNING;
     }
     server->shutdown = 1;
+    _WakeServerLoop(server);
     pthread_mutex_unlock(&server->mutex);
 
     LogInfo("Waiting for listen to shutdown...");
@@ -237,7 +432,10 @@ int ShutdownServer(Server *server) {
     }
 
     pthread_mutex_lock(&server->mutex);
-    close(server->listenfd);
+    if (server->listenfd != -1) {
+        close(server->listenfd);
+        server->listenfd = -1;
+    }
     ShutdownFileReaderPool(server->reader_pool);
     for (size_t i = 0; i < server->worker_count; i++) {
         ShutdownWorker(server->workers[i]);
@@ -256,23 +454,170 @@ int GracefullyShutdownServer(Server *server) {
     }
     LogWarn("Graceful shutdown of server...");
     server->shutdown = true;
+    _WakeServerLoop(server);
 
-    
-    close(server->listenfd);
+    if (server->listenfd != -1) {
+        close(server->listenfd);
+        server->listenfd = -1;
+    }
     GracefullyShutdownFileReaderPool(server->reader_pool);
     for (size_t i = 0; i < server->worker_count; i++) {
         GracefullyShutdownWorker(server->workers[i]);
     }
+    server->save_snapshot = server->cache_snapshot != NULL;
     pthread_mutex_unlock(&server->mutex);
 
     LogInfo("Server stopped");
     return ERR_OK;
 }
 
+// Policies run only in accept loop, so their state needs no lock.
+// Worker load counters are read without worker locks and may be stale.
+
+size_t _PickRoundRobin(Server *server) {
+    size_t index = server->last_assigned_worker;
+    server->last_assigned_worker = (server->last_assigned_worker + 1) % server->worker_count;
+    return index;
+}
+
+size_t _PickLeastConnections(Server *server) {
+    size_t best = server->last_assigned_worker;
+    size_t best_load = GetWorkerRequestCount(server->workers[best]);
+    // Scan starts after last pick, so ties are spread round-robin
+    for (size_t i = 1; i < server->worker_count; i++) {
+        size_t index = (server->last_assigned_worker + i) % server->worker_count;
+        size_t load = GetWorkerRequestCount(server->workers[index]);
+        if (load < best_load) {
+            best = index;
+            best_load = load;
+        }
+    }
+    server->last_assigned_worker = (best + 1) % server->worker_count;
+    return best;
+}
+
+size_t _PickLeastBytes(Server *server) {
+    size_t best = server->last_assigned_worker;
+    size_t best_bytes = GetWorkerPendingBytes(server->workers[best]);
+    size_t best_load = GetWorkerRequestCount(server->workers[best]);
+    for (size_t i = 1; i < server->worker_count; i++) {
+        size_t index = (server->last_assigned_worker + i) % server->worker_count;
+        size_t bytes = GetWorkerPendingBytes(server->workers[index]);
+        size_t load = GetWorkerRequestCount(server->workers[index]);
+        if (bytes < best_bytes || (bytes == best_bytes && load < best_load)) {
+            best = index;
+            best_bytes = bytes;
+            best_load = load;
+        }
+    }
+    server->last_assigned_worker = (best + 1) % server->worker_count;
+    return best;
+}
+
+// xorshift32, quality is enough to pick candidates
+uint32_t _NextAssignRandom(Server *server) {
+    uint32_t x = server->assign_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    server->assign_seed = x;
+    return x;
+}
+
+size_t _PickPowerOfTwo(Server *server) {
+    if (server->worker_count == 1) return 0;
+
+    size_t first = _NextAssignRandom(server) % server->worker_count;
+    size_t second = _NextAssignRandom(server) % (server->worker_count - 1);
+    if (second >= first) second++;
+
+    size_t first_load = GetWorkerRequestCount(server->workers[first]);
+    size_t second_load = GetWorkerRequestCount(server->workers[second]);
+    return second_load < first_load ? second : first;
+}
+
+typedef size_t (*AssignPolicyFn)(Server *server);
+
+static const struct {
+    const char *name;
+    AssignPolicyFn pick;
+} ASSIGN_POLICIES[] = {
+    [ASSIGN_POLICY_ROUND_ROBIN] = {"round-robin", _PickRoundRobin},
+    [ASSIGN_POLICY_LEAST_CONNECTIONS] = {"least-conn", _PickLeastConnections},
+    [ASSIGN_POLICY_LEAST_BYTES] = {"least-bytes", _PickLeastBytes},
+    [ASSIGN_POLICY_POWER_OF_TWO] = {"p2c", _PickPowerOfTwo},
+};
+
+const char *AssignPolicyName(AssignPolicy policy) {
+    if ((size_t) policy >= sizeof(ASSIGN_POLICIES) / sizeof(ASSIGN_POLICIES[0])) {
+        return "unknown";
+    }
+    return ASSIGN_POLICIES[policy].name;
+}
+
+// Hands connection to worker chosen by policy. If that worker is full,
+// the rest are tried in order before giving up.
+int _AssignConnection(Server *server, int clientfd) {
+    size_t chosen = ASSIGN_POLICIES[server->assign_policy].pick(server);
+
+    for (size_t i = 0; i < server->worker_count; i++) {
+        size_t index = (chosen + i) % server->worker_count;
+        LogDebugF("Assigning client fd=%d to worker #%zu", clientfd, index);
+
+        int result = AddRequest(server->workers[index], clientfd);
+        if (result == ERR_OK) {
+            return ERR_OK;
+        }
+        if (result != ERR_WORKER_MAX_REQUESTS_EXCEEDED) {
+            return result;
+        }
+    }
+
+    return ERR_WORKER_MAX_REQUESTS_EXCEEDED;
+}
+
+// Accepts whole backlog of pending connections.
+// Returns ERR_OK or ERR_SERVER_SHUTDOWN if listening socket failed.
+int _AcceptConnections(Server *server) {
+    // io_uring workers take blocking sockets, see AddRequest
+    int flags = SOCK_CLOEXEC;
+    if (server->worker_backend != WORKER_BACKEND_IO_URING) {
+        flags |= SOCK_NONBLOCK;
+    }
+    while (1) {
+        int clientfd = accept4(server->listenfd, NULL, NULL, flags);
+        if (clientfd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return ERR_OK;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // Backlog stays readable, back off instead of spinning
+                LogWarnF("accept4() failed: %s", strerror(errno));
+                usleep(SERVER_SLEEP_TIME);
+                return ERR_OK;
+            }
+            LogErrorF("accept4() failed: %s", strerror(errno));
+            return ERR_SERVER_SHUTDOWN;
+        }
+
+        LogDebugF("New client connected: fd=%d", clientfd);
+
+        if (_AssignConnection(server, clientfd) != ERR_OK) {
+            LogWarnF("No worker accepted fd=%d, closing connection", clientfd);
+            close(clientfd);
+        }
+    }
+}
+
 void _ServerLoop(void *arg) {
     Server *server = (Server *)arg;
     LogInfo("Entering server loop");
 
+    struct epoll_event events[2];
+
     while (1) {
         pthread_mutex_lock(&server->mutex);
         if (server->shutdown) {
@@ -282,36 +627,29 @@ void _ServerLoop(void *arg) {
             break;
         }
         pthread_mutex_unlock(&server->mutex);
-        int clientfd = accept(server->listenfd, NULL, NULL);
-        if (clientfd == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(SERVER_SLEEP_TIME);
-                continue;
-            }
-            LogErrorF("accept() failed: %s", strerror(errno));
+
+        int ready = epoll_wait(server->epollfd, events, 2, -1);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+
+            LogErrorF("epoll_wait() failed: %s", strerror(errno));
             server->running = 0;
             break;
         }
-        pthread_mutex_lock(&server->mutex);
-
-        LogDebugF("New client connected: fd=%d", clientfd);
-
-        fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK);
-
-        Worker *worker = server->workers[server->last_assigned_worker];
-        LogDebugF("Assigning client fd=%d to worker #%zu", clientfd, server->last_assigned_worker);
-
-        server->last_assigned_worker = (server->last_assigned_worker + 1) % server->worker_count;
 
-        int result = AddRequest(worker, clientfd);
-        if (result != ERR_OK) {
-            LogWarnF("AddRequest failed for fd=%d, closing connection", clientfd);
-            close(clientfd);
-            pthread_mutex_unlock(&server->mutex);
-            continue;
+        bool accept_ready = false;
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.fd == server->listenfd) {
+                accept_ready = true;
+            }
         }
+        // Shutdown wakeup is handled by the check at the top of loop
+        if (!accept_ready) continue;
 
-        pthread_mutex_unlock(&server->mutex);
+        if (_AcceptConnections(server) != ERR_OK) {
+            server->running = 0;
+            break;
+        }
     }
 
     LogInfo("Exiting server loop");
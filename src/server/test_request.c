@@ -0,0 +1,122 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "server/request.h"
+#include "server/errors.h"
+
+// Appends bytes as if they were read from the socket
+int test_request_read(HttpRequest *request, const char *bytes)
+{
+    char *to;
+    size_t upto;
+    size_t size = strlen(bytes);
+    ck_assert_int_eq(GetRequestReadBuffer(request, &to, &upto), ERR_OK);
+    ck_assert_uint_ge(upto, size);
+    memcpy(to, bytes, size);
+    return CommitRequestRead(request, size);
+}
+
+// Request with a complete head, parsed
+HttpRequest *test_parsed_request(const char *bytes)
+{
+    HttpRequest *request = CreateHttpRequest(-1);
+    ck_assert_ptr_nonnull(request);
+    ck_assert_int_eq(test_request_read(request, bytes), ERR_REQUEST_READ_END);
+    ck_assert_int_eq(ParseHttpRequest(request), ERR_OK);
+    return request;
+}
+
+START_TEST(test_request_keep_alive_defaults)
+{
+    HttpRequest *request = test_parsed_request("GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    ck_assert_str_eq(request->parsed_request->path->data, "/index.html");
+    ck_assert_str_eq(request->parsed_request->host->data, "localhost");
+    ck_assert(request->parsed_request->keep_alive);
+    DestroyHttpRequest(request);
+
+    request = test_parsed_request("GET /index.html HTTP/1.0\r\n\r\n");
+    ck_assert(!request->parsed_request->keep_alive);
+    DestroyHttpRequest(request);
+}
+END_TEST
+
+START_TEST(test_request_connection_header)
+{
+    HttpRequest *request = test_parsed_request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ck_assert(!request->parsed_request->keep_alive);
+    DestroyHttpRequest(request);
+
+    // Header name and value are matched regardless of case
+    request = test_parsed_request("HEAD / HTTP/1.0\r\nconnection: Keep-Alive\r\n\r\n");
+    ck_assert_int_eq(request->parsed_request->method, HTTP_REQUEST_HEAD);
+    ck_assert(request->parsed_request->keep_alive);
+    DestroyHttpRequest(request);
+}
+END_TEST
+
+START_TEST(test_request_head_split_across_reads)
+{
+    HttpRequest *request = CreateHttpRequest(-1);
+    ck_assert_int_eq(test_request_read(request, "GET /a HTTP/1.1\r\n\r"), ERR_OK);
+    ck_assert_uint_eq(request->raw_request->head_size, 0);
+    ck_assert_int_eq(test_request_read(request, "\n"), ERR_REQUEST_READ_END);
+    ck_assert_int_eq(ParseHttpRequest(request), ERR_OK);
+    ck_assert_str_eq(request->parsed_request->path->data, "/a");
+    DestroyHttpRequest(request);
+}
+END_TEST
+
+START_TEST(test_request_pipelined_kept_across_reset)
+{
+    HttpRequest *request = test_parsed_request("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.0\r\n\r\n");
+    ck_assert_str_eq(request->parsed_request->path->data, "/a");
+    ck_assert(request->parsed_request->keep_alive);
+    ck_assert(HasPipelinedRequest(request));
+
+    // Second request is already complete in the buffer
+    ck_assert_int_eq(ResetHttpRequest(request), ERR_REQUEST_READ_END);
+    ck_assert_int_eq(request->state, HTTP_STATE_READ);
+    ck_assert_ptr_null(request->parsed_request);
+    ck_assert(!HasPipelinedRequest(request));
+    ck_assert_int_eq(ParseHttpRequest(request), ERR_OK);
+    ck_assert_str_eq(request->parsed_request->path->data, "/b");
+    ck_assert(!request->parsed_request->keep_alive);
+
+    ck_assert_int_eq(ResetHttpRequest(request), ERR_OK);
+    ck_assert_uint_eq(request->raw_request->request_buffer->size, 0);
+    DestroyHttpRequest(request);
+}
+END_TEST
+
+START_TEST(test_request_partial_pipelined)
+{
+    HttpRequest *request = test_parsed_request("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\nHost: loc");
+    ck_assert(!HasPipelinedRequest(request));
+
+    // Partial head is kept until the rest of it arrives
+    ck_assert_int_eq(ResetHttpRequest(request), ERR_OK);
+    ck_assert_uint_eq(request->raw_request->head_size, 0);
+    ck_assert_int_eq(test_request_read(request, "alhost\r\n\r\n"), ERR_REQUEST_READ_END);
+    ck_assert_int_eq(ParseHttpRequest(request), ERR_OK);
+    ck_assert_str_eq(request->parsed_request->path->data, "/b");
+    ck_assert_str_eq(request->parsed_request->host->data, "localhost");
+    DestroyHttpRequest(request);
+}
+END_TEST
+
+Suite *request_suite(void)
+{
+    Suite *s = suite_create("Request");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_request_keep_alive_defaults);
+    tcase_add_test(tc_core, test_request_connection_header);
+    tcase_add_test(tc_core, test_request_head_split_across_reads);
+    tcase_add_test(tc_core, test_request_pipelined_kept_across_reset);
+    tcase_add_test(tc_core, test_request_partial_pipelined);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
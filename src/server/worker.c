@@ -4,6 +4,7 @@
 #include "server/request.h"
 #include "server/errors.h"
 #include "utils/strutils.h"
+#include "utils/uring.h"
 #include "utils/log.h"
 
 #include <stdlib.h>
@@ -13,14 +14,104 @@
 #include <pthread.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 
-static const struct timespec PSELECT_TIMEOUT = {0, 2000};
+
+#define EPOLL_MAX_EVENTS 256
+
+// Idle connections are checked once per interval while any are open
+static const struct timespec IDLE_SWEEP_INTERVAL = {1, 0};
+
+#define URING_MAX_ENTRIES 4096
+// Cache-miss file is read in chunks of this size, each published to the
+// response as soon as it is read
+#define URING_FILE_CHUNK_SIZE (1024 * 1024)
+// Chunk buffer of connection streaming uncached file body
+#define URING_STREAM_CHUNK_SIZE (256 * 1024)
 
 typedef struct HttpRequestListEntry HttpRequestListEntry;
+typedef struct ReadFileCallbackData ReadFileCallbackData;
+
+typedef enum {
+    URING_OP_SOCKET,
+    URING_OP_FILE,
+    URING_OP_WAKE,
+    URING_OP_ACCEPT,
+    URING_OP_STREAM
+} UringOpType;
+
+// Passed as io_uring user_data, identifies completed operation
+typedef struct {
+    UringOpType type;
+    HttpRequestListEntry *entry;
+} UringOp;
+
+typedef struct {
+    UringOp op;
+    int fd;
+    WriteBuffer *buffer;
+    size_t size;
+    size_t done;
+} UringFileRead;
 
 struct HttpRequestListEntry {
     HttpRequest *request;
+    HttpRequestListEntry *prev;
     HttpRequestListEntry *next;
+
+    // epoll events the socket is currently registered with (0 - not registered)
+    uint32_t events;
+
+    // Part of worker pending_bytes accounted to this request
+    size_t charged_bytes;
+
+    // Keep-alive: responses already sent and time of last socket read
+    size_t served;
+    time_t last_active;
+
+    // Load of cache buffer the response being sent waits for: own read
+    // on the reader pool or other request's load it is attached to
+    ReadFileCallbackData *body_read;
+
+    // io_uring engine: in-flight recv/send and cache-miss file read
+    UringOp socket_op;
+    bool socket_op_pending;
+    UringFileRead *file_read;
+    // Gathered responses of in-flight send
+    struct msghdr send_msg;
+    struct iovec send_iov[RESPONSE_MAX_IOV];
+    // File body is read into chunk and sent from it, one chunk at a time
+    UringOp stream_op;
+    bool stream_pending;
+    char *stream_chunk;
+    size_t stream_len;
+    size_t stream_sent;
+};
+
+// Progress of file read, handed from reader thread back to the worker loop
+struct ReadFileCallbackData {
+    Worker *worker;
+    // Touched by worker thread only, NULL once request is gone
+    HttpRequestListEntry *entry;
+    // Claimed buffer being read, NULL if waiting for other's load
+    WriteBuffer *buffer;
+    BufferWaiter waiter;
+
+    // Guarded by done_reads_mutex
+    int error;
+    bool finished;
+    bool listed;
+    ReadFileCallbackData *next;
+
+    // Taken by worker loop together with the list, reader may push
+    // the notification again meanwhile
+    int seen_error;
+    bool seen_finished;
+    ReadFileCallbackData *seen_next;
 };
 
 HttpRequestListEntry *_CreateRequestEntry(HttpRequest *request, HttpRequestListEntry *next) {
@@ -32,12 +123,20 @@ HttpRequestListEntry *_CreateRequestEntry(HttpRequest *request, HttpRequestListE
     memset(entry, 0, sizeof(HttpRequestListEntry));
     entry->request = request;
     entry->next = next;
+    if (next != NULL) {
+        next->prev = entry;
+    }
     return entry;
 }
 
 void _DestroyRequestEntry(HttpRequestListEntry *entry) {
     if (entry == NULL) return;
+    if (entry->body_read != NULL) {
+        // Reader keeps filling the buffer, its notifications are dropped
+        entry->body_read->entry = NULL;
+    }
     DestroyHttpRequest(entry->request);
+    free(entry->stream_chunk);
     free(entry);
 }
 
@@ -46,10 +145,42 @@ struct Worker {
     char *static_root;
 
     size_t max_requests;
+    // Written under mutex, read without it by connection assignment
     size_t current_requests;
+    size_t pending_bytes;
     HttpRequestListEntry *requests;
     pthread_cond_t not_empty;
 
+    WorkerBackend backend;
+    int epollfd;
+    Uring *ring;
+
+    unsigned keepalive_timeout;
+    size_t keepalive_max_requests;
+    time_t next_idle_sweep;
+
+    size_t sendfile_threshold;
+    bool cache_refresh;
+    bool cache_mmap;
+
+    // Signalled when loop has new work: added request, finished file read
+    // or shutdown. Loop blocks without timeout until it is readable.
+    int wakefd;
+    uint64_t wake_value;
+    UringOp wake_op;
+    bool wake_pending;
+
+    // Own SO_REUSEPORT listening socket (-1 - requests come from AddRequest)
+    int listenfd;
+    bool listener_watched;
+    UringOp accept_op;
+    bool accept_pending;
+
+    // Guarded by done_reads_mutex, not by mutex: reader threads
+    // push here while holding reader pool lock.
+    pthread_mutex_t done_reads_mutex;
+    ReadFileCallbackData *done_reads;
+
     CacheManager *cache_manager;
     FileReaderPool *reader_pool;
 
@@ -93,14 +224,76 @@ Worker *CreateWorker(const WorkerParams *params) {
 
     worker->static_root = static_root;
     worker->max_requests = params->max_requests;
+    worker->backend = params->backend;
+    worker->keepalive_timeout = params->keepalive_timeout;
+    worker->keepalive_max_requests = params->keepalive_max_requests;
+    worker->sendfile_threshold = params->sendfile_threshold;
+    worker->cache_refresh = params->cache_refresh;
+    worker->cache_mmap = params->cache_mmap;
     worker->cache_manager = params->cache_manager;
     worker->reader_pool = params->reader_pool;
+    worker->epollfd = -1;
+    worker->listenfd = -1;
+
+    // io_uring reads of non-blocking eventfd complete with -EAGAIN
+    int wake_flags = EFD_CLOEXEC;
+    if (worker->backend != WORKER_BACKEND_IO_URING) {
+        wake_flags |= EFD_NONBLOCK;
+    }
+    worker->wakefd = eventfd(0, wake_flags);
+    if (worker->wakefd == -1) {
+        LogErrorF("eventfd() failed: %s", strerror(errno));
+        free(static_root);
+        free(worker);
+        return NULL;
+    }
+
+    if (worker->backend == WORKER_BACKEND_EPOLL) {
+        worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (worker->epollfd == -1) {
+            LogErrorF("epoll_create1() failed: %s", strerror(errno));
+            close(worker->wakefd);
+            free(static_root);
+            free(worker);
+            return NULL;
+        }
+
+        // Wakeup is told apart from requests by NULL data
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->wakefd, &ev) == -1) {
+            LogErrorF("epoll_ctl() failed: %s", strerror(errno));
+            close(worker->epollfd);
+            close(worker->wakefd);
+            free(static_root);
+            free(worker);
+            return NULL;
+        }
+    }
+
+    if (worker->backend == WORKER_BACKEND_IO_URING) {
+        // Each connection has at most one socket and one file operation in flight
+        size_t entries = worker->max_requests * 2;
+        if (entries > URING_MAX_ENTRIES) entries = URING_MAX_ENTRIES;
+        worker->ring = CreateUring(entries + 1);
+        if (worker->ring == NULL) {
+            LogErrorF("io_uring setup failed: %s", strerror(errno));
+            close(worker->wakefd);
+            free(static_root);
+            free(worker);
+            return NULL;
+        }
+    }
 
     pthread_mutex_init(&worker->mutex, NULL);
+    pthread_mutex_init(&worker->done_reads_mutex, NULL);
     pthread_cond_init(&worker->not_empty, NULL);
 
-    LogInfoF("Worker created: max_requests=%zu, static_root=%s",
-             worker->max_requests, worker->static_root);
+    LogInfoF("Worker created: max_requests=%zu, static_root=%s, backend=%s",
+             worker->max_requests, worker->static_root,
+             WorkerBackendName(worker->backend));
 
     return worker;
 }
@@ -116,13 +309,29 @@ void DestroyWorker(Worker *worker) {
     HttpRequestListEntry *entry = worker->requests;
     while (entry != NULL) {
         HttpRequestListEntry *next = entry->next;
-        DestroyHttpRequest(entry->request);
-        free(entry);
+        _DestroyRequestEntry(entry);
         entry = next;
     }
 
+    ReadFileCallbackData *done = worker->done_reads;
+    while (done != NULL) {
+        ReadFileCallbackData *next = done->next;
+        free(done);
+        done = next;
+    }
+
+    if (worker->epollfd != -1) {
+        close(worker->epollfd);
+    }
+    DestroyUring(worker->ring);
+    close(worker->wakefd);
+    if (worker->listenfd != -1) {
+        close(worker->listenfd);
+    }
+
     free(worker->static_root);
     pthread_mutex_destroy(&worker->mutex);
+    pthread_mutex_destroy(&worker->done_reads_mutex);
     pthread_cond_destroy(&worker->not_empty);
     free(worker);
 
@@ -151,6 +360,22 @@ int StartWorker(Worker *worker) {
     return ERR_OK;
 }
 
+// Interrupts blocking wait of the worker loop
+void _WakeWorker(Worker *worker) {
+    uint64_t value = 1;
+    if (write(worker->wakefd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        LogErrorF("Failed to wake worker: %s", strerror(errno));
+    }
+}
+
+// Clears pending wakeups, eventfd must be readable
+void _DrainWakeups(Worker *worker) {
+    uint64_t value;
+    if (read(worker->wakefd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        LogErrorF("Failed to read worker wakeup: %s", strerror(errno));
+    }
+}
+
 int GracefullyShutdownWorker(Worker *worker) {
     if (worker == NULL) {
         LogError("worker == NULL");
@@ -167,6 +392,7 @@ int GracefullyShutdownWorker(Worker *worker) {
     LogInfo("Graceful shutdown of worker...");
     worker->shutdown = true;
     pthread_cond_signal(&worker->not_empty);
+    _WakeWorker(worker);
     pthread_mutex_unlock(&worker->mutex);
 
     pthread_join(worker->thread, NULL);
@@ -175,6 +401,23 @@ int GracefullyShutdownWorker(Worker *worker) {
     return ERR_OK;
 }
 
+int _ErrorRequest(Worker *worker, HttpRequestListEntry *entry);
+
+// Worker must be already locked up to this point.
+void _UringShutdownRequests(Worker *worker) {
+    HttpRequestListEntry *entry = worker->requests;
+    while (entry != NULL) {
+        HttpRequestListEntry *next = entry->next;
+        entry->request->state = HTTP_STATE_ERROR;
+        if (entry->socket_op_pending || entry->file_read != NULL || entry->stream_pending) {
+            shutdown(entry->request->socketfd, SHUT_RDWR);
+        } else {
+            _ErrorRequest(worker, entry);
+        }
+        entry = next;
+    }
+}
+
 int ShutdownWorker(Worker *worker) {
     if (worker == NULL) {
         LogError("worker == NULL");
@@ -192,12 +435,22 @@ int ShutdownWorker(Worker *worker) {
     worker->shutdown = true;
     pthread_cond_signal(&worker->not_empty);
 
-    HttpRequestListEntry *entry = worker->requests;
-    while (entry != NULL) {
-        HttpRequestListEntry *next = entry->next;
-        _DestroyRequestEntry(entry);
-        entry = next;
+    if (worker->backend == WORKER_BACKEND_IO_URING) {
+        // Kernel may still write into request buffers, so entries are left to
+        // the worker loop: shut sockets down to complete in-flight operations
+        _UringShutdownRequests(worker);
+    } else {
+        HttpRequestListEntry *entry = worker->requests;
+        while (entry != NULL) {
+            HttpRequestListEntry *next = entry->next;
+            _DestroyRequestEntry(entry);
+            entry = next;
+        }
+        worker->requests = NULL;
+        __atomic_store_n(&worker->current_requests, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&worker->pending_bytes, 0, __ATOMIC_RELAXED);
     }
+    _WakeWorker(worker);
 
     pthread_mutex_unlock(&worker->mutex);
 
@@ -207,44 +460,64 @@ int ShutdownWorker(Worker *worker) {
     return ERR_OK;
 }
 
-int AddRequest(Worker *worker, int socketfd) {
-    if (worker == NULL) {
-        LogError("AddRequest: worker == NULL");
-        return ERR_WORKER_NOT_RUNNING;
-    }
+int _ConnectRequest(Worker *worker, HttpRequestListEntry *entry);
+int _WatchRequest(Worker *worker, HttpRequestListEntry *entry);
 
-    pthread_mutex_lock(&worker->mutex);
+time_t _MonotonicSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
 
+// Worker must be already locked up to this point.
+int _AddRequest(Worker *worker, int socketfd) {
     if (worker->shutdown) {
-        pthread_mutex_unlock(&worker->mutex);
         LogWarnF("Worker shutting down, cannot accept new request (fd=%d)", socketfd);
         return ERR_WORKER_SHUTDOWN;
     }
 
     if (worker->current_requests >= worker->max_requests) {
-        pthread_mutex_unlock(&worker->mutex);
         LogWarnF("Worker request limit exceeded (%zu/%zu), rejecting fd=%d",
                  worker->current_requests, worker->max_requests, socketfd);
         return ERR_WORKER_MAX_REQUESTS_EXCEEDED;
     }
 
+    // fd_set can't hold descriptors above FD_SETSIZE
+    if (worker->backend == WORKER_BACKEND_PSELECT && socketfd >= FD_SETSIZE) {
+        LogWarnF("fd=%d exceeds FD_SETSIZE, rejecting (use epoll backend)", socketfd);
+        return ERR_WORKER_MAX_REQUESTS_EXCEEDED;
+    }
+
     HttpRequest *request = CreateHttpRequest(socketfd);
     if (request == NULL) {
-        pthread_mutex_unlock(&worker->mutex);
         LogErrorF("Failed to create HttpRequest for fd=%d", socketfd);
         return ERR_WORKER_MEMORY;
     }
+    // io_uring reads file bodies into a chunk to send, mapped data is sent
+    // directly instead
+    request->sendfile_buffers = worker->backend != WORKER_BACKEND_IO_URING;
 
     HttpRequestListEntry *entry = _CreateRequestEntry(request, worker->requests);
     if (entry == NULL) {
         DestroyHttpRequest(request);
-        pthread_mutex_unlock(&worker->mutex);
         LogError("Failed to allocate request list entry");
         return ERR_WORKER_MEMORY;
     }
 
+    if (worker->backend == WORKER_BACKEND_EPOLL) {
+        _ConnectRequest(worker, entry);
+        if (_WatchRequest(worker, entry) != ERR_OK) {
+            if (entry->next != NULL) {
+                entry->next->prev = NULL;
+            }
+            _DestroyRequestEntry(entry);
+            return ERR_WORKER_POLL_ERROR;
+        }
+    }
+
+    entry->last_active = _MonotonicSeconds();
     worker->requests = entry;
-    worker->current_requests++;
+    __atomic_store_n(&worker->current_requests, worker->current_requests + 1, __ATOMIC_RELAXED);
 
     LogDebugF("Added request fd=%d (total=%zu)", socketfd, worker->current_requests);
 
@@ -252,10 +525,85 @@ int AddRequest(Worker *worker, int socketfd) {
         pthread_cond_signal(&worker->not_empty);
     }
 
+    return ERR_OK;
+}
+
+int AddRequest(Worker *worker, int socketfd) {
+    if (worker == NULL) {
+        LogError("AddRequest: worker == NULL");
+        return ERR_WORKER_NOT_RUNNING;
+    }
+
+    pthread_mutex_lock(&worker->mutex);
+
+    int err = _AddRequest(worker, socketfd);
+
+    // epoll already watches the socket, other loops have to rebuild wait set
+    if (err == ERR_OK && worker->backend != WORKER_BACKEND_EPOLL) {
+        _WakeWorker(worker);
+    }
+
+    pthread_mutex_unlock(&worker->mutex);
+    return err;
+}
+
+int SetWorkerListener(Worker *worker, int listenfd) {
+    if (worker == NULL) {
+        LogError("SetWorkerListener: worker == NULL");
+        return ERR_WORKER_NOT_RUNNING;
+    }
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->running) {
+        pthread_mutex_unlock(&worker->mutex);
+        LogWarn("SetWorkerListener: worker already running");
+        return ERR_WORKER_ALREADY_RUNNING;
+    }
+
+    if (worker->backend == WORKER_BACKEND_PSELECT && listenfd >= FD_SETSIZE) {
+        pthread_mutex_unlock(&worker->mutex);
+        LogErrorF("Listener fd=%d exceeds FD_SETSIZE", listenfd);
+        return ERR_WORKER_POLL_ERROR;
+    }
+
+    if (worker->backend == WORKER_BACKEND_EPOLL) {
+        // Listener is told apart from requests by pointer to listenfd
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &worker->listenfd;
+        if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, listenfd, &ev) == -1) {
+            pthread_mutex_unlock(&worker->mutex);
+            LogErrorF("epoll_ctl(listenfd) failed: %s", strerror(errno));
+            return ERR_WORKER_POLL_ERROR;
+        }
+        worker->listener_watched = true;
+    }
+
+    worker->listenfd = listenfd;
     pthread_mutex_unlock(&worker->mutex);
+
+    LogDebugF("Worker listens on fd=%d", listenfd);
     return ERR_OK;
 }
 
+const char *WorkerBackendName(WorkerBackend backend) {
+    switch (backend) {
+        case WORKER_BACKEND_PSELECT: return "pselect";
+        case WORKER_BACKEND_EPOLL: return "epoll";
+        case WORKER_BACKEND_IO_URING: return "io_uring";
+    }
+    return "unknown";
+}
+
+size_t GetWorkerRequestCount(Worker *worker) {
+    return __atomic_load_n(&worker->current_requests, __ATOMIC_RELAXED);
+}
+
+size_t GetWorkerPendingBytes(Worker *worker) {
+    return __atomic_load_n(&worker->pending_bytes, __ATOMIC_RELAXED);
+}
+
 pthread_t GetWorkerThread(Worker *worker) {
     if (worker == NULL) return (pthread_t) NULL;
     pthread_mutex_lock(&worker->mutex);
@@ -268,18 +616,83 @@ pthread_t GetWorkerThread(Worker *worker) {
 //  Main Worker Loop
 // ─────────────────────────────────────────────────────────────
 
-int _ConnectRequest(Worker *worker, HttpRequest *request);
-int _ReadRequest(Worker *worker, HttpRequest *request);
-int _ProcessRequest(Worker *worker, HttpRequest *request);
-int _WriteRequest(Worker *worker, HttpRequest *request);
-int _DeleteRequest(Worker *worker, HttpRequest *request);
-int _DoneRequest(Worker *worker, HttpRequest *request);
-int _ErrorRequest(Worker *worker, HttpRequest *request);
+int _ReadRequest(Worker *worker, HttpRequestListEntry *entry);
+int _ProcessRequest(Worker *worker, HttpRequestListEntry *entry);
+int _LoadFileRequest(Worker *worker, HttpRequestListEntry *entry, ReadBuffer *buffer, WriteBuffer *wb);
+int _WaitFileRequest(Worker *worker, HttpRequestListEntry *entry, ReadBuffer *buffer);
+int _WriteRequest(Worker *worker, HttpRequestListEntry *entry);
+int _DeleteRequest(Worker *worker, HttpRequestListEntry *entry);
+void _ChargeRequest(Worker *worker, HttpRequestListEntry *entry);
+void _KeepAliveRequest(Worker *worker, HttpRequestListEntry *entry);
+void _PipelineRequests(Worker *worker, HttpRequestListEntry *entry);
+void _SweepIdleRequests(Worker *worker);
+const struct timespec *_IdleWaitTimeout(Worker *worker);
+int _DoneRequest(Worker *worker, HttpRequestListEntry *entry);
+int _ErrorRequest(Worker *worker, HttpRequestListEntry *entry);
+void _CompleteReads(Worker *worker);
+void _FinishRead(Worker *worker, HttpRequestListEntry *entry, int error);
+
+void *_WorkerLoopPselect(Worker *worker);
+void *_WorkerLoopEpoll(Worker *worker);
+void *_WorkerLoopUring(Worker *worker);
+
+// Worker must be already locked up to this point.
+// Accepts pending connections of the worker's own listener.
+void _AcceptRequests(Worker *worker) {
+    while (1) {
+        int clientfd = accept4(worker->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LogWarnF("accept4() failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        LogDebugF("New client connected: fd=%d", clientfd);
+        if (_AddRequest(worker, clientfd) != ERR_OK) {
+            LogWarnF("AddRequest failed for fd=%d, closing connection", clientfd);
+            close(clientfd);
+        }
+    }
+}
 
 void *_WorkerLoop(void *arg) {
     Worker *worker = arg;
     LogInfo("Worker loop started");
 
+    void *result;
+    if (worker->backend == WORKER_BACKEND_EPOLL) {
+        result = _WorkerLoopEpoll(worker);
+    } else if (worker->backend == WORKER_BACKEND_IO_URING) {
+        result = _WorkerLoopUring(worker);
+    } else {
+        result = _WorkerLoopPselect(worker);
+    }
+
+    LogInfo("Worker loop exited");
+    return result;
+}
+
+// Worker must be already locked up to this point.
+// Closes or keeps alive request whose response is done, or that failed.
+void _SettleRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *r = entry->request;
+    if (r->state == HTTP_STATE_DONE) {
+        _KeepAliveRequest(worker, entry);
+    }
+    _ChargeRequest(worker, entry);
+
+    if (r->state == HTTP_STATE_DONE) {
+        LogInfoF("Request fd=%d completed", r->socketfd);
+        _DoneRequest(worker, entry);
+    } else if (r->state == HTTP_STATE_ERROR) {
+        LogWarnF("Request fd=%d completed with ERROR", r->socketfd);
+        _ErrorRequest(worker, entry);
+    }
+}
+
+void *_WorkerLoopPselect(Worker *worker) {
     fd_set read_fds;
     fd_set write_fds;
     int max_fd = 0;
@@ -293,7 +706,8 @@ void *_WorkerLoop(void *arg) {
             break;
         }
 
-        if (worker->current_requests == 0) {
+        // Worker with own listener waits for connections in its poll
+        if (worker->current_requests == 0 && worker->listenfd == -1) {
             pthread_cond_wait(&worker->not_empty, &worker->mutex);
         }
 
@@ -302,21 +716,40 @@ void *_WorkerLoop(void *arg) {
             break;
         }
 
+        _CompleteReads(worker);
+        // Failed reads leave requests in ERROR, no fd_set waits for them
+        HttpRequestListEntry *entry = worker->requests;
+        while (entry != NULL) {
+            HttpRequestListEntry *next = entry->next;
+            _SettleRequest(worker, entry);
+            entry = next;
+        }
+        _SweepIdleRequests(worker);
+        if (worker->shutdown && worker->current_requests == 0) {
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
+
         FD_ZERO(&read_fds);
         FD_ZERO(&write_fds);
-        max_fd = 0;
+        FD_SET(worker->wakefd, &read_fds);
+        max_fd = worker->wakefd;
+        if (worker->listenfd != -1 && !worker->shutdown) {
+            FD_SET(worker->listenfd, &read_fds);
+            if (worker->listenfd > max_fd) max_fd = worker->listenfd;
+        }
 
-        HttpRequestListEntry *entry = worker->requests;
+        entry = worker->requests;
 
         while (entry != NULL) {
             HttpRequest *r = entry->request;
 
-            switch (r->state) {
-                case HTTP_STATE_CONNECT:
-                    LogDebugF("fd=%d state=CONNECT", r->socketfd);
-                    _ConnectRequest(worker, r);
-                    break;
+            if (r->state == HTTP_STATE_CONNECT) {
+                LogDebugF("fd=%d state=CONNECT", r->socketfd);
+                _ConnectRequest(worker, entry);
+            }
 
+            switch (r->state) {
                 case HTTP_STATE_READ:
                     FD_SET(r->socketfd, &read_fds);
                     if (r->socketfd > max_fd) max_fd = r->socketfd;
@@ -327,6 +760,14 @@ void *_WorkerLoop(void *arg) {
                     if (r->socketfd > max_fd) max_fd = r->socketfd;
                     break;
 
+                case HTTP_STATE_WAITING_FOR_BODY:
+                    // Earlier pipelined responses are sent meanwhile
+                    if (r->queued_responses != NULL) {
+                        FD_SET(r->socketfd, &write_fds);
+                        if (r->socketfd > max_fd) max_fd = r->socketfd;
+                    }
+                    break;
+
                 default:
                     break;
             }
@@ -334,166 +775,906 @@ void *_WorkerLoop(void *arg) {
             entry = entry->next;
         }
 
+        const struct timespec *timeout = _IdleWaitTimeout(worker);
+
         pthread_mutex_unlock(&worker->mutex);
 
-        int ready = pselect(max_fd + 1, &read_fds, &write_fds, NULL,
-                            &PSELECT_TIMEOUT, NULL);
+        int ready = pselect(max_fd + 1, &read_fds, &write_fds, NULL, timeout, NULL);
 
         if (ready == -1) {
             if (errno == EINTR) continue;
+            // Sockets from the wait set may have been closed by ShutdownWorker
+            if (errno == EBADF && worker->shutdown) continue;
 
             LogErrorF("pselect failed: %s", strerror(errno));
             break;
         }
 
+        if (FD_ISSET(worker->wakefd, &read_fds)) {
+            _DrainWakeups(worker);
+        }
+
         pthread_mutex_lock(&worker->mutex);
 
+        if (worker->listenfd != -1 && FD_ISSET(worker->listenfd, &read_fds)) {
+            _AcceptRequests(worker);
+        }
+
         entry = worker->requests;
         while (entry != NULL) {
             HttpRequest *r = entry->request;
 
             if (FD_ISSET(r->socketfd, &read_fds)) {
                 LogDebugF("fd=%d: ready to READ", r->socketfd);
-                _ReadRequest(worker, r);
+                _ReadRequest(worker, entry);
             }
 
             if (FD_ISSET(r->socketfd, &write_fds)) {
                 LogDebugF("fd=%d: ready to WRITE", r->socketfd);
-                _WriteRequest(worker, r);
+                _WriteRequest(worker, entry);
             }
 
             HttpRequestListEntry *next = entry->next;
-
-            if (r->state == HTTP_STATE_DONE) {
-                LogInfoF("Request fd=%d completed", r->socketfd);
-                _DoneRequest(worker, r);
-            } else if (r->state == HTTP_STATE_ERROR) {
-                LogWarnF("Request fd=%d completed with ERROR", r->socketfd);
-                _ErrorRequest(worker, r);
-            }
-
+            _SettleRequest(worker, entry);
             entry = next;
         }
 
         pthread_mutex_unlock(&worker->mutex);
     }
 
-    LogInfo("Worker loop exited");
     return NULL;
 }
 
-// ─────────────────────────────────────────────────────────────
-//  Request Processors
-// ─────────────────────────────────────────────────────────────
-
-int _ConnectRequest(Worker *worker, HttpRequest *request) {
-    (void) worker;
-    if (request->state != HTTP_STATE_CONNECT) return ERR_OK;
-    LogDebugF("fd=%d switching CONNECT → READ", request->socketfd);
-    request->state = HTTP_STATE_READ;
-    return ERR_OK;
-}
+// Worker must be already locked up to this point.
+// Syncs epoll registration of request socket with its state.
+int _WatchRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *r = entry->request;
+    uint32_t events = 0;
 
-int _ReadRequest(Worker *worker, HttpRequest *request) {
-    request->state = HTTP_STATE_READ;
+    switch (r->state) {
+        case HTTP_STATE_CONNECT:
+        case HTTP_STATE_READ:
+            events = EPOLLIN;
+            break;
+        case HTTP_STATE_WRITE:
+            events = EPOLLOUT;
+            break;
+        case HTTP_STATE_WAITING_FOR_BODY:
+            // Earlier pipelined responses are sent meanwhile
+            events = r->queued_responses != NULL ? EPOLLOUT : 0;
+            break;
+        default:
+            // Waiting for body or finished: socket is unregistered,
+            // so hangups are not reported until we can handle them.
+            events = 0;
+            break;
+    }
 
-    int err = ReadRequest(request);
+    if (events == entry->events) return ERR_OK;
 
-    if (err == ERR_REQUEST_READ_END) {
-        LogDebugF("fd=%d: read complete, parsing...", request->socketfd);
-        return _ProcessRequest(worker, request);
-    } 
-    if (err == ERR_REQUEST_NONBLOCKED_ERROR) {
-        return ERR_OK;
+    int op;
+    if (events == 0) {
+        op = EPOLL_CTL_DEL;
+    } else if (entry->events == 0) {
+        op = EPOLL_CTL_ADD;
+    } else {
+        op = EPOLL_CTL_MOD;
     }
-    if (err != ERR_OK) {
-        LogWarnF("fd=%d: read error", request->socketfd);
-        request->state = HTTP_STATE_ERROR;
-        return ERR_HTTP_MEMORY;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = entry;
+
+    if (epoll_ctl(worker->epollfd, op, r->socketfd, &ev) == -1) {
+        LogErrorF("fd=%d: epoll_ctl failed: %s", r->socketfd, strerror(errno));
+        return ERR_WORKER_POLL_ERROR;
     }
 
+    entry->events = events;
     return ERR_OK;
 }
 
-typedef struct { Worker *worker; HttpRequest *request; WriteBuffer *buffer; } ReadFileCallbackData; 
-void _ReadFileCallback(FileReadResponse *response, void *userData) { 
-    ReadFileCallbackData *data = userData; 
-    HttpRequest *request = data->request; 
-    WriteBuffer *buffer = data->buffer; 
-    free(data); 
-    if (response->error == ERR_OK) { 
-        *buffer->used = response->bytesRead;
-    } else { 
-        // Error occured while reading file 
-        // Set Forbidden response 
-        int err = PrepareHttpResponseForbidden(request); 
-        if (err != ERR_OK) { request->state = HTTP_STATE_ERROR; return; } 
-        request->state = HTTP_STATE_WRITE; return; 
-    } 
-    UnlockWriteBuffer(buffer); 
-    ReleaseWriteBuffer(buffer);
-    free(response);
-    LogDebugF("fd=%d: file read complete successfully", request->socketfd);
+// Worker must be already locked up to this point.
+// Finishes request or updates its epoll registration after state change.
+void _UpdateRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *r = entry->request;
+    if (r->state == HTTP_STATE_DONE) {
+        _KeepAliveRequest(worker, entry);
+    }
+    _ChargeRequest(worker, entry);
 
-    int err = PrepareHttpResponseOk(request);
-    if (err != ERR_OK) {
-        request->state = HTTP_STATE_ERROR;
-        return;
+    if (r->state != HTTP_STATE_DONE && r->state != HTTP_STATE_ERROR) {
+        if (_WatchRequest(worker, entry) != ERR_OK) {
+            r->state = HTTP_STATE_ERROR;
+        }
+    }
+
+    if (r->state == HTTP_STATE_DONE) {
+        LogInfoF("Request fd=%d completed", r->socketfd);
+        _DoneRequest(worker, entry);
+    } else if (r->state == HTTP_STATE_ERROR) {
+        LogWarnF("Request fd=%d completed with ERROR", r->socketfd);
+        _ErrorRequest(worker, entry);
     }
-    request->state = HTTP_STATE_WRITE; 
-    return; 
 }
 
-int _ProcessRequest(Worker *worker, HttpRequest *request) {
-    LogDebugF("fd=%d: parsing request", request->socketfd);
+void *_WorkerLoopEpoll(Worker *worker) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
 
-    int err = ParseHttpRequest(request);
-    if (err == ERR_UNSUPPORTED_HTTP_METHOD ||
-        err == ERR_UNSUPPORTED_HTTP_VERSION) {
+    while (1) {
+        pthread_mutex_lock(&worker->mutex);
 
-        LogWarnF("fd=%d: unsupported method/version", request->socketfd);
+        if (worker->shutdown && worker->current_requests == 0) {
+            LogWarn("Worker loop interrupted by shutdown");
+            pthread_mutex_unlock(&worker->mutex);
+            break;
+        }
 
-        err = PrepareHttpResponseUnsupportedMethod(request);
-        if (err != ERR_OK) {
-            request->state = HTTP_STATE_ERROR;
-            return ERR_HTTP_MEMORY;
+        // Worker with own listener waits for connections in its poll
+        if (worker->current_requests == 0 && worker->listenfd == -1) {
+            pthread_cond_wait(&worker->not_empty, &worker->mutex);
         }
 
-        request->state = HTTP_STATE_WRITE;
-        return ERR_OK;
-    }
+        if (worker->shutdown && worker->current_requests == 0) {
+            pthread_mutex_unlock(&worker->mutex);
+            break;
+        }
 
-    if (err != ERR_OK) {
-        LogWarnF("fd=%d: parse error", request->socketfd);
-        request->state = HTTP_STATE_ERROR;
-        return ERR_HTTP_PARSE;
-    }
+        _CompleteReads(worker);
+        _SweepIdleRequests(worker);
+        if (worker->shutdown && worker->current_requests == 0) {
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
 
-    if (strcmp(request->parsed_request->path->data, "/") == 0) {
-        int err = ReplacePath(request, "/index.html");
-        if (err != ERR_OK) {
-            request->state = HTTP_STATE_ERROR;
-            return ERR_HTTP_MEMORY;
+        if (worker->shutdown && worker->listener_watched) {
+            epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, worker->listenfd, NULL);
+            worker->listener_watched = false;
         }
-    }
 
-    err = AddPathPrefix(request, worker->static_root);
-    if (err != ERR_OK) {
-        request->state = HTTP_STATE_ERROR;
-        return ERR_HTTP_MEMORY;
-    }
+        const struct timespec *timeout = _IdleWaitTimeout(worker);
 
-    LogDebugF("Final path for fd=%d: %s", request->socketfd, request->parsed_request->path->data);
+        pthread_mutex_unlock(&worker->mutex);
 
-    FileStatResponse stat = GetFileStat(request->parsed_request->path->data);
-    if (stat.error == ERR_STAT_FILE_NOT_FOUND) {
-        LogWarnF("fd=%d: file not found", request->socketfd);
+        int ready = epoll_pwait2(worker->epollfd, events, EPOLL_MAX_EVENTS, timeout, NULL);
 
-        err = PrepareHttpResponseNotFound(request);
-        if (err != ERR_OK) {
-            request->state = HTTP_STATE_ERROR;
-            return ERR_HTTP_MEMORY;
-        }
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+
+            LogErrorF("epoll_pwait2 failed: %s", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&worker->mutex);
+
+        // Requests may have been dropped by ShutdownWorker during wait
+        bool dropped = worker->current_requests == 0;
+
+        for (int i = 0; i < ready; i++) {
+            HttpRequestListEntry *entry = events[i].data.ptr;
+            if (entry == NULL) {
+                _DrainWakeups(worker);
+                continue;
+            }
+            if (entry == (void *) &worker->listenfd) {
+                if (!worker->shutdown) _AcceptRequests(worker);
+                continue;
+            }
+            if (dropped) continue;
+
+            HttpRequest *r = entry->request;
+            uint32_t ev = events[i].events;
+
+            if ((ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) && r->state == HTTP_STATE_READ) {
+                LogDebugF("fd=%d: ready to READ", r->socketfd);
+                _ReadRequest(worker, entry);
+            } else if ((ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) &&
+                       (r->state == HTTP_STATE_WRITE || r->queued_responses != NULL)) {
+                LogDebugF("fd=%d: ready to WRITE", r->socketfd);
+                _WriteRequest(worker, entry);
+            }
+
+            _UpdateRequest(worker, entry);
+        }
+
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    return NULL;
+}
+
+// Worker must be already locked up to this point.
+// Returns submission entry, flushing the queue if it is full.
+struct io_uring_sqe *_UringGetSqe(Worker *worker) {
+    struct io_uring_sqe *sqe = UringGetSqe(worker->ring);
+    if (sqe == NULL) {
+        UringSubmit(worker->ring);
+        sqe = UringGetSqe(worker->ring);
+    }
+    if (sqe == NULL) {
+        LogError("io_uring submission queue is full");
+    }
+    return sqe;
+}
+
+// Worker must be already locked up to this point.
+// Streams file body: sends rest of the chunk or reads the next one into it.
+int _UringArmStream(Worker *worker, HttpRequestListEntry *entry, int fd, off_t offset, size_t count) {
+    HttpRequest *r = entry->request;
+
+    if (entry->stream_sent < entry->stream_len) {
+        struct io_uring_sqe *sqe = _UringGetSqe(worker);
+        if (sqe == NULL) return ERR_WORKER_POLL_ERROR;
+        UringPrepSend(sqe, r->socketfd, entry->stream_chunk + entry->stream_sent,
+                      entry->stream_len - entry->stream_sent, MSG_NOSIGNAL, &entry->socket_op);
+        entry->socket_op.type = URING_OP_SOCKET;
+        entry->socket_op.entry = entry;
+        entry->socket_op_pending = true;
+        return ERR_OK;
+    }
+
+    if (entry->stream_chunk == NULL) {
+        entry->stream_chunk = malloc(URING_STREAM_CHUNK_SIZE);
+        if (entry->stream_chunk == NULL) {
+            LogError("Failed to allocate stream chunk");
+            return ERR_WORKER_MEMORY;
+        }
+    }
+
+    size_t len = count < URING_STREAM_CHUNK_SIZE ? count : URING_STREAM_CHUNK_SIZE;
+    struct io_uring_sqe *sqe = _UringGetSqe(worker);
+    if (sqe == NULL) return ERR_WORKER_POLL_ERROR;
+    UringPrepRead(sqe, fd, entry->stream_chunk, len, offset, &entry->stream_op);
+    entry->stream_op.type = URING_OP_STREAM;
+    entry->stream_op.entry = entry;
+    entry->stream_pending = true;
+    return ERR_OK;
+}
+
+// Worker must be already locked up to this point.
+// Queues recv or send for the request according to its state.
+int _UringArmRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *r = entry->request;
+    if (entry->socket_op_pending || entry->stream_pending) return ERR_OK;
+
+    if (r->state == HTTP_STATE_READ) {
+        char *to;
+        size_t upto;
+        if (GetRequestReadBuffer(r, &to, &upto) != ERR_OK) {
+            return ERR_WORKER_MEMORY;
+        }
+        struct io_uring_sqe *sqe = _UringGetSqe(worker);
+        if (sqe == NULL) return ERR_WORKER_POLL_ERROR;
+        UringPrepRecv(sqe, r->socketfd, to, upto, &entry->socket_op);
+    } else if (r->state == HTTP_STATE_WRITE || r->queued_responses != NULL) {
+        _PipelineRequests(worker, entry);
+        if (r->state == HTTP_STATE_ERROR) return ERR_WORKER_WRITE_ERROR;
+
+        int fd;
+        off_t offset;
+        size_t count;
+        if (GetResponseWriteFile(r, &fd, &offset, &count) == ERR_OK) {
+            return _UringArmStream(worker, entry, fd, offset, count);
+        }
+
+        int iov_count;
+        bool truncated;
+        int err = GetResponseWriteVector(r, entry->send_iov, RESPONSE_MAX_IOV, &iov_count, &truncated);
+        if (err == ERR_RESPONSE_WRITE_END) {
+            if (r->state == HTTP_STATE_WRITE) r->state = HTTP_STATE_DONE;
+            return ERR_OK;
+        }
+        if (err == ERR_RESPONSE_BODY_PENDING) {
+            // Armed again once the next chunk of body is read
+            if (r->state == HTTP_STATE_WRITE) r->state = HTTP_STATE_WAITING_FOR_BODY;
+            return ERR_OK;
+        }
+        if (err != ERR_OK) {
+            return ERR_WORKER_WRITE_ERROR;
+        }
+        memset(&entry->send_msg, 0, sizeof(entry->send_msg));
+        entry->send_msg.msg_iov = entry->send_iov;
+        entry->send_msg.msg_iovlen = iov_count;
+
+        struct io_uring_sqe *sqe = _UringGetSqe(worker);
+        if (sqe == NULL) return ERR_WORKER_POLL_ERROR;
+        UringPrepSendmsg(sqe, r->socketfd, &entry->send_msg,
+                         MSG_NOSIGNAL | (truncated ? MSG_MORE : 0), &entry->socket_op);
+    } else {
+        return ERR_OK;
+    }
+
+    entry->socket_op.type = URING_OP_SOCKET;
+    entry->socket_op.entry = entry;
+    entry->socket_op_pending = true;
+    return ERR_OK;
+}
+
+// Worker must be already locked up to this point.
+// Finishes request or queues its next socket operation.
+void _UringUpdateRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *r = entry->request;
+    _ChargeRequest(worker, entry);
+
+    if (r->state == HTTP_STATE_READ || r->state == HTTP_STATE_WRITE ||
+        r->state == HTTP_STATE_WAITING_FOR_BODY) {
+        if (_UringArmRequest(worker, entry) != ERR_OK) {
+            r->state = HTTP_STATE_ERROR;
+        }
+    }
+
+    // Socket can't be closed under in-flight operation
+    if (entry->socket_op_pending || entry->file_read != NULL || entry->stream_pending) return;
+
+    if (r->state == HTTP_STATE_DONE) {
+        _KeepAliveRequest(worker, entry);
+        if (r->state != HTTP_STATE_DONE) {
+            // Connection reused: arm read or write of the next request
+            _UringUpdateRequest(worker, entry);
+            return;
+        }
+    }
+
+    if (r->state == HTTP_STATE_DONE) {
+        LogInfoF("Request fd=%d completed", r->socketfd);
+        _DoneRequest(worker, entry);
+    } else if (r->state == HTTP_STATE_ERROR) {
+        LogWarnF("Request fd=%d completed with ERROR", r->socketfd);
+        _ErrorRequest(worker, entry);
+    }
+}
+
+// Worker must be already locked up to this point.
+int _UringQueueFileRead(Worker *worker, UringFileRead *read) {
+    size_t len = read->size - read->done;
+    if (len > URING_FILE_CHUNK_SIZE) len = URING_FILE_CHUNK_SIZE;
+
+    struct io_uring_sqe *sqe = _UringGetSqe(worker);
+    if (sqe == NULL) return ERR_WORKER_POLL_ERROR;
+    UringPrepRead(sqe, read->fd, read->buffer->data + read->done, len, read->done, &read->op);
+    return ERR_OK;
+}
+
+// Worker must be already locked up to this point.
+// Starts cache-miss read of claimed write buffer directly on the ring.
+int _UringQueueFile(Worker *worker, HttpRequestListEntry *entry, WriteBuffer *wb, const char *path, size_t size) {
+    UringFileRead *read = malloc(sizeof(UringFileRead));
+    if (read == NULL) {
+        return ERR_WORKER_MEMORY;
+    }
+    memset(read, 0, sizeof(UringFileRead));
+
+    read->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (read->fd == -1) {
+        LogWarnF("open(%s) failed: %s", path, strerror(errno));
+        free(read);
+        return ERR_WORKER_READ_ERROR;
+    }
+    read->op.type = URING_OP_FILE;
+    read->op.entry = entry;
+    read->buffer = wb;
+    read->size = size;
+    read->done = 0;
+
+    int err = _UringQueueFileRead(worker, read);
+    if (err != ERR_OK) {
+        close(read->fd);
+        free(read);
+        return err;
+    }
+
+    entry->file_read = read;
+    return ERR_OK;
+}
+
+// Worker must be already locked up to this point.
+void _UringCompleteFile(Worker *worker, HttpRequestListEntry *entry, int res) {
+    UringFileRead *read = entry->file_read;
+    HttpRequest *r = entry->request;
+
+    if (res > 0) {
+        read->done += res;
+
+        // Publish chunk, so response sends it while the rest is read
+        PublishBufferLoad(read->buffer, read->done);
+        if (r->state == HTTP_STATE_WAITING_FOR_BODY) {
+            r->state = HTTP_STATE_WRITE;
+        }
+
+        if (read->done < read->size && r->state != HTTP_STATE_ERROR &&
+            _UringQueueFileRead(worker, read) == ERR_OK) {
+            return;
+        }
+    }
+
+    // Zero means file shrank after its size was put into the header
+    int error = read->done == read->size ? ERR_OK : ERR_WORKER_READ_ERROR;
+    FinishBufferLoad(read->buffer);
+    ReleaseWriteBuffer(read->buffer);
+    close(read->fd);
+    free(read);
+    entry->file_read = NULL;
+
+    _FinishRead(worker, entry, error);
+}
+
+// Worker must be already locked up to this point.
+void _UringCompleteStream(Worker *worker, HttpRequestListEntry *entry, int res) {
+    (void) worker;
+    entry->stream_pending = false;
+
+    if (res == -EAGAIN || res == -EINTR) return;
+    if (res <= 0) {
+        // Zero means file shrank after its size was sent in the header
+        LogWarnF("fd=%d: file stream read failed", entry->request->socketfd);
+        entry->request->state = HTTP_STATE_ERROR;
+        return;
+    }
+
+    entry->stream_len = res;
+    entry->stream_sent = 0;
+}
+
+// Worker must be already locked up to this point.
+void _UringCompleteSocket(Worker *worker, HttpRequestListEntry *entry, int res) {
+    HttpRequest *r = entry->request;
+    entry->socket_op_pending = false;
+
+    if (res == -EAGAIN || res == -EINTR) return;
+
+    if (r->state == HTTP_STATE_READ) {
+        if (res == 0 && r->raw_request->request_buffer->size == 0) {
+            LogDebugF("fd=%d: connection closed by peer", r->socketfd);
+            r->state = HTTP_STATE_DONE;
+            return;
+        }
+        if (res <= 0) {
+            LogWarnF("fd=%d: read error", r->socketfd);
+            r->state = HTTP_STATE_ERROR;
+            return;
+        }
+        entry->last_active = _MonotonicSeconds();
+        if (CommitRequestRead(r, res) == ERR_REQUEST_READ_END) {
+            LogDebugF("fd=%d: read complete, parsing...", r->socketfd);
+            _ProcessRequest(worker, entry);
+        }
+    } else if (r->state == HTTP_STATE_WRITE || r->state == HTTP_STATE_WAITING_FOR_BODY) {
+        // Send may have been of queued responses only, body read of the
+        // current request could finish meanwhile
+        if (res < 0) {
+            LogWarnF("fd=%d: write error", r->socketfd);
+            r->state = HTTP_STATE_ERROR;
+            return;
+        }
+        CommitResponseWrite(r, res);
+
+        // Send of the stream chunk, the only one while it has data
+        if (entry->stream_len > 0) {
+            entry->stream_sent += res;
+            if (entry->stream_sent == entry->stream_len) {
+                entry->stream_len = 0;
+                entry->stream_sent = 0;
+            }
+        }
+    }
+}
+
+// Worker must be already locked up to this point.
+void _UringCompleteAccept(Worker *worker, int res) {
+    if (res < 0) {
+        if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED && !worker->shutdown) {
+            LogWarnF("accept failed: %s", strerror(-res));
+        }
+        return;
+    }
+
+    LogDebugF("New client connected: fd=%d", res);
+    // New request is armed at the top of the loop
+    if (_AddRequest(worker, res) != ERR_OK) {
+        LogWarnF("AddRequest failed for fd=%d, closing connection", res);
+        close(res);
+    }
+}
+
+void *_WorkerLoopUring(Worker *worker) {
+    while (1) {
+        pthread_mutex_lock(&worker->mutex);
+
+        if (worker->shutdown && worker->current_requests == 0) {
+            LogWarn("Worker loop interrupted by shutdown");
+            pthread_mutex_unlock(&worker->mutex);
+            break;
+        }
+
+        // Worker with own listener waits for connections in its poll
+        if (worker->current_requests == 0 && worker->listenfd == -1) {
+            pthread_cond_wait(&worker->not_empty, &worker->mutex);
+        }
+
+        if (worker->shutdown && worker->current_requests == 0) {
+            pthread_mutex_unlock(&worker->mutex);
+            break;
+        }
+
+        // Loads other requests' responses wait for, finished or progressed
+        _CompleteReads(worker);
+
+        if (!worker->wake_pending) {
+            struct io_uring_sqe *sqe = _UringGetSqe(worker);
+            if (sqe != NULL) {
+                worker->wake_op.type = URING_OP_WAKE;
+                worker->wake_op.entry = NULL;
+                UringPrepRead(sqe, worker->wakefd, &worker->wake_value,
+                              sizeof(worker->wake_value), 0, &worker->wake_op);
+                worker->wake_pending = true;
+            }
+        }
+
+        if (worker->listenfd != -1 && !worker->accept_pending && !worker->shutdown) {
+            struct io_uring_sqe *sqe = _UringGetSqe(worker);
+            if (sqe != NULL) {
+                worker->accept_op.type = URING_OP_ACCEPT;
+                worker->accept_op.entry = NULL;
+                UringPrepAccept(sqe, worker->listenfd, SOCK_CLOEXEC, &worker->accept_op);
+                worker->accept_pending = true;
+            }
+        }
+
+        // New requests are prepended by AddRequest, so they form list prefix
+        HttpRequestListEntry *entry = worker->requests;
+        while (entry != NULL && entry->request->state == HTTP_STATE_CONNECT) {
+            HttpRequestListEntry *next = entry->next;
+            _ConnectRequest(worker, entry);
+            _UringUpdateRequest(worker, entry);
+            entry = next;
+        }
+
+        _SweepIdleRequests(worker);
+        if (worker->shutdown && worker->current_requests == 0) {
+            pthread_mutex_unlock(&worker->mutex);
+            continue;
+        }
+        const struct timespec *timeout = _IdleWaitTimeout(worker);
+
+        pthread_mutex_unlock(&worker->mutex);
+
+        int err = UringSubmitAndWait(worker->ring, 1, timeout);
+        if (err == ERR_URING_SUBMIT) {
+            LogErrorF("io_uring_enter failed: %s", strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&worker->mutex);
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = UringPeekCqe(worker->ring)) != NULL) {
+            UringOp *op = (UringOp *) (uintptr_t) cqe->user_data;
+            HttpRequestListEntry *entry = op->entry;
+            int res = cqe->res;
+            UringCqeSeen(worker->ring);
+
+            if (op->type == URING_OP_WAKE) {
+                worker->wake_pending = false;
+                continue;
+            }
+            if (op->type == URING_OP_ACCEPT) {
+                worker->accept_pending = false;
+                _UringCompleteAccept(worker, res);
+                continue;
+            }
+
+            // File read op is freed on completion
+            if (op->type == URING_OP_FILE) {
+                _UringCompleteFile(worker, entry, res);
+            } else if (op->type == URING_OP_STREAM) {
+                _UringCompleteStream(worker, entry, res);
+            } else {
+                _UringCompleteSocket(worker, entry, res);
+            }
+            _UringUpdateRequest(worker, entry);
+        }
+
+        pthread_mutex_unlock(&worker->mutex);
+    }
+
+    return NULL;
+}
+
+// ─────────────────────────────────────────────────────────────
+//  Request Processors
+// ─────────────────────────────────────────────────────────────
+
+int _ConnectRequest(Worker *worker, HttpRequestListEntry *entry) {
+    (void) worker;
+    HttpRequest *request = entry->request;
+    if (request->state != HTTP_STATE_CONNECT) return ERR_OK;
+    LogDebugF("fd=%d switching CONNECT → READ", request->socketfd);
+    request->state = HTTP_STATE_READ;
+    return ERR_OK;
+}
+
+int _ReadRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+    request->state = HTTP_STATE_READ;
+
+    int err = ReadRequest(request);
+    if (err != ERR_REQUEST_NONBLOCKED_ERROR) {
+        entry->last_active = _MonotonicSeconds();
+    }
+
+    // Peer closed connection between requests
+    if (err == ERR_REQUEST_CLOSED && request->raw_request->request_buffer->size == 0) {
+        LogDebugF("fd=%d: connection closed by peer", request->socketfd);
+        request->state = HTTP_STATE_DONE;
+        return ERR_OK;
+    }
+
+    if (err == ERR_REQUEST_READ_END) {
+        LogDebugF("fd=%d: read complete, parsing...", request->socketfd);
+        return _ProcessRequest(worker, entry);
+    } 
+    if (err == ERR_REQUEST_NONBLOCKED_ERROR) {
+        return ERR_OK;
+    }
+    if (err != ERR_OK) {
+        LogWarnF("fd=%d: read error", request->socketfd);
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
+
+    return ERR_OK;
+}
+
+// Called from reader thread: lists read for the worker loop unless it
+// is listed already, so the loop picks up its latest state once.
+void _PushDoneRead(ReadFileCallbackData *data, bool finished, int error) {
+    Worker *worker = data->worker;
+    pthread_mutex_lock(&worker->done_reads_mutex);
+    if (finished) {
+        data->finished = true;
+        data->error = error;
+    }
+    if (!data->listed) {
+        data->listed = true;
+        data->next = worker->done_reads;
+        worker->done_reads = data;
+    }
+    pthread_mutex_unlock(&worker->done_reads_mutex);
+
+    _WakeWorker(worker);
+}
+
+// Called from reader thread: publishes part of the file read so far,
+// response sends it while the rest is being read.
+void _ReadFileProgress(size_t bytesRead, void *userData) {
+    ReadFileCallbackData *data = userData;
+    WriteBuffer *buffer = data->buffer;
+
+    PublishBufferLoad(buffer, bytesRead);
+
+    _PushDoneRead(data, false, ERR_OK);
+}
+
+// Called from thread loading the buffer the request waits for
+void _BufferWaiterCallback(BufferLoadEvent event, void *userData) {
+    ReadFileCallbackData *data = userData;
+    _PushDoneRead(data, event != BUFFER_LOAD_PROGRESS,
+                  event == BUFFER_LOAD_FAILED ? ERR_WORKER_READ_ERROR : ERR_OK);
+}
+
+// Called from reader thread: only hands result over to worker loop,
+// request itself is touched by worker thread only.
+void _ReadFileCallback(FileReadResponse *response, void *userData) { 
+    ReadFileCallbackData *data = userData; 
+    WriteBuffer *buffer = data->buffer; 
+
+    int error = response->error;
+    if (error == ERR_OK) { 
+        PublishBufferLoad(buffer, response->bytesRead);
+        // File shrank after its size was put into the header
+        if (response->bytesRead != *buffer->size) {
+            error = ERR_WORKER_READ_ERROR;
+        }
+    }
+    FinishBufferLoad(buffer);
+    ReleaseWriteBuffer(buffer);
+    free(response);
+
+    _PushDoneRead(data, true, error);
+}
+
+// Worker must be already locked up to this point.
+// Resumes responses waiting for more of their body and finishes
+// requests whose file reads are done.
+void _CompleteReads(Worker *worker) {
+    pthread_mutex_lock(&worker->done_reads_mutex);
+    ReadFileCallbackData *data = worker->done_reads;
+    worker->done_reads = NULL;
+    for (ReadFileCallbackData *d = data; d != NULL; d = d->next) {
+        d->listed = false;
+        d->seen_finished = d->finished;
+        d->seen_error = d->error;
+        d->seen_next = d->next;
+    }
+    pthread_mutex_unlock(&worker->done_reads_mutex);
+
+    while (data != NULL) {
+        ReadFileCallbackData *next = data->seen_next;
+        HttpRequestListEntry *entry = data->entry;
+        bool finished = data->seen_finished;
+        int error = data->seen_error;
+
+        if (entry != NULL) {
+            if (finished) {
+                entry->body_read = NULL;
+                _FinishRead(worker, entry, error);
+            } else if (entry->request->state == HTTP_STATE_WAITING_FOR_BODY) {
+                entry->request->state = HTTP_STATE_WRITE;
+            }
+            if (worker->backend == WORKER_BACKEND_EPOLL) {
+                _UpdateRequest(worker, entry);
+            } else if (worker->backend == WORKER_BACKEND_IO_URING) {
+                _UringUpdateRequest(worker, entry);
+            }
+        }
+        if (finished) {
+            free(data);
+        }
+
+        data = next;
+    }
+}
+
+// Worker must be already locked up to this point.
+// Resumes or fails response whose body has been read.
+void _FinishRead(Worker *worker, HttpRequestListEntry *entry, int error) {
+    (void) worker;
+    HttpRequest *request = entry->request;
+    if (request->state == HTTP_STATE_ERROR) return;
+
+    if (error == ERR_OK) {
+        LogDebugF("fd=%d: file read complete successfully", request->socketfd);
+        if (request->state == HTTP_STATE_WAITING_FOR_BODY) {
+            request->state = HTTP_STATE_WRITE;
+        }
+        return;
+    }
+
+    LogWarnF("fd=%d: file read failed (error=%d)", request->socketfd, error);
+    // Body is sent right behind the header, so once header went out
+    // connection can only be dropped
+    if (request->raw_response == NULL || request->raw_response->header_bytes_written > 0) {
+        request->state = HTTP_STATE_ERROR;
+        return;
+    }
+
+    // Set Forbidden response 
+    int err = PrepareHttpResponseForbidden(request);
+    request->state = err == ERR_OK ? HTTP_STATE_WRITE : HTTP_STATE_ERROR;
+}
+
+// Worker must be already locked up to this point.
+// Prepares response with body sent straight from the file, bypassing
+// cache: sendfile() or, on io_uring, through connection chunk buffer.
+int _StreamFileRequest(Worker *worker, HttpRequestListEntry *entry) {
+    (void) worker;
+    HttpRequest *request = entry->request;
+    int err;
+
+    int fd = open(request->parsed_request->path->data, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LogWarnF("fd=%d: open failed: %s", request->socketfd, strerror(errno));
+        err = PrepareHttpResponseForbidden(request);
+    } else {
+        LogDebugF("fd=%d: streaming file bypassing cache", request->socketfd);
+        AddHttpResponseFile(request, fd);
+        err = PrepareHttpResponseOk(request);
+    }
+    if (err != ERR_OK) {
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
+
+    request->state = HTTP_STATE_WRITE;
+    return ERR_OK;
+}
+
+int _GetOrLoadBuffer(Worker *worker, const char *path, size_t file_size, ReadBuffer **buffer, WriteBuffer **wb) {
+    if (worker->cache_mmap) {
+        *wb = NULL;
+        int err = GetOrMapBuffer(worker->cache_manager, path, buffer);
+        // Files that can't be mapped, like empty ones, are copied
+        if (err != ERR_FILE_MAP) {
+            return err;
+        }
+    }
+    return GetOrCreateBuffer(worker->cache_manager, path, file_size, buffer, wb);
+}
+
+// Gets cache buffer of file. Buffer cached before the file changed size
+// is dropped unless it is being refreshed: the watcher may not have
+// caught up with the change yet. Load claimed on a buffer left over from
+// a failed one is always dropped then, it can't hold the file.
+int _GetCachedFile(Worker *worker, const char *path, size_t file_size, ReadBuffer **buffer, WriteBuffer **wb) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int err = _GetOrLoadBuffer(worker, path, file_size, buffer, wb);
+        if (err != ERR_OK || *(*buffer)->size == file_size) {
+            return err;
+        }
+        if (*wb != NULL) {
+            FinishBufferLoad(*wb);
+            ReleaseWriteBuffer(*wb);
+            *wb = NULL;
+        } else if (worker->cache_refresh) {
+            // Watcher swaps the new version in once it is read
+            return ERR_OK;
+        }
+        LogDebugF("%s changed size since it was cached, reloading", path);
+        ReleaseBuffer(*buffer);
+        InvalidateBuffer(worker->cache_manager, path);
+    }
+    // Keeps changing, streamed like files that don't fit into cache
+    *buffer = NULL;
+    return ERR_BUFFER_SIZE_LIMIT;
+}
+
+int _ProcessRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+    LogDebugF("fd=%d: parsing request", request->socketfd);
+
+    int err = ParseHttpRequest(request);
+    if (err == ERR_UNSUPPORTED_HTTP_METHOD ||
+        err == ERR_UNSUPPORTED_HTTP_VERSION) {
+
+        LogWarnF("fd=%d: unsupported method/version", request->socketfd);
+
+        err = PrepareHttpResponseUnsupportedMethod(request);
+        if (err != ERR_OK) {
+            request->state = HTTP_STATE_ERROR;
+            return ERR_HTTP_MEMORY;
+        }
+
+        request->state = HTTP_STATE_WRITE;
+        return ERR_OK;
+    }
+
+    if (err != ERR_OK) {
+        LogWarnF("fd=%d: parse error", request->socketfd);
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_PARSE;
+    }
+
+    request->keep_alive = request->parsed_request->keep_alive &&
+                          worker->keepalive_timeout > 0 && !worker->shutdown &&
+                          (worker->keepalive_max_requests == 0 ||
+                           entry->served + 1 < worker->keepalive_max_requests);
+
+    if (strcmp(request->parsed_request->path->data, "/") == 0) {
+        int err = ReplacePath(request, "/index.html");
+        if (err != ERR_OK) {
+            request->state = HTTP_STATE_ERROR;
+            return ERR_HTTP_MEMORY;
+        }
+    }
+
+    err = AddPathPrefix(request, worker->static_root);
+    if (err != ERR_OK) {
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
+
+    LogDebugF("Final path for fd=%d: %s", request->socketfd, request->parsed_request->path->data);
+
+    FileStatResponse stat = GetFileStat(request->parsed_request->path->data);
+    if (stat.error == ERR_STAT_FILE_NOT_FOUND) {
+        LogWarnF("fd=%d: file not found", request->socketfd);
+
+        err = PrepareHttpResponseNotFound(request);
+        if (err != ERR_OK) {
+            request->state = HTTP_STATE_ERROR;
+            return ERR_HTTP_MEMORY;
+        }
 
         request->state = HTTP_STATE_WRITE;
         return ERR_OK;
@@ -529,142 +1710,333 @@ int _ProcessRequest(Worker *worker, HttpRequest *request) {
         return ERR_OK;
     }
 
-    // GET request
-    ReadBuffer *buffer = GetBuffer(worker->cache_manager, request->parsed_request->path->data);
-    if (buffer != NULL) {
-        LogDebugF("fd=%d: cache HIT", request->socketfd);
-
-        AddHttpResponseBody(request, buffer);
-        PrepareHttpResponseOk(request);
-        request->state = HTTP_STATE_WRITE;
-        return ERR_OK;
+    // Large file: streamed from page cache, not copied into our cache
+    if (worker->sendfile_threshold > 0 && stat.file_size >= worker->sendfile_threshold) {
+        return _StreamFileRequest(worker, entry);
     }
 
-    LogDebugF("fd=%d: cache MISS", request->socketfd);
-
-    err = CreateBuffer(worker->cache_manager,
-                       request->parsed_request->path->data,
-                       stat.file_size);
-    LogDebugF("fd=%d: cache error=%d", request->socketfd, err);
+    // GET request
+    ReadBuffer *buffer;
+    WriteBuffer *wb;
+    err = _GetCachedFile(worker, request->parsed_request->path->data, stat.file_size, &buffer, &wb);
+    if (err == ERR_BUFFER_SIZE_LIMIT || err == ERR_MEMORY_LIMIT_EXCEEDED ||
+        err == ERR_BUFFER_COUNT_EXCEEDED) {
+        LogDebugF("fd=%d: file does not fit into cache, streaming it", request->socketfd);
+        return _StreamFileRequest(worker, entry);
+    }
     if (err != ERR_OK) {
+        LogDebugF("fd=%d: cache error=%d", request->socketfd, err);
         request->state = HTTP_STATE_ERROR;
         return ERR_HTTP_MEMORY;
     }
+    // Cached version may be older than the file, it is sent whole
+    request->response->header.content_length = *buffer->size;
 
-    WriteBuffer *wb = GetWriteBuffer(worker->cache_manager,
-                                     request->parsed_request->path->data);
-    if (wb == NULL) {
-        request->state = HTTP_STATE_ERROR;
-        return ERR_HTTP_MEMORY;
+    if (wb != NULL) {
+        LogDebugF("fd=%d: cache MISS", request->socketfd);
+        SetBufferMtime(wb, &stat.mtime);
+        return _LoadFileRequest(worker, entry, buffer, wb);
     }
 
-    buffer = GetBuffer(worker->cache_manager, request->parsed_request->path->data);
-    if (buffer == NULL) {
-        ReleaseWriteBuffer(wb);
-        request->state = HTTP_STATE_ERROR;
-        return ERR_HTTP_MEMORY;
+    bool cached = GetBufferUsed(buffer) == *buffer->size;
+    if (!cached) {
+        LogDebugF("fd=%d: cache MISS, file is being loaded", request->socketfd);
+        return _WaitFileRequest(worker, entry, buffer);
     }
 
+    LogDebugF("fd=%d: cache HIT", request->socketfd);
     AddHttpResponseBody(request, buffer);
-    LockWriteBuffer(wb);
+    PrepareHttpResponseOk(request);
+    request->state = HTTP_STATE_WRITE;
+    return ERR_OK;
+}
 
-    if (*wb->used == stat.file_size) {
-        LogDebugF("fd=%d: file already cached", request->socketfd);
+// Worker must be already locked up to this point.
+// Makes load of the response body the one request waits for.
+void _AttachBodyRead(HttpRequestListEntry *entry, ReadFileCallbackData *cbdata) {
+    // Previous response on the connection was sent, so its load is done
+    // and only its notification may be left
+    if (entry->body_read != NULL) {
+        entry->body_read->entry = NULL;
+    }
+    entry->body_read = cbdata;
+}
 
-        UnlockWriteBuffer(wb);
+// Worker must be already locked up to this point.
+// Fills claimed cache buffer from file, sending its loaded part meanwhile.
+int _LoadFileRequest(Worker *worker, HttpRequestListEntry *entry, ReadBuffer *buffer, WriteBuffer *wb) {
+    HttpRequest *request = entry->request;
+    const char *path = request->parsed_request->path->data;
+
+    // Left partially filled by failed load
+    PublishBufferLoad(wb, 0);
+
+    AddHttpResponseBody(request, buffer);
+    int err = PrepareHttpResponseOk(request);
+    if (err != ERR_OK) {
+        FinishBufferLoad(wb);
         ReleaseWriteBuffer(wb);
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
 
-        PrepareHttpResponseOk(request);
-        request->state = HTTP_STATE_WRITE;
+    // Header goes out right away, body follows as it is read
+    request->state = HTTP_STATE_WRITE;
+
+    if (worker->backend == WORKER_BACKEND_IO_URING) {
+        err = _UringQueueFile(worker, entry, wb, path, *wb->size);
+        if (err != ERR_OK) {
+            FinishBufferLoad(wb);
+            ReleaseWriteBuffer(wb);
+            request->state = HTTP_STATE_ERROR;
+            return ERR_HTTP_MEMORY;
+        }
         return ERR_OK;
     }
 
-    // Not cached -> read file
     FileReadRequest read_request;
-    read_request.path = request->parsed_request->path->data;
+    read_request.path = path;
     read_request.buffer = wb->data;
-    read_request.bufferSize = stat.file_size;
+    read_request.bufferSize = *wb->size;
     read_request.callback = _ReadFileCallback;
+    read_request.progress = _ReadFileProgress;
 
     ReadFileCallbackData *cbdata = malloc(sizeof(ReadFileCallbackData));
     if (cbdata == NULL) {
+        FinishBufferLoad(wb);
         ReleaseWriteBuffer(wb);
         request->state = HTTP_STATE_ERROR;
         return ERR_HTTP_MEMORY;
     }
 
+    memset(cbdata, 0, sizeof(ReadFileCallbackData));
     cbdata->worker = worker;
-    cbdata->request = request;
+    cbdata->entry = entry;
     cbdata->buffer = wb;
     read_request.userData = cbdata;
 
-    LockWriteBuffer(wb);
     FileReadSet read_set = QueueFile(worker->reader_pool, read_request);
     if (read_set.error != ERR_OK) {
-        UnlockWriteBuffer(wb);
+        free(cbdata);
+        FinishBufferLoad(wb);
         ReleaseWriteBuffer(wb);
         request->state = HTTP_STATE_ERROR;
         return ERR_HTTP_MEMORY;
     }
+    _AttachBodyRead(entry, cbdata);
 
-    LogDebugF("fd=%d: waiting for file read completion", request->socketfd);
+    LogDebugF("fd=%d: sending body while file is read", request->socketfd);
 
-    request->state = HTTP_STATE_WAITING_FOR_BODY;
     return ERR_OK;
 }
 
-int _WriteRequest(Worker *worker, HttpRequest *request) {
-    (void) worker;
+// Worker must be already locked up to this point.
+// Sends cache buffer another request is filling as it is loaded,
+// instead of reading the file once more.
+int _WaitFileRequest(Worker *worker, HttpRequestListEntry *entry, ReadBuffer *buffer) {
+    HttpRequest *request = entry->request;
+
+    ReadFileCallbackData *cbdata = malloc(sizeof(ReadFileCallbackData));
+    if (cbdata == NULL) {
+        ReleaseBuffer(buffer);
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
+    memset(cbdata, 0, sizeof(ReadFileCallbackData));
+    cbdata->worker = worker;
+    cbdata->entry = entry;
+    cbdata->waiter.callback = _BufferWaiterCallback;
+    cbdata->waiter.userData = cbdata;
+
+    if (AddBufferWaiter(buffer, &cbdata->waiter) != ERR_OK) {
+        // Loading ended meanwhile
+        free(cbdata);
+        bool cached = GetBufferUsed(buffer) == *buffer->size;
+        if (!cached) {
+            ReleaseBuffer(buffer);
+            return _StreamFileRequest(worker, entry);
+        }
+        cbdata = NULL;
+    }
+
+    AddHttpResponseBody(request, buffer);
+    if (PrepareHttpResponseOk(request) != ERR_OK) {
+        // Attached waiter is dropped once the load ends
+        if (cbdata != NULL) {
+            cbdata->entry = NULL;
+        }
+        request->state = HTTP_STATE_ERROR;
+        return ERR_HTTP_MEMORY;
+    }
+
+    if (cbdata != NULL) {
+        _AttachBodyRead(entry, cbdata);
+        LogDebugF("fd=%d: sending body while other request loads it", request->socketfd);
+    }
     request->state = HTTP_STATE_WRITE;
+    return ERR_OK;
+}
+
+int _WriteRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+
+    _PipelineRequests(worker, entry);
+    if (request->state == HTTP_STATE_ERROR) return ERR_WORKER_WRITE_ERROR;
 
     int err = WriteRequest(request);
     if (err == ERR_RESPONSE_WRITE_END) {
-        LogDebugF("fd=%d: write complete", request->socketfd);
-        request->state = HTTP_STATE_DONE;
+        // Request waiting for body has only sent queued responses
+        if (request->state == HTTP_STATE_WRITE) {
+            LogDebugF("fd=%d: write complete", request->socketfd);
+            request->state = HTTP_STATE_DONE;
+        }
+        return ERR_OK;
+    }
+    if (err == ERR_RESPONSE_BODY_PENDING) {
+        // Body is still being read, writing resumes when more of it is loaded
+        if (request->state == HTTP_STATE_WRITE) {
+            request->state = HTTP_STATE_WAITING_FOR_BODY;
+        }
         return ERR_OK;
     }
     if (err == ERR_RESPONSE_NONBLOCKED_ERROR) return ERR_OK;
+    if (err != ERR_OK) {
+        LogWarnF("fd=%d: write error", request->socketfd);
+        request->state = HTTP_STATE_ERROR;
+        return ERR_WORKER_WRITE_ERROR;
+    }
 
     return ERR_OK;
 }
 
-int _DeleteRequest(Worker *worker, HttpRequest *request) {
-    HttpRequestListEntry *entry = worker->requests;
+// Worker must be already locked up to this point.
+// Reuses connection of finished persistent request for the next one.
+// Request stays DONE if connection has to be closed.
+void _KeepAliveRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+    if (!request->keep_alive || worker->shutdown) return;
 
-    if (entry == NULL) {
-        DestroyHttpRequest(request);
-        return ERR_OK;
+    entry->served++;
+    entry->last_active = _MonotonicSeconds();
+    LogDebugF("fd=%d: keep-alive, waiting for request #%zu", request->socketfd, entry->served + 1);
+
+    int err = ResetHttpRequest(request);
+    if (err == ERR_REQUEST_READ_END) {
+        // Next request already arrived together with the previous one
+        _ProcessRequest(worker, entry);
     }
+}
 
-    if (entry->request == request) {
-        worker->requests = entry->next;
-        _DestroyRequestEntry(entry);
-        worker->current_requests--;
-        return ERR_OK;
+// Worker must be already locked up to this point.
+// Processes requests buffered behind the one about to be sent, queueing
+// their responses so that ready ones go out together in a single send.
+void _PipelineRequests(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+
+    // Response with body still being read stays current, so that its
+    // load notifications find it
+    while (request->state == HTTP_STATE_WRITE && request->keep_alive && !worker->shutdown &&
+           entry->body_read == NULL && entry->file_read == NULL &&
+           request->queued_count < RESPONSE_MAX_QUEUED && HasPipelinedRequest(request)) {
+        if (QueueHttpResponse(request) != ERR_OK) {
+            request->state = HTTP_STATE_ERROR;
+            return;
+        }
+
+        entry->served++;
+        LogDebugF("fd=%d: pipelined request #%zu", request->socketfd, entry->served + 1);
+
+        if (ResetHttpRequest(request) == ERR_REQUEST_READ_END) {
+            _ProcessRequest(worker, entry);
+        }
     }
+}
 
-    while (entry->next != NULL) {
-        if (entry->next->request == request) {
-            HttpRequestListEntry *next = entry->next;
-            entry->next = next->next;
-            _DestroyRequestEntry(next);
-            worker->current_requests--;
-            return ERR_OK;
+// Worker must be already locked up to this point.
+// Closes connections waiting for request longer than keep-alive timeout.
+// On shutdown connections with nothing received are closed right away.
+void _SweepIdleRequests(Worker *worker) {
+    if (worker->keepalive_timeout == 0 && !worker->shutdown) return;
+
+    time_t now = _MonotonicSeconds();
+    if (!worker->shutdown && now < worker->next_idle_sweep) return;
+    worker->next_idle_sweep = now + IDLE_SWEEP_INTERVAL.tv_sec;
+
+    HttpRequestListEntry *entry = worker->requests;
+    while (entry != NULL) {
+        HttpRequestListEntry *next = entry->next;
+        HttpRequest *r = entry->request;
+
+        bool idle = r->state == HTTP_STATE_READ &&
+                    (worker->shutdown ? r->raw_request->request_buffer->size == 0
+                                      : now - entry->last_active >= (time_t) worker->keepalive_timeout);
+        if (idle) {
+            LogDebugF("fd=%d: closing idle connection", r->socketfd);
+            if (entry->socket_op_pending) {
+                // In-flight recv completes once socket is shut down
+                shutdown(r->socketfd, SHUT_RDWR);
+            } else {
+                _DoneRequest(worker, entry);
+            }
         }
-        entry = entry->next;
+
+        entry = next;
+    }
+}
+
+// Worker must be already locked up to this point.
+// Wait limit of the loop: open connections need periodic idle sweep.
+const struct timespec *_IdleWaitTimeout(Worker *worker) {
+    if (worker->keepalive_timeout == 0 || worker->current_requests == 0) {
+        return NULL;
     }
+    return &IDLE_SWEEP_INTERVAL;
+}
 
+int _DeleteRequest(Worker *worker, HttpRequestListEntry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        worker->requests = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+
+    __atomic_store_n(&worker->pending_bytes, worker->pending_bytes - entry->charged_bytes, __ATOMIC_RELAXED);
+    _DestroyRequestEntry(entry);
+    __atomic_store_n(&worker->current_requests, worker->current_requests - 1, __ATOMIC_RELAXED);
     return ERR_OK;
 }
 
-int _DoneRequest(Worker *worker, HttpRequest *request) {
-    LogDebugF("fd=%d: closing connection (DONE)", request->socketfd);
-    if (request->socketfd != -1) close(request->socketfd);
-    return _DeleteRequest(worker, request);
+// Worker must be already locked up to this point.
+// Syncs worker pending_bytes with response bytes left for request.
+void _ChargeRequest(Worker *worker, HttpRequestListEntry *entry) {
+    size_t left = GetResponseBytesLeft(entry->request);
+    if (left == entry->charged_bytes) return;
+
+    __atomic_store_n(&worker->pending_bytes,
+                     worker->pending_bytes - entry->charged_bytes + left, __ATOMIC_RELAXED);
+    entry->charged_bytes = left;
+}
+
+int _CloseRequest(Worker *worker, HttpRequestListEntry *entry) {
+    HttpRequest *request = entry->request;
+    if (request->socketfd != -1) {
+        if (entry->events != 0) {
+            epoll_ctl(worker->epollfd, EPOLL_CTL_DEL, request->socketfd, NULL);
+        }
+        close(request->socketfd);
+    }
+    return _DeleteRequest(worker, entry);
+}
+
+int _DoneRequest(Worker *worker, HttpRequestListEntry *entry) {
+    LogDebugF("fd=%d: closing connection (DONE)", entry->request->socketfd);
+    return _CloseRequest(worker, entry);
 }
 
-int _ErrorRequest(Worker *worker, HttpRequest *request) {
-    LogDebugF("fd=%d: closing connection (ERROR)", request->socketfd);
-    if (request->socketfd != -1) close(request->socketfd);
-    return _DeleteRequest(worker, request);
+int _ErrorRequest(Worker *worker, HttpRequestListEntry *entry) {
+    LogDebugF("fd=%d: closing connection (ERROR)", entry->request->socketfd);
+    return _CloseRequest(worker, entry);
 }
@@ -61,6 +61,23 @@ START_TEST(test_hash_large_table_size)
 }
 END_TEST
 
+START_TEST(test_hash64_known_values)
+{
+    ck_assert_uint_eq(hash64("", 0), 0xef46db3751d8e999UL);
+    ck_assert_uint_eq(hash64("abc", 3), 0x44bc2cf5ad770999UL);
+    // Long enough for the 32 byte stripes
+    const char *long_key = "Nobody inspects the spammish repetition";
+    ck_assert_uint_eq(hash64(long_key, strlen(long_key)), 0xfbcea83c8a378bf1UL);
+}
+END_TEST
+
+START_TEST(test_hash64_uses_length)
+{
+    ck_assert_uint_ne(hash64("key1", 4), hash64("key1", 3));
+    ck_assert_uint_eq(hash64("key1", 3), hash64("key", 3));
+}
+END_TEST
+
 Suite *hash_suite(void)
 {
     Suite *s = suite_create("Hash");
@@ -72,6 +89,8 @@ Suite *hash_suite(void)
     tcase_add_test(tc_core, test_hash_different_keys);
     tcase_add_test(tc_core, test_hash_table_size_one);
     tcase_add_test(tc_core, test_hash_large_table_size);
+    tcase_add_test(tc_core, test_hash64_known_values);
+    tcase_add_test(tc_core, test_hash64_uses_length);
 
     suite_add_tcase(s, tc_core);
 
@@ -3,6 +3,11 @@
 
 // Declare suite functions from test files
 Suite *cache_suite(void);
+Suite *sketch_suite(void);
+Suite *arena_suite(void);
+Suite *watcher_suite(void);
+Suite *warmup_suite(void);
+Suite *snapshot_suite(void);
 Suite *hash_suite(void);
 Suite *reader_suite(void);
 Suite *content_suite(void);
@@ -10,6 +15,8 @@ Suite *date_suite(void);
 Suite *log_suite(void);
 Suite *string_suite(void);
 Suite *strutils_suite(void);
+Suite *uring_suite(void);
+Suite *request_suite(void);
 
 int main(void)
 {
@@ -22,6 +29,41 @@ int main(void)
     number_failed += srunner_ntests_failed(sr_cache);
     srunner_free(sr_cache);
 
+    // Run sketch tests
+    Suite *s_sketch = sketch_suite();
+    SRunner *sr_sketch = srunner_create(s_sketch);
+    srunner_run_all(sr_sketch, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_sketch);
+    srunner_free(sr_sketch);
+
+    // Run arena tests
+    Suite *s_arena = arena_suite();
+    SRunner *sr_arena = srunner_create(s_arena);
+    srunner_run_all(sr_arena, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_arena);
+    srunner_free(sr_arena);
+
+    // Run watcher tests
+    Suite *s_watcher = watcher_suite();
+    SRunner *sr_watcher = srunner_create(s_watcher);
+    srunner_run_all(sr_watcher, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_watcher);
+    srunner_free(sr_watcher);
+
+    // Run warm-up tests
+    Suite *s_warmup = warmup_suite();
+    SRunner *sr_warmup = srunner_create(s_warmup);
+    srunner_run_all(sr_warmup, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_warmup);
+    srunner_free(sr_warmup);
+
+    // Run snapshot tests
+    Suite *s_snapshot = snapshot_suite();
+    SRunner *sr_snapshot = srunner_create(s_snapshot);
+    srunner_run_all(sr_snapshot, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_snapshot);
+    srunner_free(sr_snapshot);
+
     // Run hash tests
     Suite *s_hash = hash_suite();
     SRunner *sr_hash = srunner_create(s_hash);
@@ -71,5 +113,19 @@ int main(void)
     number_failed += srunner_ntests_failed(sr_strutils);
     srunner_free(sr_strutils);
 
+    // Run uring tests
+    Suite *s_uring = uring_suite();
+    SRunner *sr_uring = srunner_create(s_uring);
+    srunner_run_all(sr_uring, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_uring);
+    srunner_free(sr_uring);
+
+    // Run request tests
+    Suite *s_request = request_suite();
+    SRunner *sr_request = srunner_create(s_request);
+    srunner_run_all(sr_request, CK_NORMAL);
+    number_failed += srunner_ntests_failed(sr_request);
+    srunner_free(sr_request);
+
     return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
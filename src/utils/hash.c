@@ -1,5 +1,14 @@
 #include "utils/hash.h"
 
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t _xxh_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t _xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t _xxh_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t _xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t _xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
 unsigned long djb2_hash(const char *key, size_t table_size) {
     unsigned long hash = 5381;
     int c;
@@ -13,4 +22,81 @@ unsigned long djb2_hash(const char *key, size_t table_size) {
 
 unsigned long hash(const char *key, size_t table_size) {
     return djb2_hash(key, table_size);
-}
\ No newline at end of file
+}
+
+uint64_t _Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian loads, memcpy compiles to a single move
+uint64_t _Read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t _Read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t _XxhRound(uint64_t acc, uint64_t input) {
+    acc += input * _xxh_prime2;
+    acc = _Rotl64(acc, 31);
+    return acc * _xxh_prime1;
+}
+
+uint64_t _XxhMerge(uint64_t acc, uint64_t v) {
+    acc ^= _XxhRound(0, v);
+    return acc * _xxh_prime1 + _xxh_prime4;
+}
+
+unsigned long hash64(const char *key, size_t length) {
+    const char *p = key;
+    const char *end = key + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = _xxh_prime1 + _xxh_prime2;
+        uint64_t v2 = _xxh_prime2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -_xxh_prime1;
+        do {
+            v1 = _XxhRound(v1, _Read64(p));
+            v2 = _XxhRound(v2, _Read64(p + 8));
+            v3 = _XxhRound(v3, _Read64(p + 16));
+            v4 = _XxhRound(v4, _Read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = _Rotl64(v1, 1) + _Rotl64(v2, 7) + _Rotl64(v3, 12) + _Rotl64(v4, 18);
+        h = _XxhMerge(h, v1);
+        h = _XxhMerge(h, v2);
+        h = _XxhMerge(h, v3);
+        h = _XxhMerge(h, v4);
+    } else {
+        h = _xxh_prime5;
+    }
+    h += length;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= _XxhRound(0, _Read64(p));
+        h = _Rotl64(h, 27) * _xxh_prime1 + _xxh_prime4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) _Read32(p) * _xxh_prime1;
+        h = _Rotl64(h, 23) * _xxh_prime2 + _xxh_prime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (uint64_t) (unsigned char) *p * _xxh_prime5;
+        h = _Rotl64(h, 11) * _xxh_prime1;
+    }
+
+    h ^= h >> 33;
+    h *= _xxh_prime2;
+    h ^= h >> 29;
+    h *= _xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
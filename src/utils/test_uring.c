@@ -0,0 +1,122 @@
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils/uring.h"
+
+START_TEST(test_CreateUring_destroy)
+{
+    Uring *ring = CreateUring(8);
+    ck_assert_ptr_nonnull(ring);
+    DestroyUring(ring);
+}
+END_TEST
+
+START_TEST(test_DestroyUring_null)
+{
+    DestroyUring(NULL);
+}
+END_TEST
+
+START_TEST(test_Uring_nop_roundtrip)
+{
+    Uring *ring = CreateUring(8);
+    ck_assert_ptr_nonnull(ring);
+
+    int tag = 42;
+    struct io_uring_sqe *sqe = UringGetSqe(ring);
+    ck_assert_ptr_nonnull(sqe);
+    UringPrepNop(sqe, &tag);
+
+    ck_assert_int_eq(UringSubmitAndWait(ring, 1, NULL), ERR_OK);
+
+    struct io_uring_cqe *cqe = UringPeekCqe(ring);
+    ck_assert_ptr_nonnull(cqe);
+    ck_assert_ptr_eq((void *) (uintptr_t) cqe->user_data, &tag);
+    ck_assert_int_eq(cqe->res, 0);
+    UringCqeSeen(ring);
+
+    ck_assert_ptr_null(UringPeekCqe(ring));
+    DestroyUring(ring);
+}
+END_TEST
+
+START_TEST(test_Uring_read_file)
+{
+    Uring *ring = CreateUring(8);
+    ck_assert_ptr_nonnull(ring);
+
+    int fd = open("testdata/test.txt", O_RDONLY);
+    ck_assert_int_ne(fd, -1);
+
+    char buffer[64];
+    memset(buffer, 0, sizeof(buffer));
+    struct io_uring_sqe *sqe = UringGetSqe(ring);
+    ck_assert_ptr_nonnull(sqe);
+    UringPrepRead(sqe, fd, buffer, sizeof(buffer), 0, NULL);
+
+    ck_assert_int_eq(UringSubmitAndWait(ring, 1, NULL), ERR_OK);
+
+    struct io_uring_cqe *cqe = UringPeekCqe(ring);
+    ck_assert_ptr_nonnull(cqe);
+    ck_assert_int_eq(cqe->res, 12);
+    ck_assert_str_eq(buffer, "Hello World\n");
+    UringCqeSeen(ring);
+
+    close(fd);
+    DestroyUring(ring);
+}
+END_TEST
+
+START_TEST(test_Uring_wait_timeout)
+{
+    Uring *ring = CreateUring(8);
+    ck_assert_ptr_nonnull(ring);
+
+    struct timespec timeout = {0, 1000000};
+    ck_assert_int_eq(UringSubmitAndWait(ring, 1, &timeout), ERR_URING_TIMEOUT);
+    ck_assert_ptr_null(UringPeekCqe(ring));
+
+    DestroyUring(ring);
+}
+END_TEST
+
+START_TEST(test_UringGetSqe_full)
+{
+    Uring *ring = CreateUring(4);
+    ck_assert_ptr_nonnull(ring);
+
+    for (int i = 0; i < 4; i++) {
+        struct io_uring_sqe *sqe = UringGetSqe(ring);
+        ck_assert_ptr_nonnull(sqe);
+        UringPrepNop(sqe, NULL);
+    }
+    ck_assert_ptr_null(UringGetSqe(ring));
+
+    // Submission frees queue slots
+    ck_assert_int_eq(UringSubmit(ring), ERR_OK);
+    ck_assert_ptr_nonnull(UringGetSqe(ring));
+
+    DestroyUring(ring);
+}
+END_TEST
+
+Suite *uring_suite(void)
+{
+    Suite *s = suite_create("Uring");
+
+    TCase *tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_CreateUring_destroy);
+    tcase_add_test(tc_core, test_DestroyUring_null);
+    tcase_add_test(tc_core, test_Uring_nop_roundtrip);
+    tcase_add_test(tc_core, test_Uring_read_file);
+    tcase_add_test(tc_core, test_Uring_wait_timeout);
+    tcase_add_test(tc_core, test_UringGetSqe_full);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include "utils/uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+
+struct Uring {
+    int fd;
+    unsigned features;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    // Tail of prepared entries, published to sq_tail on submit
+    unsigned sqe_tail;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+int _UringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+int _UringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+Uring *CreateUring(unsigned entries) {
+    Uring *ring = malloc(sizeof(Uring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(Uring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = _UringSetup(entries, &params);
+    if (ring->fd == -1) {
+        free(ring);
+        return NULL;
+    }
+    ring->features = params.features;
+
+    // Timeouts for waiting are passed with IORING_ENTER_EXT_ARG
+    if (!(ring->features & IORING_FEAT_EXT_ARG)) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (ring->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    if (ring->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(ring->fd);
+            free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr) {
+            munmap(ring->cq_ptr, ring->cq_size);
+        }
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ptr;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    char *cq = ring->cq_ptr;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return ring;
+}
+
+void DestroyUring(Uring *ring) {
+    if (ring == NULL) return;
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+struct io_uring_sqe *UringGetSqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// Publishes prepared entries, returns count not yet consumed by kernel
+unsigned _UringFlush(Uring *ring) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    return ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int UringSubmit(Uring *ring) {
+    unsigned to_submit = _UringFlush(ring);
+    if (to_submit == 0) {
+        return ERR_OK;
+    }
+    int result = _UringEnter(ring->fd, to_submit, 0, 0, NULL, 0);
+    if (result == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return ERR_URING_SUBMIT;
+    }
+    return ERR_OK;
+}
+
+int UringSubmitAndWait(Uring *ring, unsigned wait_nr, const struct timespec *timeout) {
+    unsigned to_submit = _UringFlush(ring);
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout != NULL) {
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_nsec;
+        arg.ts = (unsigned long long) (uintptr_t) &ts;
+    }
+
+    int result = _UringEnter(ring->fd, to_submit, wait_nr,
+                             IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                             &arg, sizeof(arg));
+    if (result == -1) {
+        if (errno == ETIME) {
+            return ERR_URING_TIMEOUT;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return ERR_URING_SUBMIT;
+        }
+    }
+    return ERR_OK;
+}
+
+struct io_uring_cqe *UringPeekCqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void UringCqeSeen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void UringPrepRecv(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, void *user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}
+
+void UringPrepSend(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len, int flags, void *user_data) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->msg_flags = flags;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}
+
+void UringPrepSendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, int flags, void *user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}
+
+void UringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, size_t len, size_t offset, void *user_data) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}
+
+void UringPrepAccept(struct io_uring_sqe *sqe, int fd, int flags, void *user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = flags;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}
+
+void UringPrepNop(struct io_uring_sqe *sqe, void *user_data) {
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = (unsigned long long) (uintptr_t) user_data;
+}